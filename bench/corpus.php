@@ -0,0 +1,215 @@
+<?php
+/**
+ * Payload corpus for bench/run.php.
+ *
+ * Every payload is built from a fixed seed, so the same corpus is produced on every run and every host.
+ * Each entry names the igbinary encoder/decoder paths that dominate it, so that a change to one of those
+ * functions can be checked against the payloads that exercise it.
+ */
+
+class BenchSleepEntity {
+	public $id;
+	public $name;
+	protected $email;
+	private $createdAt;
+	public $cacheOnly;
+
+	public function __construct($id, $name, $email, $createdAt) {
+		$this->id = $id;
+		$this->name = $name;
+		$this->email = $email;
+		$this->createdAt = $createdAt;
+		$this->cacheOnly = str_repeat('x', 32);
+	}
+
+	public function __sleep() {
+		return array('id', 'name', 'email', 'createdAt');
+	}
+}
+
+class BenchSerializableEntity implements Serializable {
+	public $id;
+	public $payload;
+
+	public function __construct($id, $payload) {
+		$this->id = $id;
+		$this->payload = $payload;
+	}
+
+	public function serialize() {
+		return $this->id . ':' . $this->payload;
+	}
+
+	public function unserialize($data) {
+		list($id, $payload) = explode(':', $data, 2);
+		$this->id = (int)$id;
+		$this->payload = $payload;
+	}
+}
+
+class BenchPlainEntity {
+	public $id;
+	public $title;
+	public $score;
+	public $tags;
+}
+
+function bench_random_word($min, $max) {
+	$len = mt_rand($min, $max);
+	$s = '';
+	for ($i = 0; $i < $len; $i++) {
+		$s .= chr(mt_rand(ord('a'), ord('z')));
+	}
+	return $s;
+}
+
+function bench_int_list() {
+	mt_srand(1);
+	$result = array();
+	for ($i = 0; $i < 100000; $i++) {
+		$result[] = mt_rand(-100000000, 100000000);
+	}
+	return $result;
+}
+
+function bench_double_list() {
+	mt_srand(2);
+	$result = array();
+	for ($i = 0; $i < 50000; $i++) {
+		$result[] = mt_rand() / mt_getrandmax() * 1000.0;
+	}
+	return $result;
+}
+
+function bench_config_map() {
+	mt_srand(3);
+	$result = array();
+	for ($i = 0; $i < 2000; $i++) {
+		$section = array();
+		for ($j = 0; $j < 10; $j++) {
+			$section[bench_random_word(4, 16)] = mt_rand(0, 1) ? bench_random_word(1, 40) : mt_rand();
+		}
+		$result['section_' . $i] = $section;
+	}
+	return $result;
+}
+
+function bench_nested_tree($depth, $fanout) {
+	if ($depth === 0) {
+		return array('leaf' => mt_rand(), 'label' => bench_random_word(3, 8));
+	}
+	$node = array();
+	for ($i = 0; $i < $fanout; $i++) {
+		$node['child' . $i] = bench_nested_tree($depth - 1, $fanout);
+	}
+	return $node;
+}
+
+function bench_nested() {
+	mt_srand(4);
+	return bench_nested_tree(7, 4);
+}
+
+function bench_sleep_objects() {
+	mt_srand(5);
+	$result = array();
+	for ($i = 0; $i < 10000; $i++) {
+		$result[] = new BenchSleepEntity($i, bench_random_word(5, 20), bench_random_word(5, 12) . '@example.com', 1500000000 + $i);
+	}
+	return $result;
+}
+
+function bench_serializable_objects() {
+	mt_srand(6);
+	$result = array();
+	for ($i = 0; $i < 10000; $i++) {
+		$result[] = new BenchSerializableEntity($i, bench_random_word(10, 60));
+	}
+	return $result;
+}
+
+function bench_plain_objects() {
+	mt_srand(7);
+	$result = array();
+	for ($i = 0; $i < 10000; $i++) {
+		$o = new BenchPlainEntity();
+		$o->id = $i;
+		$o->title = bench_random_word(5, 30);
+		$o->score = mt_rand() / mt_getrandmax();
+		$o->tags = array('tag' . mt_rand(0, 20), 'tag' . mt_rand(0, 20));
+		$result[] = $o;
+	}
+	return $result;
+}
+
+function bench_repeated_strings() {
+	mt_srand(8);
+	$vocabulary = array();
+	for ($i = 0; $i < 64; $i++) {
+		$vocabulary[] = bench_random_word(8, 24);
+	}
+	$result = array();
+	for ($i = 0; $i < 50000; $i++) {
+		$result[] = $vocabulary[mt_rand(0, 63)];
+	}
+	return $result;
+}
+
+/**
+ * @return array<string,array{build:callable,paths:string}>
+ */
+function bench_corpus() {
+	return array(
+		'int_list' => array(
+			'build' => 'bench_int_list',
+			'paths' => 'serialize_array, serialize_int64 / unserialize_array, unserialize_long',
+		),
+		'double_list' => array(
+			'build' => 'bench_double_list',
+			'paths' => 'serialize_double, serialize64 / unserialize_double, unserialize64',
+		),
+		'config_map' => array(
+			'build' => 'bench_config_map',
+			'paths' => 'serialize_array_key, serialize_string / unserialize_array_key, unserialize_chararray',
+		),
+		'nested' => array(
+			'build' => 'bench_nested',
+			'paths' => 'serialize_array_ref, hash_si_ptr / unserialize_array, references',
+		),
+		'sleep_objects' => array(
+			'build' => 'bench_sleep_objects',
+			'paths' => 'serialize_object (__sleep) / unserialize_object, unserialize_object_prop',
+		),
+		'serializable_objects' => array(
+			'build' => 'bench_serializable_objects',
+			'paths' => 'serialize_object_serialize_data / unserialize_object_ser',
+		),
+		'plain_objects' => array(
+			'build' => 'bench_plain_objects',
+			'paths' => 'serialize_object (toArray) / unserialize_object, unserialize_object_prop',
+		),
+		'repeated_strings' => array(
+			'build' => 'bench_repeated_strings',
+			'paths' => 'serialize_string (string ids) / unserialize_string',
+		),
+	);
+}
+
+/** Counts the values in a payload: every scalar, array and object counts as one. */
+function bench_count_values($value) {
+	if (is_array($value)) {
+		$count = 1;
+		foreach ($value as $v) {
+			$count += bench_count_values($v);
+		}
+		return $count;
+	}
+	if (is_object($value)) {
+		$count = 1;
+		foreach ((array)$value as $v) {
+			$count += bench_count_values($v);
+		}
+		return $count;
+	}
+	return 1;
+}
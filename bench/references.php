@@ -0,0 +1,80 @@
+<?php
+/**
+ * Reference table microbenchmark.
+ *
+ * Usage: hhvm bench/references.php [--min-time=seconds]
+ *
+ * Serializes graphs of N objects where every object is referenced twice, for increasing N.
+ * Every array and object goes through the serializer's pointer table (hash_si_ptr) once as an insert
+ * and every repeated object once more as a lookup, so ns/object should stay roughly flat as N grows
+ * until the table no longer fits in the CPU caches.
+ *
+ * It then serializes lists of N arrays which are only held by the list. These can't be repeated,
+ * so they are given reference ids without going through the table, and ns/array should stay flat for any N.
+ */
+
+class BenchNode {
+	public $id;
+	public $peer;
+}
+
+function bench_references_graph($n) {
+	$nodes = array();
+	for ($i = 0; $i < $n; $i++) {
+		$node = new BenchNode();
+		$node->id = $i;
+		$nodes[] = $node;
+	}
+	// Link each node to a pseudo-random earlier node, so lookups don't hit the table in insertion order.
+	for ($i = 1; $i < $n; $i++) {
+		$nodes[$i]->peer = $nodes[($i * 7919) % $i];
+	}
+	return $nodes;
+}
+
+function bench_references_unique_arrays($n) {
+	$arrays = array();
+	for ($i = 0; $i < $n; $i++) {
+		$arrays[] = array('id' => $i, 'tags' => array($i, $i + 1));
+	}
+	return $arrays;
+}
+
+function bench_references_measure($value, $min_time) {
+	$iterations = 0;
+	$start = microtime(true);
+	do {
+		igbinary_serialize($value);
+		$iterations++;
+		$elapsed = microtime(true) - $start;
+	} while ($elapsed < $min_time);
+	return $elapsed / $iterations;
+}
+
+function bench_references_main($argv) {
+	$min_time = 0.5;
+	foreach (array_slice($argv, 1) as $arg) {
+		if (preg_match('/^--min-time=(.*)$/', $arg, $m)) {
+			$min_time = (float)$m[1];
+		} else {
+			fwrite(STDERR, "Unknown option $arg\n");
+			exit(1);
+		}
+	}
+	printf("%10s %12s %10s\n", 'objects', 'bytes', 'ns/object');
+	foreach (array(1000, 10000, 100000, 1000000) as $n) {
+		$graph = bench_references_graph($n);
+		$bytes = strlen(igbinary_serialize($graph));
+		printf("%10d %12d %10.1f\n", $n, $bytes, bench_references_measure($graph, $min_time) / $n * 1e9);
+		unset($graph);
+	}
+	printf("\n%10s %12s %10s\n", 'arrays', 'bytes', 'ns/array');
+	foreach (array(1000, 10000, 100000, 1000000) as $n) {
+		$arrays = bench_references_unique_arrays($n);
+		$bytes = strlen(igbinary_serialize($arrays));
+		printf("%10d %12d %10.1f\n", $n, $bytes, bench_references_measure($arrays, $min_time) / $n * 1e9);
+		unset($arrays);
+	}
+}
+
+bench_references_main($argv);
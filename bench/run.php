@@ -0,0 +1,165 @@
+<?php
+/**
+ * Serialize/unserialize throughput benchmark.
+ *
+ * Usage: hhvm bench/run.php [--filter=payload[,payload]] [--codecs=igbinary,serialize,...]
+ *                           [--min-time=seconds] [--output=file] [--php-args="..."]
+ *
+ * Every (payload, codec, direction) combination runs in a fresh child process, so that the reported
+ * peak memory belongs to that combination alone. The payloads are described in bench/corpus.php.
+ *
+ * Columns:
+ * - bytes:   Length of the encoded payload for that codec.
+ * - MB/s:    Encoded bytes produced or consumed per second.
+ * - ns/val:  Nanoseconds per value, where every scalar, array and object counts as one value.
+ * - peak KB: Growth of memory_get_peak_usage() over the memory in use once the input was ready.
+ */
+
+require_once __DIR__ . '/corpus.php';
+
+function bench_codecs() {
+	return array(
+		'igbinary' => array(
+			'available' => function_exists('igbinary_serialize'),
+			'encode' => function ($v) { return igbinary_serialize($v); },
+			'decode' => function ($s) { return igbinary_unserialize($s); },
+		),
+		'serialize' => array(
+			'available' => true,
+			'encode' => function ($v) { return serialize($v); },
+			'decode' => function ($s) { return unserialize($s); },
+		),
+		'fb_serialize' => array(
+			'available' => function_exists('fb_serialize'),
+			'encode' => function ($v) { return fb_serialize($v); },
+			'decode' => function ($s) { $success = false; return fb_unserialize($s, $success); },
+		),
+		'json' => array(
+			'available' => true,
+			'encode' => function ($v) { return json_encode($v); },
+			'decode' => function ($s) { return json_decode($s, true); },
+		),
+	);
+}
+
+function bench_parse_options($argv) {
+	$options = array(
+		'filter' => null,
+		'codecs' => null,
+		'min-time' => 0.5,
+		'output' => null,
+		'php-args' => null,
+		'child' => false,
+		'payload' => null,
+		'codec' => null,
+		'direction' => null,
+	);
+	foreach (array_slice($argv, 1) as $arg) {
+		if ($arg === '--child') {
+			$options['child'] = true;
+			continue;
+		}
+		if (!preg_match('/^--([a-z-]+)=(.*)$/', $arg, $m) || !array_key_exists($m[1], $options)) {
+			fwrite(STDERR, "Unknown option $arg\n");
+			exit(1);
+		}
+		$options[$m[1]] = $m[2];
+	}
+	return $options;
+}
+
+/** Runs $fn until at least $min_time seconds have passed, returning the mean seconds per call. */
+function bench_time($fn, $arg, $min_time) {
+	$fn($arg);  // warm up
+	$iterations = 0;
+	$start = microtime(true);
+	do {
+		$fn($arg);
+		$iterations++;
+		$elapsed = microtime(true) - $start;
+	} while ($elapsed < $min_time);
+	return $elapsed / $iterations;
+}
+
+/** Runs a single (payload, codec, direction) combination in this process and prints the result as JSON. */
+function bench_child($payload_name, $codec_name, $direction, $min_time) {
+	$corpus = bench_corpus();
+	$codec = bench_codecs()[$codec_name];
+	$build = $corpus[$payload_name]['build'];
+	$value = $build();
+	$values = bench_count_values($value);
+	$encoded = call_user_func($codec['encode'], $value);
+	if ($direction === 'decode') {
+		unset($value);
+		$input = $encoded;
+		$fn = $codec['decode'];
+	} else {
+		$input = $value;
+		unset($value);
+		$fn = $codec['encode'];
+	}
+	$baseline = memory_get_usage();
+	$seconds = bench_time($fn, $input, $min_time);
+	$peak = memory_get_peak_usage() - $baseline;
+	echo json_encode(array(
+		'bytes' => strlen($encoded),
+		'values' => $values,
+		'seconds' => $seconds,
+		'peak' => max(0, $peak),
+	)), "\n";
+}
+
+function bench_default_php_args() {
+	$so = dirname(__DIR__) . '/igbinary.so';
+	if (defined('HHVM_VERSION') && is_file($so)) {
+		return '-d hhvm.dynamic_extension_path=' . escapeshellarg(dirname($so)) .
+			' -d ' . escapeshellarg('hhvm.dynamic_extensions[igbinary]=igbinary.so');
+	}
+	return '';
+}
+
+function bench_main($argv) {
+	$options = bench_parse_options($argv);
+	if ($options['child']) {
+		bench_child($options['payload'], $options['codec'], $options['direction'], (float)$options['min-time']);
+		return;
+	}
+	$php_args = $options['php-args'] !== null ? $options['php-args'] : bench_default_php_args();
+	$payloads = array_keys(bench_corpus());
+	if ($options['filter'] !== null) {
+		$payloads = array_intersect($payloads, explode(',', $options['filter']));
+	}
+	$codecs = bench_codecs();
+	$codec_names = $options['codecs'] !== null ? explode(',', $options['codecs']) : array_keys($codecs);
+
+	$lines = array();
+	$lines[] = sprintf("%-22s %-13s %-7s %10s %9s %9s %10s", 'payload', 'codec', 'dir', 'bytes', 'MB/s', 'ns/val', 'peak KB');
+	foreach ($payloads as $payload) {
+		foreach ($codec_names as $codec) {
+			if (!isset($codecs[$codec]) || !$codecs[$codec]['available']) {
+				continue;
+			}
+			foreach (array('encode', 'decode') as $direction) {
+				$cmd = sprintf('%s %s %s --child --payload=%s --codec=%s --direction=%s --min-time=%s',
+					escapeshellarg(PHP_BINARY), $php_args, escapeshellarg(__FILE__),
+					escapeshellarg($payload), escapeshellarg($codec), $direction, escapeshellarg($options['min-time']));
+				$result = json_decode(trim((string)shell_exec($cmd)), true);
+				if (!is_array($result)) {
+					$lines[] = sprintf("%-22s %-13s %-7s %s", $payload, $codec, $direction, 'FAILED');
+				} else {
+					$lines[] = sprintf("%-22s %-13s %-7s %10d %9.1f %9.1f %10d",
+						$payload, $codec, $direction, $result['bytes'],
+						$result['bytes'] / $result['seconds'] / 1e6,
+						$result['seconds'] * 1e9 / $result['values'],
+						$result['peak'] / 1024);
+				}
+				echo end($lines), "\n";
+			}
+		}
+	}
+	if ($options['output'] !== null) {
+		file_put_contents($options['output'], implode("\n", $lines) . "\n");
+	}
+}
+
+bench_main($argv);
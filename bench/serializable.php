@@ -0,0 +1,202 @@
+<?php
+/**
+ * Serializable payload benchmark.
+ *
+ * Usage: hhvm bench/serializable.php [--rounds=N] [--objects=N] [--payload-bytes=N]
+ *        hhvm bench/serializable.php --server [--so=path] [--baseline-so=path] [--clients=1,2,4,8]
+ *                                    [--requests=N] [--port=N] [--objects=N] [--payload-bytes=N]
+ *
+ * Unserializes arrays of Serializable objects whose serialize() payloads are different in every round,
+ * and reports ns/object and the growth of the process's resident memory (VmRSS) since the first round.
+ * The payloads are passed to unserialize() as request-local strings which are freed with the objects,
+ * so RSS growth should stay flat across rounds instead of growing by about objects * payload-bytes per round.
+ *
+ * With --server, this script starts `hhvm -m server` serving itself with each extension build (--so, and --baseline-so
+ * if given, e.g. built from the commit that still made every payload a static string), and sends --requests requests
+ * to it from each number of parallel clients in --clients. Each request unserializes payloads no request saw before.
+ * It reports requests/s, the speedup over one client, the mean ns/object of igbinary_unserialize in the server,
+ * and the server's RSS growth since the first request. When payloads are static strings, every request takes the
+ * process-wide static string table's lock for each object, so throughput stops scaling with the number of clients.
+ */
+
+class BenchSerializable implements Serializable {
+	public $payload;
+
+	public function __construct($payload) {
+		$this->payload = $payload;
+	}
+
+	public function serialize() {
+		return $this->payload;
+	}
+
+	public function unserialize($serialized) {
+		$this->payload = $serialized;
+	}
+}
+
+function bench_serializable_rss_kb() {
+	$status = @file_get_contents('/proc/self/status');
+	if ($status !== false && preg_match('/^VmRSS:\s+(\d+) kB/m', $status, $m)) {
+		return (int)$m[1];
+	}
+	return 0;
+}
+
+function bench_serializable_blob($round, $objects, $payload_bytes) {
+	$values = array();
+	for ($i = 0; $i < $objects; $i++) {
+		$prefix = "$round:$i:";
+		$values[] = new BenchSerializable($prefix . str_repeat('x', max(0, $payload_bytes - strlen($prefix))));
+	}
+	return igbinary_serialize($values);
+}
+
+/** Handles one request of the --server benchmark: unserializes payloads unique to this request, and prints the timing as JSON. */
+function bench_serializable_request() {
+	$objects = isset($_GET['objects']) ? (int)$_GET['objects'] : 1000;
+	$payload_bytes = isset($_GET['payload_bytes']) ? (int)$_GET['payload_bytes'] : 100;
+	$blob = bench_serializable_blob(bin2hex(random_bytes(8)), $objects, $payload_bytes);
+	$start = microtime(true);
+	$values = igbinary_unserialize($blob);
+	$elapsed = microtime(true) - $start;
+	unset($values, $blob);
+	echo json_encode(array('ns' => $elapsed / $objects * 1e9, 'rss' => bench_serializable_rss_kb()));
+}
+
+/** Sends $count requests to $url with $clients of them in flight at a time. Returns the seconds taken and the decoded responses. */
+function bench_serializable_drive($url, $clients, $count) {
+	$multi = curl_multi_init();
+	$responses = array();
+	$sent = 0;
+	$running = 0;
+	$start = microtime(true);
+	do {
+		while ($sent < $count && $running < $clients) {
+			$ch = curl_init($url);
+			curl_setopt($ch, CURLOPT_RETURNTRANSFER, true);
+			curl_multi_add_handle($multi, $ch);
+			$sent++;
+			$running++;
+		}
+		curl_multi_exec($multi, $active);
+		curl_multi_select($multi, 0.01);
+		while (($info = curl_multi_info_read($multi)) !== false) {
+			$ch = $info['handle'];
+			$response = json_decode(curl_multi_getcontent($ch), true);
+			if (!is_array($response)) {
+				fwrite(STDERR, "Bad response from $url\n");
+				exit(1);
+			}
+			$responses[] = $response;
+			curl_multi_remove_handle($multi, $ch);
+			curl_close($ch);
+			$running--;
+		}
+	} while ($running > 0 || $sent < $count);
+	$elapsed = microtime(true) - $start;
+	curl_multi_close($multi);
+	return array($elapsed, $responses);
+}
+
+/** Starts `hhvm -m server` serving this directory with the extension at $so, and returns once it answers. */
+function bench_serializable_start_server($so, $port, $threads) {
+	$cmd = 'exec ' . escapeshellarg(PHP_BINARY) . ' -m server -p ' . (int)$port .
+		' -d ' . escapeshellarg('hhvm.server.source_root=' . __DIR__) .
+		' -d ' . escapeshellarg('hhvm.server.thread_count=' . (int)$threads) .
+		' -d hhvm.dynamic_extension_path=' . escapeshellarg(dirname($so)) .
+		' -d ' . escapeshellarg('hhvm.dynamic_extensions[igbinary]=' . basename($so)) .
+		' -d hhvm.log.file=/dev/null';
+	$proc = proc_open($cmd, array(1 => array('file', '/dev/null', 'w'), 2 => array('file', '/dev/null', 'w')), $pipes);
+	$url = "http://127.0.0.1:$port/" . basename(__FILE__) . '?objects=1';
+	for ($i = 0; $i < 300; $i++) {
+		if (@file_get_contents($url) !== false) {
+			return $proc;
+		}
+		usleep(100000);
+	}
+	fwrite(STDERR, "hhvm -m server with $so didn't start\n");
+	proc_terminate($proc);
+	exit(1);
+}
+
+function bench_serializable_server($options) {
+	$builds = array('current' => $options['so']);
+	if ($options['baseline-so'] !== null) {
+		$builds = array('baseline' => $options['baseline-so']) + $builds;
+	}
+	$clients_list = array_map('intval', explode(',', $options['clients']));
+	$url = "http://127.0.0.1:{$options['port']}/" . basename(__FILE__) .
+		"?objects={$options['objects']}&payload_bytes={$options['payload-bytes']}";
+	printf("%-8s %7s %10s %8s %10s %14s\n", 'build', 'clients', 'req/s', 'speedup', 'ns/object', 'RSS growth KB');
+	foreach ($builds as $build => $so) {
+		$proc = bench_serializable_start_server($so, $options['port'], max($clients_list));
+		list(, $warmup) = bench_serializable_drive($url, 1, 10);
+		$base_rss = $warmup[count($warmup) - 1]['rss'];
+		$single = null;
+		foreach ($clients_list as $clients) {
+			list($elapsed, $responses) = bench_serializable_drive($url, $clients, $options['requests']);
+			$throughput = count($responses) / $elapsed;
+			if ($single === null) {
+				$single = $throughput;
+			}
+			$ns = array_sum(array_map(function ($r) { return $r['ns']; }, $responses)) / count($responses);
+			$rss = max(array_map(function ($r) { return $r['rss']; }, $responses));
+			printf("%-8s %7d %10.1f %7.2fx %10.1f %14d\n", $build, $clients, $throughput, $throughput / $single, $ns, $rss - $base_rss);
+		}
+		proc_terminate($proc);
+		proc_close($proc);
+	}
+}
+
+function bench_serializable_main($argv) {
+	$options = array(
+		'rounds' => 10,
+		'objects' => 10000,
+		'payload-bytes' => 100,
+		'server' => false,
+		'so' => dirname(__DIR__) . '/igbinary.so',
+		'baseline-so' => null,
+		'clients' => '1,2,4,8',
+		'requests' => 200,
+		'port' => 8089,
+	);
+	foreach (array_slice($argv, 1) as $arg) {
+		if ($arg === '--server') {
+			$options['server'] = true;
+			continue;
+		}
+		if (!preg_match('/^--([a-z-]+)=(.*)$/', $arg, $m) || !array_key_exists($m[1], $options) || $m[1] === 'server') {
+			fwrite(STDERR, "Unknown option $arg\n");
+			exit(1);
+		}
+		$options[$m[1]] = is_int($options[$m[1]]) ? (int)$m[2] : $m[2];
+	}
+	if ($options['server']) {
+		bench_serializable_server($options);
+		return;
+	}
+	$rounds = $options['rounds'];
+	$objects = $options['objects'];
+	$payload_bytes = $options['payload-bytes'];
+	printf("%6s %10s %14s\n", 'round', 'ns/object', 'RSS growth KB');
+	$base_rss = null;
+	for ($round = 0; $round < $rounds; $round++) {
+		$blob = bench_serializable_blob($round, $objects, $payload_bytes);
+		$start = microtime(true);
+		$values = igbinary_unserialize($blob);
+		$elapsed = microtime(true) - $start;
+		unset($values, $blob);
+		$rss = bench_serializable_rss_kb();
+		if ($base_rss === null) {
+			$base_rss = $rss;
+		}
+		printf("%6d %10.1f %14d\n", $round, $elapsed / $objects * 1e9, $rss - $base_rss);
+	}
+}
+
+if (php_sapi_name() === 'cli') {
+	bench_serializable_main($argv);
+} else {
+	bench_serializable_request();
+}
@@ -1,2 +1,2 @@
-HHVM_EXTENSION(igbinary ext_igbinary.cpp igbinary_serializer.cpp igbinary_unserializer.cpp hash_si_ptr.cpp igbinary_utils.cpp)
+HHVM_EXTENSION(igbinary ext_igbinary.cpp igbinary_serializer.cpp igbinary_unserializer.cpp hash_si_ptr.cpp igbinary_utils.cpp igbinary_string_intern.cpp igbinary_class_layout.cpp igbinary_dataset.cpp igbinary_dictionary.cpp igbinary_compress.cpp igbinary_fragment_cache.cpp igbinary_shared.cpp igbinary_schema.cpp)
 HHVM_SYSTEMLIB(igbinary ext_igbinary.php)
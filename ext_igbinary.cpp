@@ -11,15 +11,40 @@
 /* Same as equivalent php version? */
 #define IGBINARY_HHVM_VERSION "1.2.5-dev"
 
+#include <algorithm>
+
 #include "ext_igbinary.hpp"
+#include "igbinary_dictionary.hpp"
 
+#include "hphp/runtime/base/file.h"
 #include "hphp/runtime/ext/extension.h"
 #include "hphp/runtime/ext/extension-registry.h"
 
 namespace HPHP {
 
-Variant HHVM_FUNCTION(igbinary_serialize, const Variant &var) {
-	return igbinary_serialize(var);
+Variant HHVM_FUNCTION(igbinary_serialize, const Variant &var, int64_t dictionary_id) {
+	if (dictionary_id < 0 || dictionary_id > IGBINARY_DICTIONARY_MAX_ID) {
+		raise_warning("igbinary_serialize(): dictionary_id must be between 0 and %d", IGBINARY_DICTIONARY_MAX_ID);
+		return false;
+	}
+	return igbinary_serialize(var, (uint32_t) dictionary_id);
+}
+
+Variant HHVM_FUNCTION(igbinary_serialized_size, const Variant &var) {
+	return igbinary_serialized_size(var);
+}
+
+Variant HHVM_FUNCTION(igbinary_serialize_to_stream, const Resource &stream, const Variant &var, int64_t chunk_size) {
+	auto file = dyn_cast_or_null<File>(stream);
+	if (!file || file->isClosed()) {
+		raise_warning("igbinary_serialize_to_stream(): Expected a stream resource that is open");
+		return false;
+	}
+	if (chunk_size <= 0) {
+		raise_warning("igbinary_serialize_to_stream(): chunk_size must be greater than 0");
+		return false;
+	}
+	return igbinary_serialize_to_stream(var, file.get(), (size_t) chunk_size);
 }
 
 Variant HHVM_FUNCTION(igbinary_unserialize, const String &serialized) {
@@ -36,9 +61,72 @@ Variant HHVM_FUNCTION(igbinary_unserialize, const String &serialized) {
 	// }
 }
 
+Variant HHVM_FUNCTION(igbinary_unserialize_shared, const String &serialized) {
+	if (serialized.size() <= 0) {
+		return init_null();
+	}
+	return igbinary_unserialize_shared(serialized);
+}
+
+Variant HHVM_FUNCTION(igbinary_unserialize_iter, const String &serialized) {
+	return igbinary_unserialize_iter(serialized);
+}
+
+Variant HHVM_FUNCTION(igbinary_unserialize_path, const String &serialized, const Array &path) {
+	if (serialized.size() <= 0) {
+		return init_null();
+	}
+	return igbinary_unserialize_path(reinterpret_cast<const uint8_t*>(serialized.data()), serialized.size(), path);
+}
+
+Variant HHVM_FUNCTION(igbinary_validate, const String &serialized, const Array &limits) {
+	return igbinary_validate(reinterpret_cast<const uint8_t*>(serialized.data()), serialized.size(), limits);
+}
+
+Variant HHVM_FUNCTION(igbinary_dataset_write, const String &path, const Array &serialized) {
+	return igbinary_dataset_write(path, serialized);
+}
+
+Variant HHVM_FUNCTION(igbinary_dataset_get, const String &path, const Variant &key) {
+	if (!key.isString() && !key.isInteger()) {
+		raise_warning("igbinary_dataset_get(): Expected the key to be an int or a string");
+		return false;
+	}
+	return igbinary_dataset_get(path, key.toString());
+}
+
+bool HHVM_FUNCTION(igbinary_dataset_close, const String &path) {
+	return igbinary_dataset_close(path);
+}
+
+Variant HHVM_FUNCTION(igbinary_dictionary_register, int64_t id, const Array &strings) {
+	return igbinary_dictionary_register(id, strings);
+}
+
+Variant HHVM_FUNCTION(igbinary_dictionary_train, const Array &samples, int64_t max_strings) {
+	return igbinary_dictionary_train(samples, max_strings);
+}
+
+Variant HHVM_FUNCTION(igbinary_schema_register, const String &class_name, const Array &properties, int64_t version) {
+	return igbinary_schema_register(class_name, properties, version);
+}
+
 struct Igbinary {
   public:
 	bool compact_strings{true};
+	/** Tracks the sizes of the arrays and objects this thread serialized recently, see igbinary_record_serialized_size. */
+	uint32_t serialize_size_hint{0};
+	/** igbinary.context_high_water_mark, see igbinary_context_high_water_mark. */
+	int64_t context_high_water_mark{256 * 1024};
+	/** igbinary.compression_threshold, see igbinary_compression_threshold. */
+	int64_t compression_threshold{0};
+	/** igbinary.index_threshold, see igbinary_index_threshold. */
+	int64_t index_threshold{0};
+	bool index_keys{true};
+	/** igbinary.static_array_cache_size, see igbinary_static_array_cache_size. */
+	int64_t static_array_cache_size{0};
+	/** igbinary.shared_cache_size, see igbinary_shared_cache_size. */
+	int64_t shared_cache_size{0};
 };
 
 const StaticString s_igbinary_ext_name("igbinary");
@@ -49,12 +137,73 @@ bool igbinary_should_compact_strings() {
 	return s_igbinary->compact_strings;
 }
 
+uint32_t igbinary_serialize_size_hint() {
+	// A larger buffer wouldn't be kept by the pooled context, so each call would allocate and free it.
+	return (uint32_t) std::min<size_t>(s_igbinary->serialize_size_hint, igbinary_context_high_water_mark());
+}
+
+size_t igbinary_context_high_water_mark() {
+	const int64_t mark = s_igbinary->context_high_water_mark;
+	return mark > 0 ? (size_t) mark : 0;
+}
+
+size_t igbinary_compression_threshold() {
+	const int64_t threshold = s_igbinary->compression_threshold;
+	return threshold > 0 ? (size_t) threshold : 0;
+}
+
+uint32_t igbinary_index_threshold() {
+	const int64_t threshold = s_igbinary->index_threshold;
+	return threshold > 0 ? (uint32_t) std::min<int64_t>(threshold, UINT32_MAX) : 0;
+}
+
+bool igbinary_should_index_keys() {
+	return s_igbinary->index_keys;
+}
+
+size_t igbinary_shared_cache_size() {
+	const int64_t size = s_igbinary->shared_cache_size;
+	return size > 0 ? (size_t) size : 0;
+}
+
+size_t igbinary_static_array_cache_size() {
+	const int64_t size = s_igbinary->static_array_cache_size;
+	return size > 0 ? (size_t) size : 0;
+}
+
+void igbinary_record_serialized_size(size_t size) {
+	uint32_t& hint = s_igbinary->serialize_size_hint;
+	if (size > IGBINARY_SIZE_HINT_MAX) {
+		size = IGBINARY_SIZE_HINT_MAX;
+	}
+	// The hint drops to smaller payloads at once, and grows by 1/4 of the difference for larger ones,
+	// so that an occasional large payload doesn't make the small calls after it reserve more than they need.
+	if (size <= hint) {
+		hint = (uint32_t) size;
+	} else {
+		hint += ((uint32_t) size - hint) / 4;
+	}
+}
+
 static class IgbinaryExtension : public Extension {
   public:
 	IgbinaryExtension() : Extension("igbinary", IGBINARY_HHVM_VERSION) {}
 	void moduleInit() override {
 		HHVM_FE(igbinary_serialize);
+		HHVM_FE(igbinary_serialized_size);
+		HHVM_FE(igbinary_serialize_to_stream);
 		HHVM_FE(igbinary_unserialize);
+		HHVM_FE(igbinary_unserialize_shared);
+		HHVM_FE(igbinary_unserialize_iter);
+		HHVM_FE(igbinary_unserialize_path);
+		HHVM_FE(igbinary_validate);
+		HHVM_FE(igbinary_dataset_write);
+		HHVM_FE(igbinary_dataset_get);
+		HHVM_FE(igbinary_dataset_close);
+		HHVM_FE(igbinary_dictionary_register);
+		HHVM_FE(igbinary_dictionary_train);
+		HHVM_FE(igbinary_schema_register);
+		igbinary_iterator_module_init();
 
 		loadSystemlib();
 	}
@@ -67,6 +216,25 @@ static class IgbinaryExtension : public Extension {
 		IniSetting::Bind(ext, IniSetting::PHP_INI_ALL,
 		                 "igbinary.compact_strings", "1",
 		                 &s_igbinary->compact_strings);
+		IniSetting::Bind(ext, IniSetting::PHP_INI_ALL,
+		                 "igbinary.compression_threshold", "0",
+		                 &s_igbinary->compression_threshold);
+		IniSetting::Bind(ext, IniSetting::PHP_INI_ALL,
+		                 "igbinary.context_high_water_mark", "262144",
+		                 &s_igbinary->context_high_water_mark);
+		IniSetting::Bind(ext, IniSetting::PHP_INI_ALL,
+		                 "igbinary.index_threshold", "0",
+		                 &s_igbinary->index_threshold);
+		IniSetting::Bind(ext, IniSetting::PHP_INI_ALL,
+		                 "igbinary.index_keys", "1",
+		                 &s_igbinary->index_keys);
+		IniSetting::Bind(ext, IniSetting::PHP_INI_ALL,
+		                 "igbinary.static_array_cache_size", "0",
+		                 &s_igbinary->static_array_cache_size);
+		// The cache is shared by the whole process, so a request can't change its size.
+		IniSetting::Bind(ext, IniSetting::PHP_INI_SYSTEM,
+		                 "igbinary.shared_cache_size", "0",
+		                 &s_igbinary->shared_cache_size);
 	}
 
 	void threadShutdown() override {
@@ -22,9 +22,17 @@
 #include "hphp/runtime/base/type-variant.h"
 
 #define IGBINARY_FORMAT_VERSION 0x00000002
+/** Bits of the version header which are flags, rather than the version. Older versions reject any of them. */
+#define IGBINARY_FLAGS_MASK 0xffff0000
+/** Flag in the version header: A dictionary id follows. See igbinary_dictionary.hpp. */
+#define IGBINARY_FLAG_DICTIONARY 0x00010000
+/** Flag in the version header: The rest of the data is compressed. See igbinary_compress.hpp. */
+#define IGBINARY_FLAG_COMPRESSED 0x00020000
 
 namespace HPHP {
 
+struct File;
+
 /* {{{ Types */
 enum igbinary_type {
 	/* 00 */ igbinary_type_null,			/**< Null. */
@@ -79,6 +87,25 @@ enum igbinary_type {
 	/* 24 */ igbinary_type_objref32,		/**< Object reference. */
 
 	/* 25 */ igbinary_type_ref,				/**< Simple reference */
+
+	/* 26 */ igbinary_type_indexed,			/**< Array or object with its length and a key table. See igbinary_indexed.hpp. */
+
+	// These also follow the class name of a collection, instead of its properties.
+	/* 27 */ igbinary_type_vec8,			/**< Hack vec: its values, without keys. */
+	/* 28 */ igbinary_type_vec16,			/**< Hack vec. */
+	/* 29 */ igbinary_type_vec32,			/**< Hack vec. */
+
+	/* 2a */ igbinary_type_dict8,			/**< Hack dict: its keys and values, like an array. */
+	/* 2b */ igbinary_type_dict16,			/**< Hack dict. */
+	/* 2c */ igbinary_type_dict32,			/**< Hack dict. */
+
+	/* 2d */ igbinary_type_keyset8,			/**< Hack keyset: its keys, without values. */
+	/* 2e */ igbinary_type_keyset16,		/**< Hack keyset. */
+	/* 2f */ igbinary_type_keyset32,		/**< Hack keyset. */
+
+	/* 30 */ igbinary_type_object_schema8,	/**< Object with a registered schema: its property values in the schema's order. See igbinary_schema.hpp. */
+	/* 31 */ igbinary_type_object_schema16,	/**< Object with a registered schema. */
+	/* 32 */ igbinary_type_object_schema32,	/**< Object with a registered schema. */
 };
 /* }}} */
 
@@ -90,10 +117,118 @@ class IgbinaryWarning : public Exception {
 void throw_igbinary_exception(const char* fmt, ...) ATTRIBUTE_PRINTF(1,2);
 /** Return the serialized data, or throw an Exception */
 void igbinary_unserialize(const uint8_t *buf, size_t buf_len, Variant& result);
-/** Unserialize the data, or clean up and throw an Exception. Effectively constant, unless __sleep modifies something. */
-Variant igbinary_serialize(const Variant& variant);
+/**
+ * Returns an IgbinaryIterator over the top-level array of serialized, which unserializes one element at a time,
+ * or false (after a warning) if serialized isn't a valid serialized array.
+ */
+Variant igbinary_unserialize_iter(const String& serialized);
+/**
+ * Returns the value at path (a list of array keys and property names) inside the serialized value, or null if there is none.
+ * Other arrays and objects are skipped over instead of being unserialized.
+ */
+Variant igbinary_unserialize_path(const uint8_t *buf, size_t buf_len, const Array& path);
+/**
+ * Checks that buf would unserialize, without creating any values, autoloading classes or calling __wakeup.
+ * limits may set max_depth, max_elements and max_string_length.
+ * Returns the counts of elements, the nesting depth, string and reference ids and objects of each class,
+ * or false (after a warning) if the data is invalid or exceeds a limit.
+ */
+Variant igbinary_validate(const uint8_t *buf, size_t buf_len, const Array& limits);
+/**
+ * Writes a dataset file for igbinary_dataset_get, with the keys of serialized and its values (strings returned by igbinary_serialize).
+ * Returns the number of entries, or false (after a warning) on failure.
+ */
+Variant igbinary_dataset_write(const String& path, const Array& serialized);
+/**
+ * Returns the unserialized value of key in the dataset file at path, or null if there is none,
+ * or false (after a warning) if the file can't be used. Each file is mapped once per process, until igbinary_dataset_close.
+ */
+Variant igbinary_dataset_get(const String& path, const String& key);
+/**
+ * Forgets this process's mapping of the dataset file at path, so that the next igbinary_dataset_get maps the file again.
+ * The old mapping is unmapped once the requests which may be reading it have ended. Returns false if the file wasn't mapped.
+ */
+bool igbinary_dataset_close(const String& path);
+/**
+ * Registers a dictionary of strings under id (1 to IGBINARY_DICTIONARY_MAX_ID) for this process.
+ * Returns true, or false (after a warning) if the strings aren't valid or a different dictionary already has that id.
+ */
+Variant igbinary_dictionary_register(int64_t id, const Array& strings);
+/**
+ * Returns up to max_strings of the strings (keys, property names, class names and string values) which the most samples
+ * would serialize in full, most useful first, for igbinary_dictionary_register.
+ */
+Variant igbinary_dictionary_train(const Array& samples, int64_t max_strings);
+/**
+ * Registers version of the schema of class_name for this process: the names of all of its declared properties, in the order to serialize them.
+ * Instances without dynamic properties are then serialized as their property values in that order.
+ * Returns true, or false (after a warning) if the names don't match the class or a different schema already has that version.
+ */
+Variant igbinary_schema_register(const String& class_name, const Array& properties, int64_t version);
+/**
+ * Unserializes buf like igbinary_unserialize, but rejects objects and references, which can't be shared between requests.
+ * Returns false (after a warning, with result set to null) if the data is invalid or has either of them.
+ */
+bool igbinary_unserialize_values(const uint8_t *buf, size_t buf_len, Variant& result);
+/**
+ * Returns the unserialized value of serialized, from a process-wide LRU cache of arrays shared by all requests (like APC's)
+ * if it has been unserialized before. Returns false (after a warning) if it is invalid or has objects or references.
+ */
+Variant igbinary_unserialize_shared(const String& serialized);
+/** Registers the native methods and data of IgbinaryIterator. Called by moduleInit. */
+void igbinary_iterator_module_init();
+/**
+ * Unserialize the data, or clean up and throw an Exception. Effectively constant, unless __sleep modifies something.
+ * If dictionary_id isn't 0, strings in that registered dictionary are serialized as its string ids.
+ */
+Variant igbinary_serialize(const Variant& variant, uint32_t dictionary_id = 0);
+/**
+ * Returns the length of the string igbinary_serialize would return, or false (after a warning) if it would fail.
+ * Arrays and objects are serialized in chunks of IGBINARY_SERIALIZED_SIZE_CHUNK bytes which are then discarded,
+ * so __sleep and serialize() are called just as they would be by igbinary_serialize.
+ */
+Variant igbinary_serialized_size(const Variant& variant);
+/**
+ * Writes the same bytes as igbinary_serialize to stream, in chunks of around chunk_size bytes,
+ * and returns the number of bytes written, or false (after a warning) on failure.
+ * Only about one chunk is buffered at a time, so the payload may be larger than StringData::MaxSize.
+ */
+Variant igbinary_serialize_to_stream(const Variant& variant, File* stream, size_t chunk_size);
+
+/** Bytes of output igbinary_serialized_size keeps before discarding them. */
+#define IGBINARY_SERIALIZED_SIZE_CHUNK (64 * 1024)
+/** Upper bound on the initial capacity of the igbinary_serialize output buffer. */
+#define IGBINARY_SIZE_HINT_MAX (16 * 1024 * 1024)
 
 bool igbinary_should_compact_strings();
+/**
+ * Returns the initial capacity to use when serializing an array or object, learned from this thread's recent calls.
+ * It is at most igbinary_context_high_water_mark().
+ */
+uint32_t igbinary_serialize_size_hint();
+/** Records the size of a serialized array or object, for igbinary_serialize_size_hint. */
+void igbinary_record_serialized_size(size_t size);
+/** Returns igbinary.compression_threshold: igbinary_serialize compresses data of at least this many bytes (0 for none). */
+size_t igbinary_compression_threshold();
+/** Returns igbinary.index_threshold: arrays and objects with at least this many elements are serialized as indexed containers (0 for none). */
+uint32_t igbinary_index_threshold();
+/** Returns igbinary.index_keys: whether indexed containers get a key table. */
+bool igbinary_should_index_keys();
+/** Returns igbinary.shared_cache_size: the memory used by the arrays and serialized data igbinary_unserialize_shared keeps (0 for none). */
+size_t igbinary_shared_cache_size();
+/** Returns igbinary.static_array_cache_size: the bytes the process may use to cache the serialized form of static arrays (0 for none). */
+size_t igbinary_static_array_cache_size();
+/** Returns the number of bytes each table of a pooled serializer or unserializer context may keep between calls. */
+size_t igbinary_context_high_water_mark();
+
+/** Strings longer than this are never interned. */
+#define IGBINARY_INTERN_MAX_LENGTH 64
+/**
+ * Returns the existing static string with the given contents (e.g. a declared property name, a class name or a string literal),
+ * found through a bounded process-wide table, or a request-local copy if the process has no such static string or it is too long.
+ * Used for array keys, property names and class names, which repeat across requests. Never creates static strings.
+ */
+String igbinary_intern_string(const char* data, size_t len);
 }
 
 #endif
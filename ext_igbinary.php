@@ -1,7 +1,80 @@
 <?hh
 
 <<__Native>>
-function igbinary_serialize(mixed $input): mixed;
+function igbinary_serialize(mixed $input, int $dictionary_id = 0): mixed;
+
+<<__Native>>
+function igbinary_serialized_size(mixed $input): mixed;
+
+<<__Native>>
+function igbinary_serialize_to_stream(resource $stream, mixed $input, int $chunk_size = 65536): mixed;
 
 <<__Native>>
 function igbinary_unserialize(string $serialized): mixed;
+
+<<__Native>>
+function igbinary_unserialize_shared(string $serialized): mixed;
+
+<<__Native>>
+function igbinary_unserialize_iter(string $serialized): mixed;
+
+<<__Native>>
+function igbinary_unserialize_path(string $serialized, array $path): mixed;
+
+<<__Native>>
+function igbinary_validate(string $serialized, array $limits = []): mixed;
+
+<<__Native>>
+function igbinary_dataset_write(string $path, array $serialized): mixed;
+
+<<__Native>>
+function igbinary_dataset_get(string $path, mixed $key): mixed;
+
+<<__Native>>
+function igbinary_dataset_close(string $path): bool;
+
+<<__Native>>
+function igbinary_dictionary_register(int $id, array $strings): mixed;
+
+<<__Native>>
+function igbinary_dictionary_train(array $samples, int $max_strings = 1024): mixed;
+
+<<__Native>>
+function igbinary_schema_register(string $class_name, array $properties, int $version = 1): mixed;
+
+/**
+ * Writes a dataset file for igbinary_dataset_get() with the keys and values of $values (an array or Traversable).
+ * Values are serialized as they are read, so only their serialized forms are kept until the file is written.
+ * Returns the number of entries, or false on failure.
+ */
+function igbinary_dataset_build(string $path, mixed $values): mixed {
+	$serialized = array();
+	foreach ($values as $key => $value) {
+		$serialized[$key] = igbinary_serialize($value);
+	}
+	return igbinary_dataset_write($path, $serialized);
+}
+
+/**
+ * Iterates over the elements of a serialized array, unserializing one at a time.
+ * Returned by igbinary_unserialize_iter().
+ */
+<<__NativeData("IgbinaryIterator")>>
+final class IgbinaryIterator implements Iterator {
+	private function __construct() {}
+
+	<<__Native>>
+	public function current(): mixed;
+
+	<<__Native>>
+	public function key(): mixed;
+
+	<<__Native>>
+	public function next(): void;
+
+	<<__Native>>
+	public function rewind(): void;
+
+	<<__Native>>
+	public function valid(): bool;
+}
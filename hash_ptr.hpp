@@ -25,6 +25,11 @@
 // NULL converted to an integer, on sane platforms.
 #define HASH_PTR_KEY_INVALID 0
 
+/** Number of slots whose control bytes are compared at once. The capacity is always a multiple of this. */
+#define HASH_PTR_GROUP_SIZE 16
+/** Control byte of an empty slot. The control byte of a used slot is 7 bits of the key's hash, so the high bit is clear. */
+#define HASH_PTR_CTRL_EMPTY 0x80
+
 /** Key/value pair of hash_si_ptr.
  * @author Oleg Grenrus <oleg.grenrus@dynamoid.com>
  * @see hash_si_ptr
@@ -37,13 +42,17 @@ struct hash_si_ptr_pair
 
 /** Hash-array.
  * Like c++ std::unordered_map<uintptr_t, int32_t>, but does not allow HASH_PTR_KEY_INVALID as a key.
- * Current implementation uses linear probing.
+ * Current implementation is an open addressing table in the style of Swiss tables:
+ * Each slot has a control byte, and a lookup compares the control bytes of a group of HASH_PTR_GROUP_SIZE slots at once
+ * (with SSE2, where available) before comparing any keys. Groups are probed quadratically.
+ * Memory comes from the request heap.
  * @author Oleg Grenrus <oleg.grenrus@dynamoid.com>
  */
 struct hash_si_ptr {
-	size_t size; 					/**< Allocated size of array. */
+	size_t size; 					/**< Allocated size of array. A power of 2, and at least HASH_PTR_GROUP_SIZE. */
 	size_t used;					/**< Used size of array. */
 	struct hash_si_ptr_pair *data;		/**< Pointer to array or pairs of data. */
+	uint8_t *ctrl;					/**< Control bytes, one per pair. Allocated along with data. */
 };
 
 /** Inits hash_si_ptr structure.
@@ -59,6 +68,11 @@ int hash_si_ptr_init(struct hash_si_ptr *h, size_t size);
  */
 void hash_si_ptr_deinit(struct hash_si_ptr *h);
 
+/** Removes all entries from hash_si_ptr, keeping its capacity.
+ * @param h pointer to hash_si_ptr struct.
+ */
+void hash_si_ptr_clear(struct hash_si_ptr *h);
+
 /** Inserts value into hash_si_ptr.
  * @param h Pointer to hash_si_ptr struct.
  * @param key Pointer to key.
@@ -19,32 +19,71 @@
 
 #include <assert.h>
 
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+
 #include "hash_ptr.hpp"
 
-/* Function similar to inline_hash_func. This is not identical. */
-inline static uint32_t inline_hash_of_address(uintptr_t ptr) {
-	register uint32_t hash = 5381;
-	/* Note: Hash the least significant bytes first - Those need to influence the final result as much as possible. */
-	hash = ((hash << 5) + hash) + (ptr & 0xff);
-	hash = ((hash << 5) + hash) + ((ptr >> 8) & 0xff);
-	hash = ((hash << 5) + hash) + ((ptr >> 16) & 0xff);
-	hash = ((hash << 5) + hash) + ((ptr >> 24) & 0xff);
-#if SIZEOF_ZEND_LONG == 8
-	hash = ((hash << 5) + hash) + ((ptr >> 32) & 0xff);
-	hash = ((hash << 5) + hash) + ((ptr >> 40) & 0xff);
-	hash = ((hash << 5) + hash) + ((ptr >> 48) & 0xff);
-	hash = ((hash << 5) + hash) + ((ptr >> 56) & 0xff);
+#include "hphp/runtime/base/memory-manager.h"
+
+/* {{{ hash_of_address */
+/**
+ * Mixes all of the bits of the address into the result.
+ * Heap pointers are aligned, so their low bits are always 0. A multiplication by an odd constant moves the entropy
+ * of every bit of the key into the high bits of the product, and the xor folds those back into the low bits.
+ */
+inline static uint64_t hash_of_address(uintptr_t ptr) {
+	const uint64_t product = (uint64_t)ptr * UINT64_C(0x9e3779b97f4a7c15);
+	return product ^ (product >> 32);
+}
+/* }}} */
+/* {{{ hash_si_ptr_h2 */
+/** The 7 bits of the hash stored in the control byte of the key's slot. */
+inline static uint8_t hash_si_ptr_h2(uint64_t hv) {
+	return (uint8_t)(hv & 0x7f);
+}
+/* }}} */
+/* {{{ hash_si_ptr_first_group */
+/** The first group of slots to probe for a hash. Uses different bits of the hash than hash_si_ptr_h2. */
+inline static size_t hash_si_ptr_first_group(const struct hash_si_ptr *h, uint64_t hv) {
+	return (size_t)(hv >> 7) & (h->size / HASH_PTR_GROUP_SIZE - 1);
+}
+/* }}} */
+/* {{{ hash_si_ptr_match */
+/** Returns a bitmask of the slots in the group starting at ctrl whose control bytes equal c. */
+inline static uint32_t hash_si_ptr_match(const uint8_t *ctrl, uint8_t c) {
+#if defined(__SSE2__)
+	const __m128i group = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl));
+	return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)c)));
+#else
+	uint32_t mask = 0;
+	for (int i = 0; i < HASH_PTR_GROUP_SIZE; i++) {
+		mask |= (uint32_t)(ctrl[i] == c) << i;
+	}
+	return mask;
+#endif
+}
+/* }}} */
+/* {{{ hash_si_ptr_match_empty */
+/** Returns a bitmask of the empty slots in the group starting at ctrl. */
+inline static uint32_t hash_si_ptr_match_empty(const uint8_t *ctrl) {
+#if defined(__SSE2__)
+	// Only empty slots have the high bit set.
+	return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl)));
+#else
+	return hash_si_ptr_match(ctrl, HASH_PTR_CTRL_EMPTY);
 #endif
-	return hash;
 }
+/* }}} */
 
 /* {{{ nextpow2 */
 /** Next power of 2.
  * @param n Integer.
  * @return next to n power of 2 .
  */
-inline static uint32_t nextpow2(uint32_t n) {
-	uint32_t m = 1;
+inline static size_t nextpow2(size_t n) {
+	size_t m = 1;
 	while (m < n) {
 		m = m << 1;
 	}
@@ -54,62 +93,89 @@ inline static uint32_t nextpow2(uint32_t n) {
 /* }}} */
 /* {{{ hash_si_ptr_init */
 int hash_si_ptr_init(struct hash_si_ptr *h, size_t size) {
-	size = nextpow2(size);
+	size = nextpow2(size < HASH_PTR_GROUP_SIZE ? HASH_PTR_GROUP_SIZE : size);
 
 	h->size = size;
 	h->used = 0;
-	h->data = (struct hash_si_ptr_pair*) malloc(sizeof(struct hash_si_ptr_pair) * size);
+	/* The pairs and the control bytes share one allocation. The pairs come first, so that they're aligned. */
+	h->data = (struct hash_si_ptr_pair*) HPHP::req::malloc((sizeof(struct hash_si_ptr_pair) + 1) * size);
 	if (h->data == NULL) {
+		h->ctrl = NULL;
 		return 1;
 	}
+	h->ctrl = reinterpret_cast<uint8_t*>(h->data + size);
 
-	memset(h->data, 0, sizeof(struct hash_si_ptr_pair) * size); /* Set everything to 0. sets keys to HASH_PTR_KEY_INVALID. */
+	memset(h->ctrl, HASH_PTR_CTRL_EMPTY, size); /* The pairs are only read once their control byte is set. */
 
 	return 0;
 }
 /* }}} */
 /* {{{ hash_si_ptr_deinit */
 void hash_si_ptr_deinit(struct hash_si_ptr *h) {
-	free(h->data);
+	if (h->data != NULL) {
+		HPHP::req::free(h->data);
+	}
 	h->data = NULL;
+	h->ctrl = NULL;
 
 	h->size = 0;
 	h->used = 0;
 }
 /* }}} */
+/* {{{ hash_si_ptr_clear */
+void hash_si_ptr_clear(struct hash_si_ptr *h) {
+	if (h->used != 0) {
+		memset(h->ctrl, HASH_PTR_CTRL_EMPTY, h->size);
+		h->used = 0;
+	}
+}
+/* }}} */
 /* {{{ _hash_si_ptr_find */
-/** Returns index of key, or where it should be.
+/** Returns index of key, or the empty slot where it should be inserted.
  * @param h Pointer to hash_si_ptr struct.
  * @param key Pointer to key.
+ * @param hv hash_of_address(key).
  * @return index.
  */
-inline static size_t _hash_si_ptr_find(struct hash_si_ptr *h, const uintptr_t key) {
-	uint32_t hv;
-	size_t size;
+inline static size_t _hash_si_ptr_find(const struct hash_si_ptr *h, const uintptr_t key, const uint64_t hv) {
+	const uint8_t h2 = hash_si_ptr_h2(hv);
+	const size_t group_mask = h->size / HASH_PTR_GROUP_SIZE - 1;
+	size_t group = hash_si_ptr_first_group(h, hv);
 
 	assert(h != NULL);
 
-	size = h->size;
-	hv = inline_hash_of_address(key) & (h->size-1);
-
-	while (size > 0 &&
-		h->data[hv].key != HASH_PTR_KEY_INVALID &&
-		h->data[hv].key != key) {
-		/* linear prob */
-		hv = (hv + 1) & (h->size-1);
-		size--;
+	/* Triangular probing visits every group once the number of groups is a power of 2, */
+	/* and the table is never full, so this terminates. */
+	for (size_t step = 1; ; step++) {
+		const size_t base = group * HASH_PTR_GROUP_SIZE;
+		const uint8_t *ctrl = h->ctrl + base;
+		for (uint32_t match = hash_si_ptr_match(ctrl, h2); match != 0; match &= match - 1) {
+			const size_t i = base + __builtin_ctz(match);
+			if (h->data[i].key == key) {
+				return i;
+			}
+		}
+		/* Nothing is ever removed, so an empty slot in this group means the key isn't in any later group. */
+		const uint32_t empty = hash_si_ptr_match_empty(ctrl);
+		if (empty != 0) {
+			return base + __builtin_ctz(empty);
+		}
+		group = (group + step) & group_mask;
 	}
-
-	return hv;
 }
 /* }}} */
+/* {{{ hash_si_ptr_set_slot */
+inline static void hash_si_ptr_set_slot(struct hash_si_ptr *h, size_t i, const uintptr_t key, uint32_t value, const uint64_t hv) {
+	h->ctrl[i] = hash_si_ptr_h2(hv);
+	h->data[i].key = key;
+	h->data[i].value = value;
+}
 /* }}} */
 /* {{{ hash_si_ptr_rehash */
 /** Rehash/resize hash_si_ptr.
  * @param h Pointer to hash_si_ptr struct.
  */
 inline static void hash_si_ptr_rehash(struct hash_si_ptr *h) {
-	uint32_t hv;
 	size_t i;
 	struct hash_si_ptr newh;
 
@@ -118,53 +184,52 @@ inline static void hash_si_ptr_rehash(struct hash_si_ptr *h) {
 	hash_si_ptr_init(&newh, h->size * 2);
 
 	for (i = 0; i < h->size; i++) {
-		if (h->data[i].key != HASH_PTR_KEY_INVALID) {
-			hv = _hash_si_ptr_find(&newh, h->data[i].key);
-			newh.data[hv].key = h->data[i].key;
-			newh.data[hv].value = h->data[i].value;
+		if (h->ctrl[i] != HASH_PTR_CTRL_EMPTY) {
+			const uintptr_t key = h->data[i].key;
+			const uint64_t hv = hash_of_address(key);
+			hash_si_ptr_set_slot(&newh, _hash_si_ptr_find(&newh, key, hv), key, h->data[i].value, hv);
 		}
 	}
 
-	free(h->data);
-	h->data = newh.data;
-	h->size *= 2;
+	newh.used = h->used;
+	hash_si_ptr_deinit(h);
+	*h = newh;
 }
 /* }}} */
 /* {{{ hash_si_ptr_insert */
 int hash_si_ptr_insert(struct hash_si_ptr *h, const uintptr_t key, uint32_t value) {
-	uint32_t hv;
+	size_t hv_index;
+	const uint64_t hv = hash_of_address(key);
 
-	if (h->size / 4 * 3 < h->used + 1) {
+	/* Keep at least 1/8 of the slots empty, so that probe sequences stay short. */
+	if (h->size / 8 * 7 < h->used + 1) {
 		hash_si_ptr_rehash(h);
 	}
 
-	hv = _hash_si_ptr_find(h, key);
-
-	if (h->data[hv].key == HASH_PTR_KEY_INVALID) {
-		h->data[hv].key = key;
+	hv_index = _hash_si_ptr_find(h, key, hv);
 
-		h->used++;
-	} else {
+	if (h->ctrl[hv_index] != HASH_PTR_CTRL_EMPTY) {
 		return 2;
 	}
 
-	h->data[hv].value = value;
+	hash_si_ptr_set_slot(h, hv_index, key, value, hv);
+	h->used++;
 
 	return 0;
 }
 /* }}} */
 /* {{{ hash_si_ptr_find */
 int hash_si_ptr_find(struct hash_si_ptr *h, const uintptr_t key, uint32_t *value) {
-	uint32_t hv;
+	size_t hv_index;
 
 	assert(h != NULL);
 
-	hv = _hash_si_ptr_find(h, key);
+	hv_index = _hash_si_ptr_find(h, key, hash_of_address(key));
 
-	if (h->data[hv].key == HASH_PTR_KEY_INVALID) {
+	if (h->ctrl[hv_index] == HASH_PTR_CTRL_EMPTY) {
 		return 1;
 	} else {
-		*value = h->data[hv].value;
+		*value = h->data[hv_index].value;
 		return 0;
 	}
 }
@@ -0,0 +1,234 @@
+/*
+  +----------------------------------------------------------------------+
+  | See COPYING file for further copyright information                   |
+  +----------------------------------------------------------------------+
+  | Author of hhvm fork: Tyson Andre <tysonandre775@hotmail.com>         |
+  | See CREDITS for contributors                                         |
+  +----------------------------------------------------------------------+
+*/
+
+#include "igbinary_class_layout.hpp"
+
+#include "ext_igbinary.hpp"
+
+#include <memory>
+
+#include "folly/SharedMutex.h"
+
+#include "hphp/runtime/base/array-iterator.h"
+#include "hphp/runtime/base/builtin-functions.h"
+#include "hphp/runtime/base/request-event-handler.h"
+#include "hphp/runtime/base/request-local.h"
+#include "hphp/runtime/base/static-string-table.h"
+#include "hphp/runtime/vm/unit.h"
+
+namespace HPHP {
+
+namespace {
+
+const StaticString
+	s___wakeup("__wakeup"),
+	s_zero("\0", 1),
+	s_protected_prefix("\0*\0", 3);
+
+typedef hphp_hash_map<const Class*, const IgbinaryClassLayout*> LayoutMap;
+
+/** Most plans kept for one class. Classes whose __sleep returns more different lists than this are serialized without a plan. */
+const size_t kMaxSleepPlansPerClass = 8;
+
+/** Layouts of persistent classes. Filled in once per class, and read by every request. */
+folly::SharedMutex s_persistent_layouts_lock;
+LayoutMap s_persistent_layouts;
+
+/** Layouts of this request's non-persistent classes, and the classes this request found by name. */
+struct IgbinaryClassLayoutCache final : RequestEventHandler {
+	void requestInit() override {
+		assert(layouts.empty() && by_name.empty());
+	}
+
+	void requestShutdown() override {
+		for (auto& it : layouts) {
+			delete it.second;
+		}
+		layouts.clear();
+		by_name.clear();
+		// The plans hold request-local strings, so they must be freed before the request's memory is.
+		for (auto& it : sleep_plans) {
+			for (IgbinarySleepPlan* plan : it.second) {
+				delete plan;
+			}
+		}
+		sleep_plans.clear();
+	}
+
+	LayoutMap layouts;
+	/** Class name => layout. Keys are the names of the classes, which are static strings. */
+	hphp_hash_map<const StringData*, const IgbinaryClassLayout*, string_data_hash, string_data_isame> by_name;
+	/**
+	 * Class => the plans for the different lists of names its __sleep returned.
+	 * Plans are only freed at the end of the request: the serializer may still be using one while a nested instance of the class
+	 * (or a nested igbinary_serialize call in __sleep) looks up another.
+	 */
+	hphp_hash_map<const Class*, std::vector<IgbinarySleepPlan*>> sleep_plans;
+};
+
+IMPLEMENT_STATIC_REQUEST_LOCAL(IgbinaryClassLayoutCache, s_layout_cache);
+
+} // namespace
+
+/* {{{ IgbinaryClassLayout::IgbinaryClassLayout */
+IgbinaryClassLayout::IgbinaryClassLayout(Class* cls) :
+	cls(cls),
+	has_wakeup(cls->lookupMethod(s___wakeup.get()) != nullptr) {
+	const size_t n = cls->numDeclProperties();
+	for (Slot slot = 0; slot < n; slot++) {
+		const Class::Prop& prop = cls->declProperties()[slot];
+		// Check every spelling of the name against the lookup that the unserializer would otherwise do.
+		for (const StringData* name : { prop.name, prop.mangledName }) {
+			auto const lookup = cls->getDeclPropIndex(nullptr, name);
+			if (lookup.prop == slot && lookup.accessible) {
+				m_slots.emplace(name, slot);
+			}
+		}
+	}
+
+	serialize_from_slots = !(cls->attrs() & AttrBuiltin) && cls->instanceCtor() == nullptr;
+	if (!serialize_from_slots) {
+		return;
+	}
+	// Same order as ObjectData::o_getArray(): most derived class first, then each parent's own declared properties.
+	std::vector<bool> listed(n, false);
+	for (const Class* c = cls; c != nullptr; c = c->parent()) {
+		const PreClass* pc = c->preClass();
+		const PreClass::Prop* pc_props = pc->properties();
+		for (size_t i = 0, count = pc->numProperties(); i < count; i++) {
+			const PreClass::Prop& prop = pc_props[i];
+			if (prop.attrs() & AttrStatic) {
+				continue;
+			}
+			const Slot slot = c->lookupDeclProp(prop.name());
+			if (slot == kInvalidSlot || listed[slot]) {
+				continue;
+			}
+			listed[slot] = true;
+			serialized_props.push_back(SerializedProp{slot, prop.mangledName()});
+		}
+	}
+}
+/* }}} */
+/* {{{ igbinary_class_layout */
+const IgbinaryClassLayout* igbinary_class_layout(Class* cls) {
+	if (!(cls->attrs() & AttrPersistent)) {
+		auto& layouts = s_layout_cache->layouts;
+		auto it = layouts.find(cls);
+		if (it != layouts.end()) {
+			return it->second;
+		}
+		const IgbinaryClassLayout* layout = new IgbinaryClassLayout(cls);
+		layouts.emplace(cls, layout);
+		return layout;
+	}
+	{
+		folly::SharedMutex::ReadHolder read_lock(s_persistent_layouts_lock);
+		auto it = s_persistent_layouts.find(cls);
+		if (it != s_persistent_layouts.end()) {
+			return it->second;
+		}
+	}
+	folly::SharedMutex::WriteHolder write_lock(s_persistent_layouts_lock);
+	auto result = s_persistent_layouts.emplace(cls, nullptr);
+	if (result.second) {
+		result.first->second = new IgbinaryClassLayout(cls);
+	}
+	return result.first->second;
+}
+/* }}} */
+/* {{{ IgbinarySleepPlan::matches */
+bool IgbinarySleepPlan::matches(const ArrayData* sleep_result) const {
+	if (sleep_result == static_sleep_result) {
+		return true;
+	}
+	if ((size_t) sleep_result->size() != entries.size()) {
+		return false;
+	}
+	size_t i = 0;
+	for (ArrayIter iter(sleep_result); iter; ++iter, ++i) {
+		const Variant& name = iter.secondRef();
+		if (!name.isString() || !name.getStringData()->same(entries[i].name.get())) {
+			return false;
+		}
+	}
+	return true;
+}
+/* }}} */
+/* {{{ igbinary_sleep_plan_create */
+/** Returns a new plan, or nullptr if any of the names needs the serializer's per-name checks. See igbinary_sleep_plan. */
+static IgbinarySleepPlan* igbinary_sleep_plan_create(Class* cls, const Array& sleep_result) {
+	std::unique_ptr<IgbinarySleepPlan> plan(new IgbinarySleepPlan());
+	plan->static_sleep_result = sleep_result->isStatic() ? sleep_result.get() : nullptr;
+	plan->entries.reserve(sleep_result.size());
+	for (ArrayIter iter(sleep_result); iter; ++iter) {
+		const Variant& member = iter.secondRef();
+		if (!member.isString()) {
+			return nullptr;
+		}
+		const String name = member.toString();
+		if (name.empty() || name.data()[0] == '\0') {
+			return nullptr;
+		}
+		// Same lookup and mangling as the serializer does for each name, see igbinary_serialize_object.
+		IgbinarySleepPlan::Entry entry{name, kInvalidSlot, name};
+		auto const lookup = cls->getDeclPropIndex(cls, name.get());
+		if (lookup.prop != kInvalidSlot && lookup.accessible) {
+			entry.slot = lookup.prop;
+			auto const attrs = cls->declProperties()[lookup.prop].attrs;
+			if (attrs & AttrPrivate) {
+				entry.serialized_name = concat4(s_zero, cls->nameStr(), s_zero, name);
+			} else if (attrs & AttrProtected) {
+				entry.serialized_name = concat(s_protected_prefix, name);
+			}
+		}
+		plan->entries.push_back(std::move(entry));
+	}
+	return plan.release();
+}
+/* }}} */
+/* {{{ igbinary_sleep_plan */
+const IgbinarySleepPlan* igbinary_sleep_plan(Class* cls, const Array& sleep_result) {
+	std::vector<IgbinarySleepPlan*>& plans = s_layout_cache->sleep_plans[cls];
+	for (const IgbinarySleepPlan* plan : plans) {
+		if (plan->matches(sleep_result.get())) {
+			return plan;
+		}
+	}
+	if (plans.size() >= kMaxSleepPlansPerClass) {
+		return nullptr;
+	}
+	IgbinarySleepPlan* plan = igbinary_sleep_plan_create(cls, sleep_result);
+	if (plan == nullptr) {
+		return nullptr;
+	}
+	plans.push_back(plan);
+	return plan;
+}
+/* }}} */
+/* {{{ igbinary_class_layout_for_name */
+const IgbinaryClassLayout* igbinary_class_layout_for_name(const StringData* name) {
+	auto& by_name = s_layout_cache->by_name;
+	auto it = by_name.find(name);
+	if (it != by_name.end()) {
+		return it->second;
+	}
+	// A class can't be redefined within a request, so once a name resolves it keeps resolving to the same class.
+	// Failures aren't cached, since the class may be declared later in the request.
+	Class* cls = Unit::loadClass(name);  // with autoloading
+	if (cls == nullptr) {
+		return nullptr;
+	}
+	const IgbinaryClassLayout* layout = igbinary_class_layout(cls);
+	by_name.emplace(cls->name(), layout);
+	return layout;
+}
+/* }}} */
+
+} // namespace HPHP
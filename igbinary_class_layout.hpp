@@ -0,0 +1,115 @@
+/*
+  +----------------------------------------------------------------------+
+  | See COPYING file for further copyright information                   |
+  +----------------------------------------------------------------------+
+  | Author of hhvm fork: Tyson Andre <tysonandre775@hotmail.com>         |
+  | See CREDITS for contributors                                         |
+  | Caches what igbinary needs to know about a class to (un)serialize    |
+  | its instances, so that it isn't looked up again for every instance.  |
+  +----------------------------------------------------------------------+
+*/
+
+#ifndef IGBINARY_CLASS_LAYOUT_H__
+#define IGBINARY_CLASS_LAYOUT_H__
+
+#include <vector>
+
+#include "hphp/runtime/base/type-array.h"
+#include "hphp/runtime/base/type-string.h"
+#include "hphp/runtime/vm/class.h"
+#include "hphp/util/hash-map-typedefs.h"
+
+namespace HPHP {
+
+/**
+ * The parts of a class that igbinary looks up for each instance. Immutable once created.
+ *
+ * Layouts of persistent classes are shared by all requests, and are never freed.
+ * Layouts of other classes are only used by the request that created them, because a later request may load a different
+ * class with the same name (e.g. after the file declaring it changed). They're freed when that request ends.
+ */
+class IgbinaryClassLayout {
+  public:
+	explicit IgbinaryClassLayout(Class* cls);
+
+	Class* const cls;
+	/** Whether instances need __wakeup to be called after unserializing. */
+	const bool has_wakeup;
+
+	/**
+	 * Returns the slot in propVec() of the declared property that the serialized property name refers to,
+	 * or kInvalidSlot if the name is a dynamic property (or a property that isn't accessible without a context).
+	 * This gives the same result as ObjectData::getProp(nullptr, name) on a new instance.
+	 */
+	Slot lookupSlot(const StringData* name) const {
+		auto it = m_slots.find(name);
+		return it != m_slots.end() ? it->second : kInvalidSlot;
+	}
+
+	/** A declared property, as the serializer writes it. */
+	struct SerializedProp {
+		Slot slot;
+		/** The name, mangled if it's protected or private. A static string. */
+		const StringData* name;
+	};
+
+	/**
+	 * Whether instances can be serialized from serialized_props and the dynamic properties, instead of from ObjectData::toArray().
+	 * False for builtin classes, which may have their own toArray() behavior.
+	 */
+	bool serialize_from_slots;
+	/**
+	 * The declared properties in the order ObjectData::toArray() lists them:
+	 * The class's own properties in declaration order, followed by those of its parent, and so on.
+	 * Properties which are redeclared by a subclass are only listed once, like in toArray().
+	 */
+	std::vector<SerializedProp> serialized_props;
+
+  private:
+	/** Serialized property name => slot. Keys are static strings owned by cls. */
+	hphp_hash_map<const StringData*, Slot, string_data_hash, string_data_same> m_slots;
+};
+
+/**
+ * What the serializer needs to know about each property name returned by a class's __sleep.
+ * Computed for the first instance, and reused for the following instances which return the same names.
+ * Plans are request-local, and are only freed when the request ends, so a plan stays valid while its instance's properties are serialized.
+ */
+struct IgbinarySleepPlan {
+	struct Entry {
+		/** The name returned by __sleep. */
+		String name;
+		/** The slot of the declared property with that name that's accessible from the class, or kInvalidSlot. */
+		Slot slot;
+		/** The name to serialize if the slot is used. name, mangled for protected and private properties. */
+		String serialized_name;
+	};
+
+	/** The array __sleep returned when the plan was made, if it's a static array (e.g. an array literal), so it can be recognized by identity. */
+	const ArrayData* static_sleep_result;
+	std::vector<Entry> entries;
+
+	/** Returns true if the plan applies to this return value of __sleep. */
+	bool matches(const ArrayData* sleep_result) const;
+};
+
+/**
+ * Returns the plan for the names returned by __sleep on an instance of cls.
+ * Returns nullptr if any of them isn't a string or starts with "\0". The serializer warns about those, so it has to check them one by one.
+ * Also returns nullptr if the class already has plans for too many different lists of names.
+ */
+const IgbinarySleepPlan* igbinary_sleep_plan(Class* cls, const Array& sleep_result);
+
+/**
+ * Returns the layout of the class with this name, loading it (with autoloading) if needed.
+ * Returns nullptr if there is no such class.
+ * Names which were already resolved in this request are looked up without calling Unit::loadClass.
+ */
+const IgbinaryClassLayout* igbinary_class_layout_for_name(const StringData* name);
+
+/** Returns the layout of cls. */
+const IgbinaryClassLayout* igbinary_class_layout(Class* cls);
+
+}
+
+#endif
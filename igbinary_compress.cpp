@@ -0,0 +1,199 @@
+/*
+  +----------------------------------------------------------------------+
+  | See COPYING file for further copyright information                   |
+  +----------------------------------------------------------------------+
+  | Author of hhvm fork: Tyson Andre <tysonandre775@hotmail.com>         |
+  | See CREDITS for contributors                                         |
+  | This is an LZ4 block compressor and a bounds-checked decompressor.   |
+  +----------------------------------------------------------------------+
+*/
+
+#include "igbinary_compress.hpp"
+
+#include <string.h>
+
+namespace HPHP {
+
+namespace {
+
+/** Matches are at least this long. */
+constexpr size_t kMinMatch = 4;
+/** The last match must start at least this many bytes before the end of the block. */
+constexpr size_t kMatchStartLimit = 12;
+/** The last bytes of the block are always literals. */
+constexpr size_t kLastLiterals = 5;
+/** Matches are at most this far back. */
+constexpr size_t kMaxOffset = 65535;
+/** log2 of the number of positions remembered by the compressor. */
+constexpr unsigned kHashLog = 12;
+
+inline uint32_t igbinary_lz4_read32(const uint8_t* p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+inline uint32_t igbinary_lz4_hash(uint32_t sequence) {
+	return (sequence * 2654435761u) >> (32 - kHashLog);
+}
+
+/** Writes the part of a length of at least 15 which doesn't fit in the token, as 255s followed by the remainder. */
+inline uint8_t* igbinary_lz4_write_length(uint8_t* op, size_t len) {
+	for (; len >= 255; len -= 255) {
+		*op++ = 255;
+	}
+	*op++ = (uint8_t) len;
+	return op;
+}
+
+/** Bytes needed for a sequence with lit literals, and a match of match_len bytes (0 for the last sequence). */
+inline size_t igbinary_lz4_sequence_size(size_t lit, size_t match_len) {
+	size_t size = 1 + lit + (lit >= 15 ? 1 + (lit - 15) / 255 : 0);
+	if (match_len > 0) {
+		const size_t m = match_len - kMinMatch;
+		size += 2 + (m >= 15 ? 1 + (m - 15) / 255 : 0);
+	}
+	return size;
+}
+
+/** Writes a sequence: lit literals from anchor, followed by a match of match_len bytes offset bytes back (unless match_len is 0). */
+inline uint8_t* igbinary_lz4_write_sequence(uint8_t* op, const uint8_t* anchor, size_t lit, size_t offset, size_t match_len) {
+	uint8_t* const token = op++;
+	if (lit >= 15) {
+		*token = 15 << 4;
+		op = igbinary_lz4_write_length(op, lit - 15);
+	} else {
+		*token = (uint8_t) (lit << 4);
+	}
+	memcpy(op, anchor, lit);
+	op += lit;
+	if (match_len == 0) {
+		return op;
+	}
+	*op++ = (uint8_t) offset;
+	*op++ = (uint8_t) (offset >> 8);
+	const size_t m = match_len - kMinMatch;
+	if (m >= 15) {
+		*token |= 15;
+		op = igbinary_lz4_write_length(op, m - 15);
+	} else {
+		*token |= (uint8_t) m;
+	}
+	return op;
+}
+
+/** Reads the rest of a length whose token nibble was 15. Returns false if the block ends first. */
+inline bool igbinary_lz4_read_length(const uint8_t*& ip, const uint8_t* iend, size_t& len) {
+	uint8_t b;
+	do {
+		if (ip >= iend) {
+			return false;
+		}
+		b = *ip++;
+		len += b;
+	} while (b == 255);
+	return true;
+}
+
+} // namespace
+
+/* {{{ igbinary_lz4_compress */
+size_t igbinary_lz4_compress(const uint8_t* src, size_t len, uint8_t* dst, size_t capacity) {
+	uint32_t table[1 << kHashLog] = {0};
+	const uint8_t* ip = src;
+	const uint8_t* anchor = src;
+	const uint8_t* const iend = src + len;
+	uint8_t* op = dst;
+	uint8_t* const oend = dst + capacity;
+
+	if (len > kMatchStartLimit) {
+		const uint8_t* const match_start_limit = iend - kMatchStartLimit;
+		const uint8_t* const match_end_limit = iend - kLastLiterals;
+		while (ip < match_start_limit) {
+			const uint32_t sequence = igbinary_lz4_read32(ip);
+			const uint32_t h = igbinary_lz4_hash(sequence);
+			const uint8_t* const ref = src + table[h];
+			table[h] = (uint32_t) (ip - src);
+			if (ref >= ip || (size_t) (ip - ref) > kMaxOffset || igbinary_lz4_read32(ref) != sequence) {
+				ip++;
+				continue;
+			}
+			const uint8_t* mp = ip + kMinMatch;
+			const uint8_t* rp = ref + kMinMatch;
+			while (mp < match_end_limit && *mp == *rp) {
+				mp++;
+				rp++;
+			}
+			const size_t lit = ip - anchor;
+			const size_t match_len = mp - ip;
+			if (igbinary_lz4_sequence_size(lit, match_len) > (size_t) (oend - op)) {
+				return 0;
+			}
+			op = igbinary_lz4_write_sequence(op, anchor, lit, ip - ref, match_len);
+			ip = mp;
+			anchor = ip;
+		}
+	}
+	const size_t lit = iend - anchor;
+	if (igbinary_lz4_sequence_size(lit, 0) > (size_t) (oend - op)) {
+		return 0;
+	}
+	op = igbinary_lz4_write_sequence(op, anchor, lit, 0, 0);
+	return op - dst;
+}
+/* }}} */
+/* {{{ igbinary_lz4_decompress */
+bool igbinary_lz4_decompress(const uint8_t* src, size_t len, uint8_t* dst, size_t dst_len) {
+	const uint8_t* ip = src;
+	const uint8_t* const iend = src + len;
+	uint8_t* op = dst;
+	uint8_t* const oend = dst + dst_len;
+
+	while (ip < iend) {
+		const uint8_t token = *ip++;
+		size_t lit = token >> 4;
+		if (lit == 15 && !igbinary_lz4_read_length(ip, iend, lit)) {
+			return false;
+		}
+		if (lit > (size_t) (iend - ip) || lit > (size_t) (oend - op)) {
+			return false;
+		}
+		memcpy(op, ip, lit);
+		ip += lit;
+		op += lit;
+		if (ip == iend) {
+			break;  // The last sequence has no match.
+		}
+
+		if (iend - ip < 2) {
+			return false;
+		}
+		const size_t offset = ip[0] | ((size_t) ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > (size_t) (op - dst)) {
+			return false;
+		}
+		size_t match_len = token & 15;
+		if (match_len == 15 && !igbinary_lz4_read_length(ip, iend, match_len)) {
+			return false;
+		}
+		match_len += kMinMatch;
+		if (match_len > (size_t) (oend - op)) {
+			return false;
+		}
+		const uint8_t* ref = op - offset;
+		if (offset >= match_len) {
+			memcpy(op, ref, match_len);
+			op += match_len;
+		} else {
+			// The match overlaps the bytes it produces, repeating the last offset bytes.
+			for (size_t i = 0; i < match_len; i++) {
+				*op++ = *ref++;
+			}
+		}
+	}
+	return op == oend;
+}
+/* }}} */
+
+} // namespace HPHP
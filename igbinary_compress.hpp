@@ -0,0 +1,43 @@
+/*
+  +----------------------------------------------------------------------+
+  | See COPYING file for further copyright information                   |
+  +----------------------------------------------------------------------+
+  | Author of hhvm fork: Tyson Andre <tysonandre775@hotmail.com>         |
+  | See CREDITS for contributors                                         |
+  | Block compression of serialized data, in the LZ4 block format.       |
+  +----------------------------------------------------------------------+
+*/
+
+#ifndef IGBINARY_COMPRESS_H__
+#define IGBINARY_COMPRESS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace HPHP {
+
+/*
+ * Compressed data has IGBINARY_FLAG_COMPRESSED set in its version header, followed by:
+ *
+ *   uint32 length           Length of the uncompressed data.
+ *   block                   The rest of the data (what would follow the version header), as one LZ4 block.
+ *
+ * Any LZ4 block decoder can read the block. This implementation favours speed over ratio: it looks for matches
+ * with a single hash table of recent positions, like LZ4's default (fast) mode.
+ */
+
+/** Uncompressed data is at most this many times longer than its block, so larger lengths are rejected. */
+#define IGBINARY_LZ4_MAX_RATIO 255
+
+/**
+ * Compresses the len bytes at src into dst, which has room for capacity bytes.
+ * Returns the length of the block, or 0 if it would be longer than capacity.
+ */
+size_t igbinary_lz4_compress(const uint8_t* src, size_t len, uint8_t* dst, size_t capacity);
+
+/** Decompresses the block of len bytes at src into exactly dst_len bytes at dst. Returns false if the block is invalid. */
+bool igbinary_lz4_decompress(const uint8_t* src, size_t len, uint8_t* dst, size_t dst_len);
+
+}
+
+#endif
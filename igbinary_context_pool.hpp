@@ -0,0 +1,92 @@
+/*
+  +----------------------------------------------------------------------+
+  | See COPYING file for further copyright information                   |
+  +----------------------------------------------------------------------+
+  | Author of hhvm fork: Tyson Andre <tysonandre775@hotmail.com>         |
+  | See CREDITS for contributors                                         |
+  | Request-local pools of serializer and unserializer contexts, so that |
+  | their tables are cleared and reused instead of reallocated per call. |
+  +----------------------------------------------------------------------+
+*/
+
+#ifndef IGBINARY_CONTEXT_POOL_H__
+#define IGBINARY_CONTEXT_POOL_H__
+
+#include <stddef.h>
+
+#include "ext_igbinary.hpp"
+
+#include "hphp/runtime/base/memory-manager.h"
+#include "hphp/runtime/base/request-event-handler.h"
+#include "hphp/runtime/base/request-local.h"
+
+namespace HPHP {
+
+/**
+ * Contexts for igbinary_serialize or igbinary_unserialize calls, reused between the calls made by a request.
+ * __sleep, __wakeup, serialize() and unserialize() may call igbinary again, so each nesting level has its own context.
+ * Contexts are allocated on the request heap, and are freed when the request ends.
+ *
+ * T must be default constructible, and have a method release(size_t high_water_mark) that empties it for the next call.
+ * That method frees any table whose allocated size is larger than high_water_mark bytes, and keeps the others.
+ */
+template<typename T>
+struct IgbinaryContextPool final : RequestEventHandler {
+	/** Calls nested more deeply than this get a context which isn't pooled. */
+	static constexpr size_t kMaxDepth = 4;
+
+	void requestInit() override {
+		assert(m_depth == 0);
+	}
+
+	void requestShutdown() override {
+		for (size_t i = 0; i < kMaxDepth; i++) {
+			if (m_contexts[i] != nullptr) {
+				req::destroy_raw(m_contexts[i]);
+				m_contexts[i] = nullptr;
+			}
+		}
+		m_depth = 0;
+	}
+
+	/** Holds a context for the duration of a call, and releases it (even if the call throws). */
+	struct Lease {
+		explicit Lease(IgbinaryContextPool& pool) : m_pool(pool) {
+			const size_t depth = pool.m_depth++;
+			if (depth < kMaxDepth) {
+				if (pool.m_contexts[depth] == nullptr) {
+					pool.m_contexts[depth] = req::make_raw<T>();
+				}
+				m_context = pool.m_contexts[depth];
+			} else {
+				m_context = req::make_raw<T>();
+			}
+		}
+
+		~Lease() {
+			const size_t depth = --m_pool.m_depth;
+			if (depth < kMaxDepth) {
+				m_context->release(igbinary_context_high_water_mark());
+			} else {
+				req::destroy_raw(m_context);
+			}
+		}
+
+		Lease(const Lease&) = delete;
+		Lease& operator=(const Lease&) = delete;
+
+		T* get() const { return m_context; }
+
+	  private:
+		IgbinaryContextPool& m_pool;
+		T* m_context;
+	};
+
+  private:
+	T* m_contexts[kMaxDepth] = {};
+	size_t m_depth = 0;
+};
+
+}
+
+#endif
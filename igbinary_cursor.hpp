@@ -0,0 +1,73 @@
+/*
+  +----------------------------------------------------------------------+
+  | See COPYING file for further copyright information                   |
+  +----------------------------------------------------------------------+
+  | Author of hhvm fork: Tyson Andre <tysonandre775@hotmail.com>         |
+  | See CREDITS for contributors                                         |
+  | Loads and stores of big-endian values at unaligned addresses.        |
+  | igbinary's format stores all lengths, ids and numbers as big-endian. |
+  +----------------------------------------------------------------------+
+*/
+
+#ifndef IGBINARY_CURSOR_H__
+#define IGBINARY_CURSOR_H__
+
+#include <stdint.h>
+#include <string.h>
+
+namespace HPHP {
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+# define IGBINARY_HOST_TO_BE16(x) (x)
+# define IGBINARY_HOST_TO_BE32(x) (x)
+# define IGBINARY_HOST_TO_BE64(x) (x)
+#else
+# define IGBINARY_HOST_TO_BE16(x) __builtin_bswap16(x)
+# define IGBINARY_HOST_TO_BE32(x) __builtin_bswap32(x)
+# define IGBINARY_HOST_TO_BE64(x) __builtin_bswap64(x)
+#endif
+
+/* memcpy of a constant size compiles to a single (unaligned) load or store. */
+
+inline uint16_t igbinary_load16(const uint8_t* p) {
+	uint16_t v;
+	memcpy(&v, p, sizeof(v));
+	return IGBINARY_HOST_TO_BE16(v);
+}
+
+inline uint32_t igbinary_load32(const uint8_t* p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return IGBINARY_HOST_TO_BE32(v);
+}
+
+inline uint64_t igbinary_load64(const uint8_t* p) {
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return IGBINARY_HOST_TO_BE64(v);
+}
+
+/** Stores a 16 bit value and returns the address after it. */
+inline uint8_t* igbinary_store16(uint8_t* p, uint16_t v) {
+	v = IGBINARY_HOST_TO_BE16(v);
+	memcpy(p, &v, sizeof(v));
+	return p + sizeof(v);
+}
+
+/** Stores a 32 bit value and returns the address after it. */
+inline uint8_t* igbinary_store32(uint8_t* p, uint32_t v) {
+	v = IGBINARY_HOST_TO_BE32(v);
+	memcpy(p, &v, sizeof(v));
+	return p + sizeof(v);
+}
+
+/** Stores a 64 bit value and returns the address after it. */
+inline uint8_t* igbinary_store64(uint8_t* p, uint64_t v) {
+	v = IGBINARY_HOST_TO_BE64(v);
+	memcpy(p, &v, sizeof(v));
+	return p + sizeof(v);
+}
+
+}
+
+#endif
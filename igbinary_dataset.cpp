@@ -0,0 +1,290 @@
+/*
+  +----------------------------------------------------------------------+
+  | See COPYING file for further copyright information                   |
+  +----------------------------------------------------------------------+
+  | Author of hhvm fork: Tyson Andre <tysonandre775@hotmail.com>         |
+  | See CREDITS for contributors                                         |
+  | Read-only files of keyed igbinary values, which are memory-mapped    |
+  | once per process and shared by all threads.                          |
+  +----------------------------------------------------------------------+
+*/
+
+#include "ext_igbinary.hpp"
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "folly/SharedMutex.h"
+
+#include "hphp/runtime/base/array-iterator.h"
+#include "hphp/runtime/base/runtime-error.h"
+#include "hphp/runtime/vm/treadmill.h"
+
+#include "igbinary_cursor.hpp"
+#include "igbinary_indexed.hpp"
+
+/*
+ * A dataset file is:
+ *
+ *   "IGDS"
+ *   uint32 version          IGBINARY_DATASET_VERSION.
+ *   uint64 count            Number of entries.
+ *   uint64 index offset     Offset of the index, after the records.
+ *   records                 For each entry, the bytes of its key followed by its value as returned by igbinary_serialize.
+ *   index                   An entry for each record, sorted by hash and then by key. See below.
+ *
+ * Each entry of the index is the igbinary_indexed_hash_string of the key (uint32), the length of the key (uint32),
+ * the offset of the record (uint64) and the length of the value (uint64).
+ * Integer keys are stored as their decimal strings, so that 1 and "1" are the same key, as in arrays.
+ * Numbers are big-endian, like the rest of the format.
+ */
+#define IGBINARY_DATASET_VERSION 1
+#define IGBINARY_DATASET_HEADER_SIZE 24
+#define IGBINARY_DATASET_ENTRY_SIZE 24
+
+namespace HPHP {
+
+namespace {
+
+/** A mapped dataset file. Closed datasets are unmapped by the treadmill, once the requests which may be reading them have ended. */
+struct IgbinaryDataset {
+	const uint8_t* data;
+	size_t size;
+	uint64_t count;
+	uint64_t index_offset;
+};
+
+/** Lookups of datasets which are already mapped only take the read lock. */
+folly::SharedMutex s_datasets_lock;
+/** The datasets mapped by this process, by path. Files which failed to open aren't added, so they are retried. */
+std::unordered_map<std::string, IgbinaryDataset*> s_datasets;
+
+/* {{{ igbinary_dataset_open */
+/** Maps the dataset at path and checks its header. Returns false (after a warning) if it can't be used. */
+static bool igbinary_dataset_open(const std::string& path, IgbinaryDataset& dataset) {
+	const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		raise_warning("igbinary_dataset_get(): Failed to open %s: %s", path.c_str(), strerror(errno));
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < IGBINARY_DATASET_HEADER_SIZE) {
+		::close(fd);
+		raise_warning("igbinary_dataset_get(): %s is not a dataset file", path.c_str());
+		return false;
+	}
+	void* mapped = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);  // The mapping stays valid.
+	if (mapped == MAP_FAILED) {
+		raise_warning("igbinary_dataset_get(): Failed to map %s: %s", path.c_str(), strerror(errno));
+		return false;
+	}
+	const uint8_t* data = static_cast<const uint8_t*>(mapped);
+	dataset.data = data;
+	dataset.size = (size_t) st.st_size;
+	dataset.count = igbinary_load64(data + 8);
+	dataset.index_offset = igbinary_load64(data + 16);
+	if (memcmp(data, "IGDS", 4) != 0 || igbinary_load32(data + 4) != IGBINARY_DATASET_VERSION ||
+			dataset.index_offset < IGBINARY_DATASET_HEADER_SIZE || dataset.index_offset > dataset.size ||
+			dataset.count > (dataset.size - dataset.index_offset) / IGBINARY_DATASET_ENTRY_SIZE) {
+		munmap(mapped, dataset.size);
+		raise_warning("igbinary_dataset_get(): %s is not a dataset file, or is of an unsupported version", path.c_str());
+		return false;
+	}
+	return true;
+}
+/* }}} */
+/* {{{ igbinary_dataset_find */
+/**
+ * Returns the dataset at path, mapping it if this process hasn't yet, or nullptr (after a warning) if it can't be used.
+ * The dataset stays mapped until the end of the request, even if another thread closes it.
+ */
+static const IgbinaryDataset* igbinary_dataset_find(const String& path) {
+	const std::string key(path.data(), path.size());
+	{
+		folly::SharedMutex::ReadHolder read_lock(s_datasets_lock);
+		auto it = s_datasets.find(key);
+		if (it != s_datasets.end()) {
+			return it->second;
+		}
+	}
+	// The file is mapped without the lock, so that lookups of other datasets don't wait for it.
+	std::unique_ptr<IgbinaryDataset> dataset(new IgbinaryDataset());
+	if (!igbinary_dataset_open(key, *dataset)) {
+		return nullptr;
+	}
+	folly::SharedMutex::WriteHolder write_lock(s_datasets_lock);
+	auto inserted = s_datasets.emplace(key, dataset.get());
+	if (!inserted.second) {
+		// Another thread mapped it first. Nothing else can see this mapping.
+		munmap(const_cast<uint8_t*>(dataset->data), dataset->size);
+		return inserted.first->second;
+	}
+	return dataset.release();
+}
+/* }}} */
+/* {{{ igbinary_dataset_unmap */
+/** Removes the dataset at path from s_datasets, and unmaps it once no request can be reading it. Returns false if it wasn't mapped. */
+static bool igbinary_dataset_unmap(const std::string& path) {
+	IgbinaryDataset* dataset;
+	{
+		folly::SharedMutex::WriteHolder write_lock(s_datasets_lock);
+		auto it = s_datasets.find(path);
+		if (it == s_datasets.end()) {
+			return false;
+		}
+		dataset = it->second;
+		s_datasets.erase(it);
+	}
+	// The treadmill waits for the requests which started before this call, which may have found the dataset, to end.
+	Treadmill::enqueue([dataset] {
+		munmap(const_cast<uint8_t*>(dataset->data), dataset->size);
+		delete dataset;
+	});
+	return true;
+}
+/* }}} */
+/* {{{ igbinary_dataset_entry */
+/** An entry of the index of a dataset being written. */
+struct igbinary_dataset_entry {
+	uint32_t hash;
+	String key;
+	uint64_t offset;
+	uint64_t value_len;
+};
+/* }}} */
+/* {{{ igbinary_dataset_write_all */
+/** Writes len bytes to fp, returning false on failure. */
+static bool igbinary_dataset_write_all(FILE* fp, const void* data, size_t len) {
+	return len == 0 || fwrite(data, 1, len, fp) == len;
+}
+/* }}} */
+
+} // namespace
+
+/* {{{ igbinary_dataset_write */
+Variant igbinary_dataset_write(const String& path, const Array& serialized) {
+	std::vector<igbinary_dataset_entry> entries;
+	entries.reserve(serialized.size());
+	uint64_t offset = IGBINARY_DATASET_HEADER_SIZE;
+	for (ArrayIter iter(serialized); iter; ++iter) {
+		const Variant& value = iter.secondRef();
+		if (!value.isString()) {
+			raise_warning("igbinary_dataset_write(): Expected the value of each key to be a string returned by igbinary_serialize");
+			return false;
+		}
+		const String key = iter.first().toString();
+		const uint64_t value_len = value.toString().size();
+		entries.push_back(igbinary_dataset_entry{igbinary_indexed_hash_string(key.data(), key.size()), key, offset, value_len});
+		offset += key.size() + value_len;
+	}
+	std::sort(entries.begin(), entries.end(), [](const igbinary_dataset_entry& a, const igbinary_dataset_entry& b) {
+		if (a.hash != b.hash) {
+			return a.hash < b.hash;
+		}
+		const int cmp = memcmp(a.key.data(), b.key.data(), std::min(a.key.size(), b.key.size()));
+		return cmp != 0 ? cmp < 0 : a.key.size() < b.key.size();
+	});
+
+	// Readers in other processes only see the complete file, once it is renamed.
+	const std::string final_path(path.data(), path.size());
+	const std::string tmp_path = final_path + ".tmp." + std::to_string(getpid());
+	FILE* fp = fopen(tmp_path.c_str(), "wb");
+	if (fp == nullptr) {
+		raise_warning("igbinary_dataset_write(): Failed to open %s: %s", tmp_path.c_str(), strerror(errno));
+		return false;
+	}
+	uint8_t header[IGBINARY_DATASET_HEADER_SIZE];
+	memcpy(header, "IGDS", 4);
+	igbinary_store32(header + 4, IGBINARY_DATASET_VERSION);
+	igbinary_store64(header + 8, entries.size());
+	igbinary_store64(header + 16, offset);
+	bool ok = igbinary_dataset_write_all(fp, header, sizeof(header));
+	// Records are written in the order of the array, which is the order of the offsets computed above.
+	for (ArrayIter iter(serialized); ok && iter; ++iter) {
+		const String key = iter.first().toString();
+		const String value = iter.secondRef().toString();
+		ok = igbinary_dataset_write_all(fp, key.data(), key.size()) && igbinary_dataset_write_all(fp, value.data(), value.size());
+	}
+	for (size_t i = 0; ok && i < entries.size(); i++) {
+		const igbinary_dataset_entry& entry = entries[i];
+		uint8_t buf[IGBINARY_DATASET_ENTRY_SIZE];
+		uint8_t* p = igbinary_store32(buf, entry.hash);
+		p = igbinary_store32(p, (uint32_t) entry.key.size());
+		p = igbinary_store64(p, entry.offset);
+		igbinary_store64(p, entry.value_len);
+		ok = igbinary_dataset_write_all(fp, buf, sizeof(buf));
+	}
+	if (fclose(fp) != 0) {
+		ok = false;
+	}
+	if (!ok || rename(tmp_path.c_str(), final_path.c_str()) != 0) {
+		raise_warning("igbinary_dataset_write(): Failed to write %s: %s", final_path.c_str(), strerror(errno));
+		unlink(tmp_path.c_str());
+		return false;
+	}
+	// This process's lookups see the new file, instead of the one it replaced.
+	igbinary_dataset_unmap(final_path);
+	return (int64_t) entries.size();
+}
+/* }}} */
+/* {{{ igbinary_dataset_get */
+Variant igbinary_dataset_get(const String& path, const String& key) {
+	const IgbinaryDataset* dataset = igbinary_dataset_find(path);
+	if (dataset == nullptr) {
+		return false;
+	}
+	const uint32_t hash = igbinary_indexed_hash_string(key.data(), key.size());
+	const uint8_t* const index = dataset->data + dataset->index_offset;
+	// Find the first entry with this hash.
+	uint64_t lo = 0, hi = dataset->count;
+	while (lo < hi) {
+		const uint64_t mid = lo + (hi - lo) / 2;
+		if (igbinary_load32(index + mid * IGBINARY_DATASET_ENTRY_SIZE) < hash) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	for (uint64_t i = lo; i < dataset->count; i++) {
+		const uint8_t* const entry = index + i * IGBINARY_DATASET_ENTRY_SIZE;
+		if (igbinary_load32(entry) != hash) {
+			break;
+		}
+		const uint64_t key_len = igbinary_load32(entry + 4);
+		const uint64_t offset = igbinary_load64(entry + 8);
+		const uint64_t value_len = igbinary_load64(entry + 16);
+		if (offset > dataset->index_offset || key_len > dataset->index_offset - offset ||
+				value_len > dataset->index_offset - offset - key_len) {
+			raise_warning("igbinary_dataset_get(): Invalid index entry %llu in %s", (unsigned long long) i, path.data());
+			return false;
+		}
+		if (key_len != (uint64_t) key.size() || memcmp(dataset->data + offset, key.data(), key_len) != 0) {
+			continue;
+		}
+		// The value is unserialized straight from the mapping.
+		Variant result;
+		igbinary_unserialize(dataset->data + offset + key_len, value_len, result);
+		return result;
+	}
+	return init_null();
+}
+/* }}} */
+/* {{{ igbinary_dataset_close */
+bool igbinary_dataset_close(const String& path) {
+	return igbinary_dataset_unmap(std::string(path.data(), path.size()));
+}
+/* }}} */
+
+} // namespace HPHP
@@ -0,0 +1,118 @@
+/*
+  +----------------------------------------------------------------------+
+  | See COPYING file for further copyright information                   |
+  +----------------------------------------------------------------------+
+  | Author of hhvm fork: Tyson Andre <tysonandre775@hotmail.com>         |
+  | See CREDITS for contributors                                         |
+  | This is the process-wide registry of shared string dictionaries.     |
+  +----------------------------------------------------------------------+
+*/
+
+#include "ext_igbinary.hpp"
+#include "igbinary_dictionary.hpp"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+#include "hphp/runtime/base/array-iterator.h"
+#include "hphp/runtime/base/req-containers.h"
+#include "hphp/runtime/base/runtime-error.h"
+#include "hphp/runtime/base/static-string-table.h"
+
+namespace HPHP {
+
+namespace {
+
+/**
+ * Slots are filled at most once (null -> dictionary) and never cleared, so readers need no locks.
+ * Registering is done by every request that wants to use a dictionary, so it must be cheap when the dictionary exists.
+ */
+std::atomic<const IgbinaryDictionary*> s_dictionaries[IGBINARY_DICTIONARY_MAX_ID + 1];
+/** Held while filling a slot, so that only the request which fills it makes its strings static. */
+std::mutex s_dictionaries_register_mutex;
+
+/* {{{ igbinary_dictionary_same */
+/** Returns true if dictionary has exactly the given strings, in order. */
+static bool igbinary_dictionary_same(const IgbinaryDictionary* dictionary, const Array& strings) {
+	if (dictionary->strings.size() != (size_t) strings.size()) {
+		return false;
+	}
+	size_t i = 0;
+	for (ArrayIter iter(strings); iter; ++iter, ++i) {
+		const Variant& s = iter.secondRef();
+		if (!s.isString() || !dictionary->strings[i]->same(s.getStringData())) {
+			return false;
+		}
+	}
+	return true;
+}
+/* }}} */
+/* {{{ igbinary_dictionary_check */
+/** Returns false (after a warning) unless strings is a list of distinct non-empty strings. Creates no static strings. */
+static bool igbinary_dictionary_check(const Array& strings) {
+	req::hash_set<const StringData*, string_data_hash, string_data_same> seen;
+	seen.reserve(strings.size());
+	for (ArrayIter iter(strings); iter; ++iter) {
+		const Variant& s = iter.secondRef();
+		// Empty strings are never given string ids.
+		if (!s.isString() || s.getStringData()->empty()) {
+			raise_warning("igbinary_dictionary_register(): Expected a list of non-empty strings");
+			return false;
+		}
+		if (!seen.insert(s.getStringData()).second) {
+			raise_warning("igbinary_dictionary_register(): \"%s\" is in the dictionary more than once", s.getStringData()->data());
+			return false;
+		}
+	}
+	return true;
+}
+/* }}} */
+
+} // namespace
+
+/* {{{ igbinary_dictionary_find */
+const IgbinaryDictionary* igbinary_dictionary_find(uint32_t id) {
+	if (id == 0 || id > IGBINARY_DICTIONARY_MAX_ID) {
+		return nullptr;
+	}
+	return s_dictionaries[id].load(std::memory_order_acquire);
+}
+/* }}} */
+/* {{{ igbinary_dictionary_register */
+Variant igbinary_dictionary_register(int64_t id, const Array& strings) {
+	if (id <= 0 || id > IGBINARY_DICTIONARY_MAX_ID) {
+		raise_warning("igbinary_dictionary_register(): id must be between 1 and %d", IGBINARY_DICTIONARY_MAX_ID);
+		return false;
+	}
+	const IgbinaryDictionary* existing = s_dictionaries[id].load(std::memory_order_acquire);
+	if (existing == nullptr) {
+		// Static strings are never freed, so they are only made for a valid list which is about to fill the slot.
+		if (!igbinary_dictionary_check(strings)) {
+			return false;
+		}
+		std::lock_guard<std::mutex> lock(s_dictionaries_register_mutex);
+		existing = s_dictionaries[id].load(std::memory_order_acquire);
+		if (existing == nullptr) {
+			std::unique_ptr<IgbinaryDictionary> dictionary(new IgbinaryDictionary());
+			dictionary->id = (uint32_t) id;
+			dictionary->strings.reserve(strings.size());
+			for (ArrayIter iter(strings); iter; ++iter) {
+				const StringData* sd = makeStaticString(iter.secondRef().getStringData());
+				dictionary->ids.emplace(sd, (uint32_t) dictionary->strings.size());
+				dictionary->strings.push_back(sd);
+			}
+			s_dictionaries[id].store(dictionary.release(), std::memory_order_release);
+			return true;
+		}
+		// Another thread registered this id first.
+	}
+	if (!igbinary_dictionary_same(existing, strings)) {
+		raise_warning("igbinary_dictionary_register(): A different dictionary is already registered as %d", (int) id);
+		return false;
+	}
+	return true;
+}
+/* }}} */
+
+} // namespace HPHP
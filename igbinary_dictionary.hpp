@@ -0,0 +1,51 @@
+/*
+  +----------------------------------------------------------------------+
+  | See COPYING file for further copyright information                   |
+  +----------------------------------------------------------------------+
+  | Author of hhvm fork: Tyson Andre <tysonandre775@hotmail.com>         |
+  | See CREDITS for contributors                                         |
+  | Shared string dictionaries, which pre-seed the string ids of         |
+  | serialized data with strings that many payloads use.                 |
+  +----------------------------------------------------------------------+
+*/
+
+#ifndef IGBINARY_DICTIONARY_H__
+#define IGBINARY_DICTIONARY_H__
+
+#include <stdint.h>
+
+#include <unordered_map>
+#include <vector>
+
+#include "hphp/runtime/base/type-string.h"
+
+namespace HPHP {
+
+/*
+ * Data serialized with a dictionary has IGBINARY_FLAG_DICTIONARY set in its version header, followed by the uint32 id of the dictionary.
+ * String ids 0 to size - 1 then refer to the dictionary's strings, and the strings defined by the data get ids from size on.
+ * The dictionary must be registered (with the same strings) wherever the data is unserialized.
+ */
+
+/** Dictionary ids are 1 to this. */
+#define IGBINARY_DICTIONARY_MAX_ID 1023
+
+/** A registered dictionary. Never freed or modified, so it can be used by any thread without locks. */
+struct IgbinaryDictionary {
+	uint32_t id;
+	std::vector<const StringData*> strings;	/**< Static strings, by string id. */
+	std::unordered_map<const StringData*, uint32_t, string_data_hash, string_data_same> ids;	/**< String ids, by contents. */
+
+	/** Returns the string id of s, or -1 if the dictionary doesn't have it. */
+	int64_t find(const StringData* s) const {
+		auto it = ids.find(s);
+		return it == ids.end() ? -1 : (int64_t) it->second;
+	}
+};
+
+/** Returns the dictionary registered under id, or nullptr if there is none. */
+const IgbinaryDictionary* igbinary_dictionary_find(uint32_t id);
+
+}
+
+#endif
@@ -0,0 +1,89 @@
+/*
+  +----------------------------------------------------------------------+
+  | See COPYING file for further copyright information                   |
+  +----------------------------------------------------------------------+
+  | Author of hhvm fork: Tyson Andre <tysonandre775@hotmail.com>         |
+  | See CREDITS for contributors                                         |
+  | This is the process-wide table of the fragments of static arrays.    |
+  +----------------------------------------------------------------------+
+*/
+
+#include "igbinary_fragment_cache.hpp"
+
+#include <atomic>
+
+#include "hphp/util/hash.h"
+
+namespace HPHP {
+
+namespace {
+
+/** Number of slots. Must be a power of 2. At most this many arrays are ever cached. */
+constexpr size_t kFragmentTableSize = 4096;
+/** Number of slots checked for a given array before giving up. */
+constexpr size_t kFragmentMaxProbes = 8;
+
+/**
+ * Slots are filled at most once (null -> fragment) and never cleared, so readers need no locks.
+ * Static arrays are never freed, so their addresses are never reused by other arrays.
+ */
+std::atomic<const IgbinaryFragment*> s_fragment_table[kFragmentTableSize];
+/** The sum of the memory_size() of the cached fragments. */
+std::atomic<size_t> s_fragment_bytes{0};
+
+inline size_t igbinary_fragment_slot(const ArrayData* arr) {
+	return hash_int64((int64_t) reinterpret_cast<uintptr_t>(arr)) & (kFragmentTableSize - 1);
+}
+
+} // namespace
+
+/* {{{ igbinary_fragment_has_room */
+bool igbinary_fragment_has_room(size_t budget) {
+	return s_fragment_bytes.load(std::memory_order_relaxed) < budget;
+}
+/* }}} */
+/* {{{ igbinary_fragment_find */
+const IgbinaryFragment* igbinary_fragment_find(const ArrayData* arr) {
+	size_t slot = igbinary_fragment_slot(arr);
+	for (size_t probe = 0; probe < kFragmentMaxProbes; probe++, slot = (slot + 1) & (kFragmentTableSize - 1)) {
+		const IgbinaryFragment* existing = s_fragment_table[slot].load(std::memory_order_acquire);
+		if (existing == nullptr) {
+			return nullptr;
+		}
+		if (existing->arr == arr) {
+			return existing;
+		}
+	}
+	return nullptr;
+}
+/* }}} */
+/* {{{ igbinary_fragment_add */
+const IgbinaryFragment* igbinary_fragment_add(IgbinaryFragment* fragment, size_t budget) {
+	const size_t size = fragment->memory_size();
+	if (s_fragment_bytes.fetch_add(size, std::memory_order_relaxed) + size > budget) {
+		s_fragment_bytes.fetch_sub(size, std::memory_order_relaxed);
+		return nullptr;
+	}
+	size_t slot = igbinary_fragment_slot(fragment->arr);
+	for (size_t probe = 0; probe < kFragmentMaxProbes; probe++, slot = (slot + 1) & (kFragmentTableSize - 1)) {
+		const IgbinaryFragment* existing = s_fragment_table[slot].load(std::memory_order_acquire);
+		if (existing == nullptr) {
+			if (s_fragment_table[slot].compare_exchange_strong(existing, fragment, std::memory_order_acq_rel)) {
+				return fragment;
+			}
+			// Another thread filled this slot first. existing is now what that thread stored.
+		}
+		if (existing->arr == fragment->arr) {
+			// Another thread cached the same array first.
+			s_fragment_bytes.fetch_sub(size, std::memory_order_relaxed);
+			delete fragment;
+			return existing;
+		}
+	}
+	// All of the candidate slots hold other arrays.
+	s_fragment_bytes.fetch_sub(size, std::memory_order_relaxed);
+	return nullptr;
+}
+/* }}} */
+
+} // namespace HPHP
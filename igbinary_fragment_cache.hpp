@@ -0,0 +1,76 @@
+/*
+  +----------------------------------------------------------------------+
+  | See COPYING file for further copyright information                   |
+  +----------------------------------------------------------------------+
+  | Author of hhvm fork: Tyson Andre <tysonandre775@hotmail.com>         |
+  | See CREDITS for contributors                                         |
+  | A process-wide cache of the serialized bytes of static arrays.       |
+  +----------------------------------------------------------------------+
+*/
+
+#ifndef IGBINARY_FRAGMENT_CACHE_H__
+#define IGBINARY_FRAGMENT_CACHE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <utility>
+#include <vector>
+
+namespace HPHP {
+
+struct ArrayData;
+struct StringData;
+
+/*
+ * Static arrays (literals, constants and other arrays created once per process) never change and are never freed,
+ * so each one is serialized once, on its own, and the bytes are spliced into later payloads.
+ *
+ * The string ids and reference ids in those bytes depend on what was serialized before the array, so they are left out
+ * of the bytes and recorded as relocations, numbered from the start of the fragment. They are written when splicing,
+ * after adding the number of strings and references defined before it. The strings and arrays the fragment defines are
+ * then added to the tables of the payload, so that later values can refer to them.
+ */
+
+/** Arrays with fewer elements than this are serialized directly, which is about as fast as splicing them. */
+#define IGBINARY_FRAGMENT_MIN_ELEMENTS 8
+
+/** Where a string id or reference id goes in the bytes of a fragment. */
+struct IgbinaryFragmentRelocation {
+	uint32_t offset;	/**< Offset in bytes at which the type and id are written. */
+	uint8_t type8;		/**< igbinary_type_string_id8 or igbinary_type_ref8. */
+	uint32_t id;		/**< Id relative to the first string or reference defined by the fragment. */
+};
+
+/** The serialized form of a static array. Never freed or modified once cached, so it can be used by any thread without locks. */
+struct IgbinaryFragment {
+	const ArrayData* arr;
+	std::vector<uint8_t> bytes;	/**< The type, length and contents of the array, without the relocated ids. */
+	std::vector<IgbinaryFragmentRelocation> relocations;	/**< In order of offset. */
+	std::vector<const StringData*> strings;	/**< The strings written in full, by relative string id. These are static strings. */
+	std::vector<std::pair<const ArrayData*, uint32_t>> arrays;	/**< The nested arrays that may be referred to, with their relative reference ids. */
+	uint32_t references;	/**< The number of reference ids defined, including the one of the array itself (relative id 0). */
+
+	/** Returns an estimate of the memory used by this fragment, which is charged against igbinary.static_array_cache_size. */
+	size_t memory_size() const {
+		return sizeof(*this) + bytes.capacity() + relocations.capacity() * sizeof(IgbinaryFragmentRelocation) +
+			strings.capacity() * sizeof(const StringData*) + arrays.capacity() * sizeof(std::pair<const ArrayData*, uint32_t>);
+	}
+};
+
+/** Returns false if the cached fragments already use budget bytes, so new ones shouldn't be created. */
+bool igbinary_fragment_has_room(size_t budget);
+
+/** Returns the fragment cached for the static array arr, or nullptr. */
+const IgbinaryFragment* igbinary_fragment_find(const ArrayData* arr);
+
+/**
+ * Caches fragment, if there is room for it within budget bytes, and takes ownership of it.
+ * Returns the cached fragment for the same array (which is another one if a different thread cached it first),
+ * or nullptr if it wasn't cached, in which case the caller still owns fragment.
+ */
+const IgbinaryFragment* igbinary_fragment_add(IgbinaryFragment* fragment, size_t budget);
+
+}
+
+#endif
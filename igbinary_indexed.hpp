@@ -0,0 +1,74 @@
+/*
+  +----------------------------------------------------------------------+
+  | See COPYING file for further copyright information                   |
+  +----------------------------------------------------------------------+
+  | Author of hhvm fork: Tyson Andre <tysonandre775@hotmail.com>         |
+  | See CREDITS for contributors                                         |
+  | Layout of indexed containers (igbinary_type_indexed), which wrap     |
+  | large arrays and objects so that readers can skip or seek in them.   |
+  +----------------------------------------------------------------------+
+*/
+
+#ifndef IGBINARY_INDEXED_H__
+#define IGBINARY_INDEXED_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "igbinary_cursor.hpp"
+
+namespace HPHP {
+
+/*
+ * An indexed container is written instead of an array or object with at least igbinary.index_threshold elements:
+ *
+ *   igbinary_type_indexed
+ *   uint32 body length      Bytes of the wrapped array or object.
+ *   uint32 strings          Number of string ids defined in the body.
+ *   uint32 references       Number of reference ids defined in the body (including the array's or object's own).
+ *   uint32 table length     Number of entries in the key table. 0 if igbinary.index_keys was off.
+ *   key table               An entry for each element of the array or object, sorted by hash. See below.
+ *   body                    The array or object, in the usual format.
+ *
+ * Each entry of the key table is four uint32s: the hash of the element's key (see igbinary_indexed_hash_*),
+ * the offset of the key in the body, and the number of string ids and reference ids defined in the body before it.
+ * Numbers are big-endian, like the rest of the format.
+ */
+
+/** Bytes after the igbinary_type_indexed byte and before the key table. */
+#define IGBINARY_INDEXED_HEADER_SIZE 16
+/** Bytes of each entry of the key table. */
+#define IGBINARY_INDEXED_ENTRY_SIZE 16
+
+/** An entry of the key table of an indexed container. */
+struct IgbinaryIndexEntry {
+	uint32_t hash;
+	uint32_t offset;
+	uint32_t strings;
+	uint32_t references;
+};
+
+/* FNV-1a. This is part of the format: changing it would break the key tables of existing data. */
+inline uint32_t igbinary_indexed_hash_bytes(uint32_t h, const uint8_t* p, size_t len) {
+	for (size_t i = 0; i < len; i++) {
+		h ^= p[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+/** Hash of a string key. */
+inline uint32_t igbinary_indexed_hash_string(const char* data, size_t len) {
+	return igbinary_indexed_hash_bytes(2166136261u, reinterpret_cast<const uint8_t*>(data), len);
+}
+
+/** Hash of an integer key, which is the hash of its 8 big-endian bytes with a different seed than strings. */
+inline uint32_t igbinary_indexed_hash_int(int64_t i) {
+	uint8_t buf[8];
+	igbinary_store64(buf, (uint64_t) i);
+	return igbinary_indexed_hash_bytes(2166136261u ^ 0x69u, buf, sizeof(buf));
+}
+
+}
+
+#endif
@@ -0,0 +1,188 @@
+/*
+  +----------------------------------------------------------------------+
+  | See COPYING file for further copyright information                   |
+  +----------------------------------------------------------------------+
+  | Author of hhvm fork: Tyson Andre <tysonandre775@hotmail.com>         |
+  | See CREDITS for contributors                                         |
+  | This is the process-wide registry of class schemas.                  |
+  +----------------------------------------------------------------------+
+*/
+
+#include "ext_igbinary.hpp"
+#include "igbinary_schema.hpp"
+
+#include <string.h>
+
+#include <atomic>
+#include <memory>
+
+#include "folly/SharedMutex.h"
+
+#include "hphp/runtime/base/array-iterator.h"
+#include "hphp/runtime/base/runtime-error.h"
+#include "hphp/runtime/base/static-string-table.h"
+#include "hphp/system/systemlib.h"
+
+namespace HPHP {
+
+namespace {
+
+const StaticString s___sleep("__sleep");
+
+/** Class name => its schemas, in order of registration. Schemas are never removed, so the pointers stay valid. */
+typedef hphp_hash_map<const StringData*, std::vector<const IgbinarySchema*>, string_data_hash, string_data_isame> SchemaMap;
+
+folly::SharedMutex s_schemas_lock;
+SchemaMap s_schemas;
+/** Set once the first schema is registered, so that the serializer doesn't take the lock for every class otherwise. */
+std::atomic<bool> s_has_schemas{false};
+
+/* {{{ igbinary_schema_name_matches */
+/** Returns true if name is the serialized name of a property without its "\0Class\0" or "\0*\0" prefix, if it has one. */
+static bool igbinary_schema_name_matches(const StringData* serialized_name, const StringData* name) {
+	const char* data = serialized_name->data();
+	size_t len = serialized_name->size();
+	if (len > 0 && data[0] == '\0') {
+		const char* end = static_cast<const char*>(memchr(data + 1, '\0', len - 1));
+		if (end != nullptr) {
+			len -= end + 1 - data;
+			data = end + 1;
+		}
+	}
+	return len == (size_t) name->size() && memcmp(data, name->data(), len) == 0;
+}
+/* }}} */
+/* {{{ igbinary_schema_same */
+/** Returns true if schema has exactly the given property names, in order. */
+static bool igbinary_schema_same(const IgbinarySchema* schema, const Array& properties) {
+	if (schema->properties.size() != (size_t) properties.size()) {
+		return false;
+	}
+	size_t i = 0;
+	for (ArrayIter iter(properties); iter; ++iter, ++i) {
+		const Variant& name = iter.secondRef();
+		if (!name.isString() || !schema->properties[i]->same(name.getStringData())) {
+			return false;
+		}
+	}
+	return true;
+}
+/* }}} */
+
+} // namespace
+
+/* {{{ igbinary_schema_any */
+bool igbinary_schema_any() {
+	return s_has_schemas.load(std::memory_order_acquire);
+}
+/* }}} */
+/* {{{ igbinary_schema_latest */
+const IgbinarySchema* igbinary_schema_latest(const StringData* class_name) {
+	folly::SharedMutex::ReadHolder read_lock(s_schemas_lock);
+	auto it = s_schemas.find(class_name);
+	if (it == s_schemas.end()) {
+		return nullptr;
+	}
+	const IgbinarySchema* latest = nullptr;
+	for (const IgbinarySchema* schema : it->second) {
+		if (latest == nullptr || schema->version > latest->version) {
+			latest = schema;
+		}
+	}
+	return latest;
+}
+/* }}} */
+/* {{{ igbinary_schema_find */
+const IgbinarySchema* igbinary_schema_find(const StringData* class_name, int64_t version) {
+	folly::SharedMutex::ReadHolder read_lock(s_schemas_lock);
+	auto it = s_schemas.find(class_name);
+	if (it == s_schemas.end()) {
+		return nullptr;
+	}
+	for (const IgbinarySchema* schema : it->second) {
+		if (schema->version == version) {
+			return schema;
+		}
+	}
+	return nullptr;
+}
+/* }}} */
+/* {{{ igbinary_schema_props */
+bool igbinary_schema_props(const IgbinarySchema* schema, const IgbinaryClassLayout* layout, std::vector<IgbinaryClassLayout::SerializedProp>& props) {
+	const auto& serialized_props = layout->serialized_props;
+	if (!layout->serialize_from_slots || schema->properties.size() != serialized_props.size()) {
+		return false;
+	}
+	props.clear();
+	props.reserve(serialized_props.size());
+	std::vector<bool> listed(serialized_props.size(), false);
+	for (const StringData* name : schema->properties) {
+		// A private property of a parent class may have the same name as a property of the class. Such names are ambiguous.
+		size_t found = serialized_props.size();
+		for (size_t i = 0; i < serialized_props.size(); i++) {
+			if (igbinary_schema_name_matches(serialized_props[i].name, name)) {
+				if (found != serialized_props.size()) {
+					return false;
+				}
+				found = i;
+			}
+		}
+		if (found == serialized_props.size() || listed[found]) {
+			return false;
+		}
+		listed[found] = true;
+		props.push_back(serialized_props[found]);
+	}
+	return true;
+}
+/* }}} */
+/* {{{ igbinary_schema_register */
+Variant igbinary_schema_register(const String& class_name, const Array& properties, int64_t version) {
+	const IgbinaryClassLayout* layout = igbinary_class_layout_for_name(class_name.get());  // with autoloading
+	if (layout == nullptr) {
+		raise_warning("igbinary_schema_register(): Class %s does not exist", class_name.data());
+		return false;
+	}
+	Class* cls = layout->cls;
+	if (!layout->serialize_from_slots || cls->isCollectionClass() || cls->classof(SystemLib::s_SerializableClass) ||
+			cls->lookupMethod(s___sleep.get()) != nullptr) {
+		raise_warning("igbinary_schema_register(): Instances of %s aren't serialized from their declared properties", cls->name()->data());
+		return false;
+	}
+
+	std::unique_ptr<IgbinarySchema> schema(new IgbinarySchema());
+	schema->class_name = makeStaticString(cls->name());
+	schema->version = version;
+	schema->properties.reserve(properties.size());
+	for (ArrayIter iter(properties); iter; ++iter) {
+		const Variant& name = iter.secondRef();
+		if (!name.isString()) {
+			raise_warning("igbinary_schema_register(): Expected a list of property names");
+			return false;
+		}
+		schema->properties.push_back(makeStaticString(name.getStringData()));
+	}
+	std::vector<IgbinaryClassLayout::SerializedProp> props;
+	if (!igbinary_schema_props(schema.get(), layout, props)) {
+		raise_warning("igbinary_schema_register(): The properties must name each declared property of %s exactly once", cls->name()->data());
+		return false;
+	}
+
+	folly::SharedMutex::WriteHolder write_lock(s_schemas_lock);
+	auto& schemas = s_schemas[schema->class_name];
+	for (const IgbinarySchema* existing : schemas) {
+		if (existing->version == version) {
+			if (!igbinary_schema_same(existing, properties)) {
+				raise_warning("igbinary_schema_register(): A different schema is already registered as version %lld of %s", (long long) version, cls->name()->data());
+				return false;
+			}
+			return true;
+		}
+	}
+	schemas.push_back(schema.release());
+	s_has_schemas.store(true, std::memory_order_release);
+	return true;
+}
+/* }}} */
+
+} // namespace HPHP
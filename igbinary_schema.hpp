@@ -0,0 +1,62 @@
+/*
+  +----------------------------------------------------------------------+
+  | See COPYING file for further copyright information                   |
+  +----------------------------------------------------------------------+
+  | Author of hhvm fork: Tyson Andre <tysonandre775@hotmail.com>         |
+  | See CREDITS for contributors                                         |
+  | Registered class schemas, which let instances of a class be          |
+  | serialized as their property values in a fixed order.                |
+  +----------------------------------------------------------------------+
+*/
+
+#ifndef IGBINARY_SCHEMA_H__
+#define IGBINARY_SCHEMA_H__
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "hphp/runtime/base/type-string.h"
+
+#include "igbinary_class_layout.hpp"
+
+namespace HPHP {
+
+/*
+ * An object of a class with a registered schema is serialized as igbinary_type_object_schema8 (16, 32) followed by a schema id.
+ * Schema ids are numbered from 0 in the order the data defines them. The first object using a schema defines it:
+ * Its id is then followed by the schema's class name, its version (a long), and its number of properties (as igbinary_type_array8, 16 or 32)
+ * followed by that many serialized (mangled) property names. The class name and property names are string8/16/32 with their bytes,
+ * and don't define string ids.
+ * The property values of the object follow (after the definition, if any), in the order of the schema's property names.
+ * Each object has one reference id, like other objects.
+ *
+ * The unserializer writes the values straight into the declared property slots if the same version of the schema
+ * is registered where the data is unserialized, and otherwise looks up each property name as for other objects.
+ */
+
+/** A registered version of the schema of a class. Never freed or modified, so it can be used by any thread without locks. */
+struct IgbinarySchema {
+	const StringData* class_name;	/**< Static string, as passed to igbinary_schema_register. */
+	int64_t version;
+	std::vector<const StringData*> properties;	/**< Static strings. The unmangled names of all of the declared properties, in serialized order. */
+};
+
+/** Returns true if any schema was registered in this process. Checked before the lookups below. */
+bool igbinary_schema_any();
+
+/** Returns the registered schema of the class with the highest version, or nullptr if there is none. Class names are case insensitive. */
+const IgbinarySchema* igbinary_schema_latest(const StringData* class_name);
+
+/** Returns the schema registered for the class with this version, or nullptr if there is none. */
+const IgbinarySchema* igbinary_schema_find(const StringData* class_name, int64_t version);
+
+/**
+ * Sets props to the declared properties of layout's class in the order of the schema.
+ * Returns false if the schema doesn't name each of them exactly once (e.g. if the class changed since the schema was registered).
+ */
+bool igbinary_schema_props(const IgbinarySchema* schema, const IgbinaryClassLayout* layout, std::vector<IgbinaryClassLayout::SerializedProp>& props);
+
+}
+
+#endif
@@ -11,7 +11,16 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <algorithm>
+#include <memory>
+
 #include "hash_ptr.hpp"
+#include "igbinary_compress.hpp"
+#include "igbinary_cursor.hpp"
+#include "igbinary_dictionary.hpp"
+#include "igbinary_fragment_cache.hpp"
+#include "igbinary_indexed.hpp"
+#include "igbinary_schema.hpp"
 // For HHVM_VERSION_*
 #include "hphp/runtime/version.h"
 
@@ -30,6 +39,14 @@
 
 #include "hphp/runtime/base/array-iterator.h"
 #include "hphp/runtime/base/builtin-functions.h"
+#include "hphp/runtime/base/file.h"
+// for req::hash_map
+#include "hphp/runtime/base/req-containers.h"
+// for ::HPHP::collections::asArray
+#include "hphp/runtime/base/collections.h"
+
+#include "igbinary_class_layout.hpp"
+#include "igbinary_context_pool.hpp"
 
 
 #include "hphp/system/systemlib.h"
@@ -47,9 +64,17 @@ const StaticString
 inline static void igbinary_serialize_variant(struct igbinary_serialize_data *igsd, const Variant& self);
 inline static int igbinary_serialize_array_ref_by_key(struct igbinary_serialize_data *igsd, const uintptr_t key, bool object);
 
-typedef hphp_hash_map<const StringData*, uint32_t, string_data_hash, string_data_same> StringIdMap;
+typedef req::hash_map<const StringData*, uint32_t, string_data_hash, string_data_same> StringIdMap;
+
+/** The schema of a class, as used by one call. See igbinary_serialize_object_schema. */
+struct igbinary_serialize_schema {
+	const IgbinarySchema* schema;	/**< nullptr if the class has no usable schema, and its instances are serialized with property names. */
+	std::vector<IgbinaryClassLayout::SerializedProp> props;	/**< The declared properties, in the order of the schema. */
+	int64_t id;						/**< The schema id, or -1 if the data doesn't define it yet. */
+};
 
 /** Serializer data.
+ * Reused between calls, see s_serialize_contexts. igbinary_serialize_data_init prepares it for a call.
  * @author Oleg Grenrus <oleg.grenrus@dynamoid.com>
  */
 struct igbinary_serialize_data {
@@ -59,8 +84,36 @@ struct igbinary_serialize_data {
 	StringIdMap strings;		/**< Hash of already serialized strings. */
 	struct hash_si_ptr references;	/**< Hash of already serialized potential references. (non-NULL uintptr_t => int32_t) */
 	int references_id;			/**< Number of things that the unserializer might think are references. >= length of references */
+	uint32_t flush_threshold;	/**< igbinary_serialize_flush is called between values once buffer holds at least this many bytes. */
+	size_t flushed_bytes;		/**< Number of bytes removed from buffer by igbinary_serialize_flush. */
+	File* stream;				/**< Where igbinary_serialize_flush writes the buffer. If null, the buffer is discarded. */
+	size_t strings_defined;		/**< Number of strings and class names written in full, i.e. the number of string ids the unserializer defined. */
+	uint32_t index_threshold;	/**< Arrays and objects with at least this many elements are written as indexed containers. 0 to disable. */
+	bool index_keys;			/**< Whether indexed containers have a key table. */
+	uint32_t index_depth;		/**< Number of indexed containers being written. The buffer isn't flushed inside them. */
+	const IgbinaryDictionary* dictionary;	/**< Strings which are serialized as their string ids in the dictionary. May be null. */
+	uint32_t strings_start;		/**< The first string id defined by the data, i.e. the number of strings in the dictionary. */
+	IgbinaryFragment* fragment;	/**< The fragment whose ids are being recorded instead of written, see igbinary_serialize_static_fragment. Usually null. */
+	bool use_schemas;			/**< Whether any class schema was registered. */
+	req::hash_map<const Class*, igbinary_serialize_schema> schemas;	/**< The schemas of the classes of the objects serialized so far. */
+	uint32_t schemas_defined;	/**< Number of schemas the data defined, i.e. the next schema id. */
+	/** Where igbinary_serialize_data_compress compresses the data. Its contents are left over from the last use, so it isn't cleared between calls. */
+	req::vector<uint8_t> scratch;
+
+	igbinary_serialize_data() {
+		hash_si_ptr_init(&references, 16);
+	}
+
+	~igbinary_serialize_data() {
+		hash_si_ptr_deinit(&references);
+	}
+
+	void release(size_t high_water_mark);
 };
 
+/** One context per nesting level of igbinary_serialize calls. */
+IMPLEMENT_STATIC_REQUEST_LOCAL(IgbinaryContextPool<igbinary_serialize_data>, s_serialize_contexts);
+
 inline static int igbinary_serialize_array_ref(struct igbinary_serialize_data *igsd, const Variant& self, bool object);
 
 /* {{{ igbinary_serialize_data_init */
@@ -71,17 +124,141 @@ inline static int igbinary_serialize_data_init(struct igbinary_serialize_data *i
 	igsd->buffer.setOutputLimit(StringData::MaxSize);
 
 	igsd->scalar = scalar;  // TODO use?
-	if (!igsd->scalar) {
-		igsd->strings.reserve(16);
-		hash_si_ptr_init(&igsd->references, 16);
-		igsd->references_id = 0;
-	}
+	// strings and references were emptied by the previous call's release().
+	assert(igsd->strings.empty() && hash_si_ptr_size(&igsd->references) == 0);
+	igsd->references_id = 0;
 
 	igsd->compact_strings = igbinary_should_compact_strings(); /* FIXME allow ini options parsing */
+	igsd->flush_threshold = UINT32_MAX;  // Never, buffer is limited to StringData::MaxSize.
+	igsd->flushed_bytes = 0;
+	igsd->stream = nullptr;
+	igsd->strings_defined = 0;
+	igsd->index_threshold = igbinary_index_threshold();
+	igsd->index_keys = igbinary_should_index_keys();
+	igsd->index_depth = 0;
+	igsd->dictionary = nullptr;
+	igsd->strings_start = 0;
+	igsd->fragment = nullptr;
+	assert(igsd->schemas.empty());
+	igsd->use_schemas = igbinary_schema_any();
+	igsd->schemas_defined = 0;
 
 	return r;
 }
+/* }}} */
+/* {{{ igbinary_serialize_data::release */
+/** Empties the context for the next call, freeing the tables that grew past high_water_mark bytes. */
+void igbinary_serialize_data::release(size_t high_water_mark) {
+	if (buffer.capacity() > high_water_mark) {
+		buffer.release();
+	} else {
+		buffer.clear();
+	}
+	if (strings.bucket_count() * sizeof(void*) > high_water_mark) {
+		StringIdMap().swap(strings);
+	} else {
+		strings.clear();
+	}
+	if (hash_si_ptr_capacity(&references) * (sizeof(struct hash_si_ptr_pair) + 1) > high_water_mark) {
+		hash_si_ptr_deinit(&references);
+		hash_si_ptr_init(&references, 16);
+	} else {
+		hash_si_ptr_clear(&references);
+	}
+	schemas.clear();
+	if (scratch.capacity() > high_water_mark) {
+		req::vector<uint8_t>().swap(scratch);
+	}
+}
+/* }}} */
+/* {{{ igbinary_serialize_data_reserve */
+/** Grows the buffer's capacity to at least len bytes, without changing its contents. */
+inline static void igbinary_serialize_data_reserve(struct igbinary_serialize_data *igsd, size_t len) {
+	if (len > igsd->buffer.size()) {
+		igsd->buffer.appendCursor(std::min<size_t>(len, StringData::MaxSize) - igsd->buffer.size());
+	}
+}
+/* }}} */
+/* {{{ igbinary_serialize_data_detach */
+/**
+ * Returns the serialized data.
+ * If the reserved capacity turned out to be far larger than the output, the output is copied,
+ * so that callers which keep the result around don't also keep the unused capacity.
+ */
+inline static String igbinary_serialize_data_detach(struct igbinary_serialize_data *igsd) {
+	const size_t len = igsd->buffer.size();
+	if (UNLIKELY(igsd->buffer.capacity() > 2 * len + 4096)) {
+		return String(igsd->buffer.data(), len, CopyString);
+	}
+	return igsd->buffer.detach();
+}
+/* }}} */
+/* {{{ igbinary_serialize_data_compress */
+/**
+ * Returns the serialized data compressed straight from the buffer into the context's scratch buffer,
+ * and then copied into a string of exactly its length, so the result doesn't keep the capacity of the uncompressed data.
+ * Returns a null String if compressing doesn't make the data smaller.
+ */
+static String igbinary_serialize_data_compress(struct igbinary_serialize_data *igsd) {
+	const uint8_t* const data = reinterpret_cast<const uint8_t*>(igsd->buffer.data());
+	const size_t body_len = igsd->buffer.size() - 4;
+	if (body_len <= 8 || body_len > 0xffffffff) {
+		return String();
+	}
+	// The block is only kept if it and its length are shorter than the uncompressed data, so no more than that is needed.
+	if (igsd->scratch.size() < 8 + body_len) {
+		igsd->scratch.resize(8 + body_len);
+	}
+	uint8_t* const start = igsd->scratch.data();
+	igbinary_store32(start, igbinary_load32(data) | IGBINARY_FLAG_COMPRESSED);
+	igbinary_store32(start + 4, (uint32_t) body_len);
+	const size_t block_len = igbinary_lz4_compress(data + 4, body_len, start + 8, body_len - 5);
+	if (block_len == 0) {
+		return String();
+	}
+	return String(reinterpret_cast<const char*>(start), 8 + block_len, CopyString);
+}
+/* }}} */
+/* {{{ igbinary_serialize_flush */
+/**
+ * Writes the buffered output to igsd->stream (or discards it, for igbinary_serialized_size), and empties the buffer.
+ * Keeps count of the bytes that were removed from the buffer.
+ */
+NEVER_INLINE static void igbinary_serialize_flush(struct igbinary_serialize_data *igsd) {
+	const size_t len = igsd->buffer.size();
+	if (len == 0) {
+		return;
+	}
+	if (igsd->stream != nullptr) {
+		// Hand the buffer's string to the stream instead of copying it, and start a new buffer of the same size.
+		const String chunk = igsd->buffer.detach();
+		if (igsd->stream->write(chunk) != (int64_t) len) {
+			throw IgbinaryWarning("igbinary_serialize_to_stream: Failed to write %zu bytes after %zu bytes", len, igsd->flushed_bytes);
+		}
+		igbinary_serialize_data_reserve(igsd, igsd->flush_threshold);
+	} else {
+		igsd->buffer.clear();
+	}
+	igsd->flushed_bytes += len;
+}
+/* }}} */
 
+/* {{{ igbinary_serialize_reserve */
+/**
+ * Reserves room for up to len bytes at the end of the output, and returns a cursor to write them at.
+ * Pass it and the cursor's final position to igbinary_serialize_commit.
+ */
+inline static uint8_t* igbinary_serialize_reserve(struct igbinary_serialize_data *igsd, size_t len) {
+	return reinterpret_cast<uint8_t*>(igsd->buffer.appendCursor(len));
+}
+/* }}} */
+/* {{{ igbinary_serialize_commit */
+/** Marks the bytes written between start (returned by igbinary_serialize_reserve()) and end as part of the output. */
+inline static void igbinary_serialize_commit(struct igbinary_serialize_data *igsd, const uint8_t* start, const uint8_t* end) {
+	StringBuffer& buf = igsd->buffer;
+	buf.resize(buf.size() + (end - start));
+}
+/* }}} */
 /* {{{ igbinary_serialize8 */
 /** Serialize 8bit value. */
 inline static void igbinary_serialize8(struct igbinary_serialize_data *igsd, uint8_t i) {
@@ -91,54 +268,86 @@ inline static void igbinary_serialize8(struct igbinary_serialize_data *igsd, uin
 /* {{{ igbinary_serialize16 */
 /** Serialize 16bit value. */
 inline static void igbinary_serialize16(struct igbinary_serialize_data *igsd, uint16_t i) {
-	StringBuffer& buf = igsd->buffer;
-	char* const bytes = buf.appendCursor(2);
-
-	bytes[0] = (char) ((i >> 8) & 0xff);
-	bytes[1] = (char) (i & 0xff);
-	buf.resize(buf.size() + 2);
+	uint8_t* const start = igbinary_serialize_reserve(igsd, 2);
+	igbinary_serialize_commit(igsd, start, igbinary_store16(start, i));
 }
 /* }}} */
 /* {{{ igbinary_serialize32 */
 /** Serialize 32bit value. */
 inline static void igbinary_serialize32(struct igbinary_serialize_data *igsd, uint32_t i) {
-	StringBuffer& buf = igsd->buffer;
-	char* const bytes = buf.appendCursor(4);
-
-	bytes[0] = (char) ((i >> 24) & 0xff);
-	bytes[1] = (char) ((i >> 16) & 0xff);
-	bytes[2] = (char) ((i >> 8) & 0xff);
-	bytes[3] = (char) (i & 0xff);
-	buf.resize(buf.size() + 4);
+	uint8_t* const start = igbinary_serialize_reserve(igsd, 4);
+	igbinary_serialize_commit(igsd, start, igbinary_store32(start, i));
 }
 /* }}} */
 /* {{{ igbinary_serialize64 */
 /** Serialize 64bit value. */
-inline static int igbinary_serialize64(struct igbinary_serialize_data *igsd, uint64_t i) {
-	StringBuffer& buf = igsd->buffer;
-	char* const bytes = buf.appendCursor(8);
-
-	bytes[0] = (char) ((i >> 56) & 0xff);
-	bytes[1] = (char) ((i >> 48) & 0xff);
-	bytes[2] = (char) ((i >> 40) & 0xff);
-	bytes[3] = (char) ((i >> 32) & 0xff);
-	bytes[4] = (char) ((i >> 24) & 0xff);
-	bytes[5] = (char) ((i >> 16) & 0xff);
-	bytes[6] = (char) ((i >> 8) & 0xff);
-	bytes[7] = (char) (i & 0xff);
-	buf.resize(buf.size() + 8);
-
-	return 0;
+inline static void igbinary_serialize64(struct igbinary_serialize_data *igsd, uint64_t i) {
+	uint8_t* const start = igbinary_serialize_reserve(igsd, 8);
+	igbinary_serialize_commit(igsd, start, igbinary_store64(start, i));
+}
+/* }}} */
+/* {{{ igbinary_write_type_and_len */
+/**
+ * Writes a type followed by a length, id or count at cursor, picking the smallest of the 8, 16 and 32 bit variants of the type.
+ * type8 is the 8 bit variant. The 16 and 32 bit variants must be type8 + 1 and type8 + 2.
+ * Writes at most 5 bytes, and returns the address after the last byte written.
+ */
+inline static uint8_t* igbinary_write_type_and_len(uint8_t* cursor, uint8_t type8, uint32_t len) {
+	if (len <= 0xff) {
+		cursor[0] = type8;
+		cursor[1] = (uint8_t) len;
+		return cursor + 2;
+	} else if (len <= 0xffff) {
+		cursor[0] = type8 + 1;
+		return igbinary_store16(cursor + 1, (uint16_t) len);
+	} else {
+		cursor[0] = type8 + 2;
+		return igbinary_store32(cursor + 1, len);
+	}
+}
+/* }}} */
+/* {{{ igbinary_serialize_type_and_len */
+/** Serializes a type followed by a length, id or count. See igbinary_write_type_and_len. */
+inline static void igbinary_serialize_type_and_len(struct igbinary_serialize_data *igsd, uint8_t type8, uint32_t len) {
+	uint8_t* const start = igbinary_serialize_reserve(igsd, 5);
+	igbinary_serialize_commit(igsd, start, igbinary_write_type_and_len(start, type8, len));
+}
+/* }}} */
+/* {{{ igbinary_serialize_type_and_len_and_bytes */
+/** Same as igbinary_serialize_type_and_len, followed by the len bytes of data. */
+inline static void igbinary_serialize_type_and_len_and_bytes(struct igbinary_serialize_data *igsd, uint8_t type8, const char* data, uint32_t len) {
+	uint8_t* const start = igbinary_serialize_reserve(igsd, 5 + (size_t)len);
+	uint8_t* const cursor = igbinary_write_type_and_len(start, type8, len);
+	memcpy(cursor, data, len);
+	igbinary_serialize_commit(igsd, start, cursor + len);
 }
 /* }}} */
-
 
 /* {{{ igbinary_serialize_header */
 /** Serializes header. */
 inline static void igbinary_serialize_header(struct igbinary_serialize_data *igsd) {
+	if (UNLIKELY(igsd->dictionary != nullptr)) {
+		igbinary_serialize32(igsd, IGBINARY_FORMAT_VERSION | IGBINARY_FLAG_DICTIONARY); /* version */
+		igbinary_serialize32(igsd, igsd->dictionary->id);
+		return;
+	}
 	igbinary_serialize32(igsd, IGBINARY_FORMAT_VERSION); /* version */
 }
 /* }}} */
+/* {{{ igbinary_serialize_dictionary */
+/** Makes igsd serialize the strings of the dictionary registered as dictionary_id as string ids. Call before igbinary_serialize_header. */
+inline static void igbinary_serialize_dictionary(struct igbinary_serialize_data *igsd, uint32_t dictionary_id) {
+	if (dictionary_id == 0) {
+		return;
+	}
+	const IgbinaryDictionary* dictionary = igbinary_dictionary_find(dictionary_id);
+	if (dictionary == nullptr) {
+		throw IgbinaryWarning("igbinary_serialize: dictionary %u is not registered", dictionary_id);
+	}
+	igsd->dictionary = dictionary;
+	igsd->strings_start = (uint32_t) dictionary->strings.size();
+}
+/* }}} */
 
 /* {{{ igbinary_serialize_null */
 /** Serializes null. */
@@ -154,73 +363,110 @@ inline static void igbinary_serialize_bool(struct igbinary_serialize_data *igsd,
 /* {{{ igbinary_serialize_int64 */
 /** Serializes 64-bit integer. */
 inline static void igbinary_serialize_int64(struct igbinary_serialize_data *igsd, int64_t l) {
-	uint64_t k = l >= 0 ? l : -l;
+	uint64_t k = l >= 0 ? l : -(uint64_t)l;
 	bool p = l >= 0;
+	uint8_t* const start = igbinary_serialize_reserve(igsd, 9);
+	uint8_t* cursor = start;
 
-	/* -ZEND_LONG_MIN is 0 otherwise. */
-	if (l == INT64_MIN) {
-		igbinary_serialize8(igsd, (uint8_t) igbinary_type_long64n);
-		igbinary_serialize64(igsd, (uint64_t) 0x8000000000000000);
-		return;
-	}
-
+	/* -INT64_MIN is INT64_MIN, so it takes the 64 bit branch. */
 	if (k <= 0xff) {
-		igbinary_serialize8(igsd, (uint8_t) (p ? igbinary_type_long8p : igbinary_type_long8n));
-		igbinary_serialize8(igsd, (uint8_t) k);
+		cursor[0] = (uint8_t) (p ? igbinary_type_long8p : igbinary_type_long8n);
+		cursor[1] = (uint8_t) k;
+		cursor += 2;
 	} else if (k <= 0xffff) {
-		igbinary_serialize8(igsd, (uint8_t) (p ? igbinary_type_long16p : igbinary_type_long16n));
-		igbinary_serialize16(igsd, (uint16_t) k);
+		cursor[0] = (uint8_t) (p ? igbinary_type_long16p : igbinary_type_long16n);
+		cursor = igbinary_store16(cursor + 1, (uint16_t) k);
 	} else if (k <= 0xffffffff) {
-		igbinary_serialize8(igsd, (uint8_t) (p ? igbinary_type_long32p : igbinary_type_long32n));
-		igbinary_serialize32(igsd, (uint32_t) k);
+		cursor[0] = (uint8_t) (p ? igbinary_type_long32p : igbinary_type_long32n);
+		cursor = igbinary_store32(cursor + 1, (uint32_t) k);
 	} else {
-		igbinary_serialize8(igsd, (uint8_t) (p ? igbinary_type_long64p : igbinary_type_long64n));
-		igbinary_serialize64(igsd, (uint64_t) k);
+		cursor[0] = (uint8_t) (p ? igbinary_type_long64p : igbinary_type_long64n);
+		cursor = igbinary_store64(cursor + 1, k);
 	}
+	igbinary_serialize_commit(igsd, start, cursor);
 }
 /* }}} */
 /* {{{ igbinary_serialize_double */
 /** Serializes double. */
 inline static void igbinary_serialize_double(struct igbinary_serialize_data *igsd, double d) {
-	union {
-		double d;
-		uint64_t u;
-	} u;
-	igbinary_serialize8(igsd, igbinary_type_double);
-	u.d = d;
-	igbinary_serialize64(igsd, u.u);
+	uint64_t u;
+	memcpy(&u, &d, sizeof(u));
+	uint8_t* const start = igbinary_serialize_reserve(igsd, 9);
+	start[0] = igbinary_type_double;
+	igbinary_serialize_commit(igsd, start, igbinary_store64(start + 1, u));
 }
 /* }}} */
 /* {{{ igbinary_serialize_append_bytes */
 inline static void igbinary_serialize_append_bytes(struct igbinary_serialize_data *igsd, const char* data, const size_t len) {
-	StringBuffer& buf = igsd->buffer;
-	char* const bytes = buf.appendCursor(len);
-	memcpy(bytes, data, len);
-	buf.resize(buf.size() + len);
+	uint8_t* const start = igbinary_serialize_reserve(igsd, len);
+	memcpy(start, data, len);
+	igbinary_serialize_commit(igsd, start, start + len);
 }
+/* }}} */
 
 /* {{{ igbinary_serialize_chararray */
 /** Serializes string data. */
 inline static int igbinary_serialize_chararray(struct igbinary_serialize_data *igsd, const StringData* string) {
 	const size_t len = string->size();
-	if (len <= 0xff) {
-		igbinary_serialize8(igsd, igbinary_type_string8);
-		igbinary_serialize8(igsd, len);
-	} else if (len <= 0xffff) {
-		igbinary_serialize8(igsd, igbinary_type_string16);
-		igbinary_serialize16(igsd, len);
-	} else if (LIKELY(len <= 0xffffffff)) {
-		igbinary_serialize8(igsd, igbinary_type_string32);
-		igbinary_serialize32(igsd, len);
-	} else {
+	if (UNLIKELY(len > 0xffffffff)) {
 		throw IgbinaryWarning("igbinary_serialize_chararray: Too long for other igbinary v2 implementations to parse");
 	}
-
-	igbinary_serialize_append_bytes(igsd, string->data(), len);
+	igbinary_serialize_type_and_len_and_bytes(igsd, igbinary_type_string8, string->data(), len);
+	igsd->strings_defined++;
 
 	return 0;
 }
 /* }}} */
+/* {{{ igbinary_serialize_id */
+/** Serializes a string id or reference id, or records it as a relocation if a fragment is being recorded. */
+inline static void igbinary_serialize_id(struct igbinary_serialize_data *igsd, enum igbinary_type type8, uint32_t id) {
+	if (UNLIKELY(igsd->fragment != nullptr)) {
+		igsd->fragment->relocations.push_back(IgbinaryFragmentRelocation{(uint32_t) igsd->buffer.size(), (uint8_t) type8, id});
+		return;
+	}
+	igbinary_serialize_type_and_len(igsd, type8, id);
+}
+/* }}} */
+/* {{{ igbinary_serialized_len_size */
+/** Returns the number of bytes igbinary_write_type_and_len writes for len. */
+inline static size_t igbinary_serialized_len_size(size_t len) {
+	return len <= 0xff ? 2 : len <= 0xffff ? 3 : 5;
+}
+/* }}} */
+/* {{{ igbinary_serialized_scalar_size */
+/**
+ * Returns the exact number of bytes igbinary_serialize_variant writes for a top-level scalar (excluding the header),
+ * or 0 if that can't be computed without serializing it (arrays, objects and references).
+ */
+inline static size_t igbinary_serialized_scalar_size(const Variant& self) {
+	auto tv = self.asTypedValue();
+
+	switch (tv->m_type) {
+		case KindOfUninit:
+		case KindOfNull:
+		case KindOfResource:
+		case KindOfBoolean:
+			return 1;
+		case KindOfInt64:
+			{
+				const int64_t l = tv->m_data.num;
+				const uint64_t k = l >= 0 ? l : -(uint64_t)l;
+				return k <= 0xff ? 2 : k <= 0xffff ? 3 : k <= 0xffffffff ? 5 : 9;
+			}
+		case KindOfDouble:
+			return 9;
+		case KindOfString:
+		case KindOfPersistentString:
+			{
+				// Scalars are serialized without string ids.
+				const size_t len = tv->m_data.pstr->size();
+				return len == 0 ? 1 : igbinary_serialized_len_size(len) + len;
+			}
+		default:
+			return 0;
+	}
+}
+/* }}} */
 /* {{{ igbinary_serialize_string */
 /** Serializes string.
  * Serializes each string once, after first time uses pointers.
@@ -232,29 +478,118 @@ inline static void igbinary_serialize_string(struct igbinary_serialize_data *igs
 		return;
 	}
 
+	if (UNLIKELY(igsd->dictionary != nullptr) && !igsd->scalar) {
+		const int64_t id = igsd->dictionary->find(string);
+		if (id >= 0) {
+			igbinary_serialize_type_and_len(igsd, igbinary_type_string_id8, (uint32_t) id);
+			return;
+		}
+	}
 	if (igsd->scalar || !igsd->compact_strings) {
 		igbinary_serialize_chararray(igsd, string);
 		return;
 	}
-	auto result = igsd->strings.insert(std::pair<const StringData*, uint32_t>(string, (uint32_t)igsd->strings.size()));
+	auto result = igsd->strings.insert(std::pair<const StringData*, uint32_t>(string, igsd->strings_start + (uint32_t)igsd->strings_defined));
 	if (result.second) {
 		igbinary_serialize_chararray(igsd, string);
 		return;
 	}
 	uint32_t t = result.first->second;  // old value.
-	if (t <= 0xff) {
-		igbinary_serialize8(igsd, (uint8_t) igbinary_type_string_id8);
-		igbinary_serialize8(igsd, (uint8_t) t);
-	} else if (t <= 0xffff) {
-		igbinary_serialize8(igsd, (uint8_t) igbinary_type_string_id16);
-		igbinary_serialize16(igsd, (uint16_t) t);
+	igbinary_serialize_id(igsd, igbinary_type_string_id8, t);
+}
+/* }}} */
+
+/* {{{ igbinary_serialize_index */
+/** An indexed container being written, see igbinary_indexed.hpp. */
+struct igbinary_serialize_index {
+	size_t start;				/**< Offset of the igbinary_type_indexed byte in the buffer. */
+	size_t body_start;			/**< Offset of the wrapped array or object in the buffer. */
+	size_t strings_start;		/**< igsd->strings_defined before the body. */
+	int references_start;		/**< igsd->references_id before the array or object got its reference id. */
+	uint32_t table_len;			/**< Number of key table entries reserved. */
+	req::vector<IgbinaryIndexEntry> entries;
+};
+/* }}} */
+/* {{{ igbinary_serialize_index_begin */
+/**
+ * Starts an indexed container for an array or object with n elements, if n reaches igbinary.index_threshold.
+ * references_start is igsd->references_id before the array or object got its reference id.
+ * Returns index, or nullptr if the array or object should be written as usual.
+ */
+inline static struct igbinary_serialize_index* igbinary_serialize_index_begin(struct igbinary_serialize_data *igsd, struct igbinary_serialize_index* index, size_t n, int references_start) {
+	if (LIKELY(igsd->index_threshold == 0 || n < igsd->index_threshold)) {
+		return nullptr;
+	}
+	index->start = igsd->buffer.size();
+	index->table_len = igsd->index_keys ? (uint32_t) n : 0;
+	// The header and key table are filled in by igbinary_serialize_index_end.
+	const size_t len = 1 + IGBINARY_INDEXED_HEADER_SIZE + (size_t) index->table_len * IGBINARY_INDEXED_ENTRY_SIZE;
+	uint8_t* const start = igbinary_serialize_reserve(igsd, len);
+	memset(start, 0, len);
+	start[0] = igbinary_type_indexed;
+	igbinary_serialize_commit(igsd, start, start + len);
+
+	index->body_start = igsd->buffer.size();
+	index->strings_start = igsd->strings_defined;
+	index->references_start = references_start;
+	index->entries.reserve(index->table_len);
+	igsd->index_depth++;
+	return index;
+}
+/* }}} */
+/* {{{ igbinary_serialize_index_key */
+/** Records the key with the given hash (see igbinary_indexed_hash_*), which is about to be written, in the key table. */
+inline static void igbinary_serialize_index_key(struct igbinary_serialize_data *igsd, struct igbinary_serialize_index* index, uint32_t hash) {
+	if (index->table_len == 0) {
+		return;
+	}
+	index->entries.push_back(IgbinaryIndexEntry{
+		hash,
+		(uint32_t) (igsd->buffer.size() - index->body_start),
+		(uint32_t) (igsd->strings_defined - index->strings_start),
+		(uint32_t) (igsd->references_id - index->references_start),
+	});
+}
+/* }}} */
+/* {{{ igbinary_serialize_index_key_variant */
+/** Same as igbinary_serialize_index_key, for an int or string key. */
+inline static void igbinary_serialize_index_key_variant(struct igbinary_serialize_data *igsd, struct igbinary_serialize_index* index, const Variant& key) {
+	if (key.isInteger()) {
+		igbinary_serialize_index_key(igsd, index, igbinary_indexed_hash_int(key.toInt64()));
 	} else {
-		igbinary_serialize8(igsd, (uint8_t) igbinary_type_string_id32);
-		igbinary_serialize32(igsd, (uint32_t) t);
+		const StringData* s = key.getStringData();
+		igbinary_serialize_index_key(igsd, index, igbinary_indexed_hash_string(s->data(), s->size()));
+	}
+}
+/* }}} */
+/* {{{ igbinary_serialize_index_end */
+/** Fills in the header and the key table of an indexed container, after its body was written. */
+static void igbinary_serialize_index_end(struct igbinary_serialize_data *igsd, struct igbinary_serialize_index* index) {
+	igsd->index_depth--;
+	const size_t body_len = igsd->buffer.size() - index->body_start;
+	if (UNLIKELY(body_len > 0xffffffff)) {
+		throw IgbinaryWarning("igbinary_serialize_index_end: Indexed container of %llu bytes is too long", (unsigned long long) body_len);
+	}
+	if (UNLIKELY(index->entries.size() != index->table_len)) {
+		throw IgbinaryWarning("igbinary_serialize_index_end: Expected %u elements, got %u", index->table_len, (unsigned int) index->entries.size());
+	}
+	std::stable_sort(index->entries.begin(), index->entries.end(), [](const IgbinaryIndexEntry& a, const IgbinaryIndexEntry& b) {
+		return a.hash < b.hash;
+	});
+	// Nothing was flushed since igbinary_serialize_index_begin, so the header is still in the buffer.
+	uint8_t* cursor = reinterpret_cast<uint8_t*>(const_cast<char*>(igsd->buffer.data())) + index->start + 1;
+	cursor = igbinary_store32(cursor, (uint32_t) body_len);
+	cursor = igbinary_store32(cursor, (uint32_t) (igsd->strings_defined - index->strings_start));
+	cursor = igbinary_store32(cursor, (uint32_t) (igsd->references_id - index->references_start));
+	cursor = igbinary_store32(cursor, index->table_len);
+	for (const auto& entry : index->entries) {
+		cursor = igbinary_store32(cursor, entry.hash);
+		cursor = igbinary_store32(cursor, entry.offset);
+		cursor = igbinary_store32(cursor, entry.strings);
+		cursor = igbinary_store32(cursor, entry.references);
 	}
 }
 /* }}} */
-
 /* {{{ igbinary_serialize_array_key */
 /** Serializes an array/object key */
 inline static void igbinary_serialize_array_key(struct igbinary_serialize_data *igsd, const Variant& self) {
@@ -278,9 +613,105 @@ inline static void igbinary_serialize_array_key(struct igbinary_serialize_data *
 }
 /* }}} */
 
+/* {{{ igbinary_serialize_hack_array */
+/**
+ * Serializes the type, length and contents of arr as a vec (values only), dict (keys and values) or keyset (keys only), depending on type8.
+ * Also used for the backing arrays of collections.
+ */
+inline static void igbinary_serialize_hack_array(struct igbinary_serialize_data *igsd, const ArrayData* arr, enum igbinary_type type8) {
+	igbinary_serialize_type_and_len(igsd, type8, arr->size());
+	switch (type8) {
+		case igbinary_type_vec8:
+			for (ArrayIter iter(arr); iter; ++iter) {
+				igbinary_serialize_variant(igsd, iter.secondRef());
+			}
+			break;
+		case igbinary_type_dict8:
+			for (ArrayIter iter(arr); iter; ++iter) {
+				igbinary_serialize_array_key(igsd, iter.first());
+				igbinary_serialize_variant(igsd, iter.secondRef());
+			}
+			break;
+		default:
+			assert(type8 == igbinary_type_keyset8);
+			for (ArrayIter iter(arr); iter; ++iter) {
+				igbinary_serialize_array_key(igsd, iter.first());
+			}
+			break;
+	}
+}
+/* }}} */
+/* {{{ igbinary_serialize_can_use_fragments */
+/**
+ * Returns true if the static array self can be spliced in from igbinary_fragment_cache.hpp.
+ * Fragments are serialized without a dictionary, indexing or duplicate string checks being turned off,
+ * so they can't be used with those.
+ */
+inline static bool igbinary_serialize_can_use_fragments(struct igbinary_serialize_data *igsd, const Variant& self) {
+	return igsd->fragment == nullptr && self.asTypedValue()->m_type != KindOfRef && igsd->compact_strings && !igsd->scalar &&
+		igsd->dictionary == nullptr && igsd->index_threshold == 0;
+}
+/* }}} */
+inline static void igbinary_serialize_array(struct igbinary_serialize_data *igsd, const Variant& self, bool object, struct igbinary_serialize_index* index);
+/* {{{ igbinary_serialize_static_fragment */
+/** Serializes the static array self on its own, recording its ids as relocations. */
+static std::unique_ptr<IgbinaryFragment> igbinary_serialize_static_fragment(struct igbinary_serialize_data *igsd, const Variant& self) {
+	std::unique_ptr<IgbinaryFragment> fragment(new IgbinaryFragment());
+	fragment->arr = self.asTypedValue()->m_data.parr;
+	igbinary_serialize_data sub;
+	igbinary_serialize_data_init(&sub, false);
+	sub.fragment = fragment.get();
+	igbinary_serialize_array(&sub, self, false, nullptr);
+
+	fragment->bytes.assign(sub.buffer.data(), sub.buffer.data() + sub.buffer.size());
+	fragment->strings.resize(sub.strings_defined);
+	for (const auto& entry : sub.strings) {
+		fragment->strings[entry.second] = entry.first;
+	}
+	fragment->references = (uint32_t) sub.references_id;
+	fragment->relocations.shrink_to_fit();
+	fragment->arrays.shrink_to_fit();
+	return fragment;
+}
+/* }}} */
+/* {{{ igbinary_serialize_splice_fragment */
+/**
+ * Appends the bytes of a fragment, writing its ids relative to the strings and references defined so far,
+ * and adds the strings and arrays it defines to the tables of igsd. references_start is the reference id of the array itself.
+ */
+static void igbinary_serialize_splice_fragment(struct igbinary_serialize_data *igsd, const IgbinaryFragment* fragment, int references_start) {
+	const uint32_t strings_base = igsd->strings_start + (uint32_t) igsd->strings_defined;
+	const char* const bytes = reinterpret_cast<const char*>(fragment->bytes.data());
+	size_t offset = 0;
+	for (const IgbinaryFragmentRelocation& relocation : fragment->relocations) {
+		igbinary_serialize_append_bytes(igsd, bytes + offset, relocation.offset - offset);
+		const uint32_t base = relocation.type8 == igbinary_type_string_id8 ? strings_base : (uint32_t) references_start;
+		igbinary_serialize_type_and_len(igsd, relocation.type8, base + relocation.id);
+		offset = relocation.offset;
+	}
+	igbinary_serialize_append_bytes(igsd, bytes + offset, fragment->bytes.size() - offset);
+
+	// Strings which were already defined keep their old ids. The unserializer gives the copies in the fragment new ones.
+	for (size_t i = 0; i < fragment->strings.size(); i++) {
+		igsd->strings.insert(std::pair<const StringData*, uint32_t>(fragment->strings[i], strings_base + (uint32_t) i));
+	}
+	igsd->strings_defined += fragment->strings.size();
+	for (const auto& entry : fragment->arrays) {
+		const uintptr_t key = reinterpret_cast<uintptr_t>(entry.first);
+		uint32_t existing;
+		if (hash_si_ptr_find(&igsd->references, key, &existing) == 1) {
+			hash_si_ptr_insert(&igsd->references, key, (uint32_t) references_start + entry.second);
+		}
+	}
+	igsd->references_id = references_start + (int) fragment->references;
+}
+/* }}} */
 /* {{{ igbinay_serialize_array */
-/** Serializes array or objects inner properties */
-inline static void igbinary_serialize_array(struct igbinary_serialize_data *igsd, const Variant& self, bool object) {
+/**
+ * Serializes array or objects inner properties.
+ * For objects, index is the indexed container the object is being written in, or nullptr.
+ */
+inline static void igbinary_serialize_array(struct igbinary_serialize_data *igsd, const Variant& self, bool object, struct igbinary_serialize_index* index) {
 	auto tv = self.asTypedValue();
 	const ArrayData* arr;
 
@@ -289,6 +720,12 @@ inline static void igbinary_serialize_array(struct igbinary_serialize_data *igsd
 		case KindOfPersistentArray:
 #endif
 		case KindOfArray:
+		case KindOfPersistentVec:
+		case KindOfVec:
+		case KindOfPersistentDict:
+		case KindOfDict:
+		case KindOfPersistentKeyset:
+		case KindOfKeyset:
 			arr = tv->m_data.parr;
 			break;
 		case KindOfRef:
@@ -301,6 +738,12 @@ inline static void igbinary_serialize_array(struct igbinary_serialize_data *igsd
 					case KindOfPersistentArray:
 #endif
 					case KindOfArray:
+					case KindOfPersistentVec:
+					case KindOfVec:
+					case KindOfPersistentDict:
+					case KindOfDict:
+					case KindOfPersistentKeyset:
+					case KindOfKeyset:
 						arr = tv_deref->m_data.parr;
 						break;
 					default:
@@ -313,102 +756,244 @@ inline static void igbinary_serialize_array(struct igbinary_serialize_data *igsd
 	}
 	size_t n = arr->size();
 
+	const int references_start = igsd->references_id;
 	if (!object && igbinary_serialize_array_ref(igsd, self, false) == 0) {
 		return;
 	}
 
 	// TODO: Support refs.
 
-	if (n <= 0xff) {
-		igbinary_serialize8(igsd, igbinary_type_array8);
-		igbinary_serialize8(igsd, n);
-	} else if (n <= 0xffff) {
-		igbinary_serialize8(igsd, igbinary_type_array16);
-		igbinary_serialize16(igsd, n);
-	} else {
-		igbinary_serialize8(igsd, igbinary_type_array32);
-		igbinary_serialize32(igsd, n);
+	if (UNLIKELY(arr->isStatic()) && !object && n >= IGBINARY_FRAGMENT_MIN_ELEMENTS && igbinary_serialize_can_use_fragments(igsd, self)) {
+		const size_t budget = igbinary_static_array_cache_size();
+		const IgbinaryFragment* fragment = budget > 0 ? igbinary_fragment_find(arr) : nullptr;
+		if (fragment == nullptr && budget > 0 && igbinary_fragment_has_room(budget)) {
+			std::unique_ptr<IgbinaryFragment> created = igbinary_serialize_static_fragment(igsd, self);
+			fragment = igbinary_fragment_add(created.get(), budget);
+			if (fragment != nullptr) {
+				created.release();
+			} else {
+				fragment = created.get();  // No room for it after all. It's been serialized already, so use it this once.
+				igbinary_serialize_splice_fragment(igsd, fragment, references_start);
+				return;
+			}
+		}
+		if (fragment != nullptr) {
+			igbinary_serialize_splice_fragment(igsd, fragment, references_start);
+			return;
+		}
 	}
 
-	if (n == 0) {
+	if (UNLIKELY(!arr->isPHPArray())) {
+		// Hack arrays have their own types, which php5 and php7 can't unserialize. They are never indexed.
+		igbinary_serialize_hack_array(igsd, arr, arr->isVecArray() ? igbinary_type_vec8 : arr->isDict() ? igbinary_type_dict8 : igbinary_type_keyset8);
 		return;
 	}
-	if (false) {
-#if HHVM_VERSION_MAJOR > 3 || (HHVM_VERSION_MAJOR >= 3 && HHVM_VERSION_MINOR >= 14)
-	} else if (arr->isVecArray()) {
-		// it wouldn't be unserializable by php5 and php7.
-		// Maybe igbinary_keyset, igbinary_vecarray for those, or SPL....
-		throw new IgbinaryWarning("igbinary_serialize_array: Unable to handle case of isVecArray");
-#endif
-#if HHVM_VERSION_MAJOR > 3 || (HHVM_VERSION_MAJOR >= 3 && HHVM_VERSION_MINOR >= 15)
-	} else if (arr->isKeyset()) {
-		// TODO find exact patch version(s)?
-		// it wouldn't be unserializable by php5 and php7.
-		// Maybe igbinary_keyset, igbinary_vecarray for those, or SPL....
-		throw new IgbinaryWarning("igbinary_serialize_array: Unable to handle case of isKeyset");
 
-#endif
+	struct igbinary_serialize_index array_index;
+	if (!object) {
+		index = igbinary_serialize_index_begin(igsd, &array_index, n, references_start);
+	}
+	igbinary_serialize_type_and_len(igsd, igbinary_type_array8, n);
+
+	if (n == 0) {
+		return;
+	}
+	if (arr->isPacked()) {
+		// Packed arrays have the keys 0..n-1, in order. Write those directly instead of creating a Variant for each key.
+		int64_t i = 0;
+		for (ArrayIter iter(arr); iter; ++iter, ++i) {
+			if (UNLIKELY(index != nullptr)) {
+				igbinary_serialize_index_key(igsd, index, igbinary_indexed_hash_int(i));
+			}
+			igbinary_serialize_int64(igsd, i);
+			igbinary_serialize_variant(igsd, iter.secondRef());
+		}
 	} else {
 		for (ArrayIter iter(arr); iter; ++iter) {
 			// FIXME check if int or string?
-			igbinary_serialize_array_key(igsd, iter.first());
+			const Variant key = iter.first();
+			if (UNLIKELY(index != nullptr)) {
+				igbinary_serialize_index_key_variant(igsd, index, key);
+			}
+			igbinary_serialize_array_key(igsd, key);
 			igbinary_serialize_variant(igsd, iter.secondRef());
 		}
 	}
+	if (UNLIKELY(index != nullptr) && !object) {
+		igbinary_serialize_index_end(igsd, index);
+	}
 }
 /* }}} */
 /* {{{ igbinary_serialize_object_name */
 /** Serialize object name. */
 inline static void igbinary_serialize_object_name(struct igbinary_serialize_data *igsd, const StringData* class_name) {
-	// TODO: optimize
-	const auto result = igsd->strings.insert(std::pair<const StringData*, uint32_t>(class_name, (uint32_t)igsd->strings.size()));
-	if (result.second) {  // First time the class name was used as a string.
-		auto name_len = class_name->size();
-		if (name_len <= 0xff) {
-			igbinary_serialize8(igsd, (uint8_t) igbinary_type_object8);
-			igbinary_serialize8(igsd, (uint8_t) name_len TSRMLS_CC);
-		} else if (name_len <= 0xffff) {
-			igbinary_serialize8(igsd, (uint8_t) igbinary_type_object16 TSRMLS_CC);
-			igbinary_serialize16(igsd, (uint16_t) name_len TSRMLS_CC);
-		} else {
-			igbinary_serialize8(igsd, (uint8_t) igbinary_type_object32 TSRMLS_CC);
-			igbinary_serialize32(igsd, (uint32_t) name_len TSRMLS_CC);
+	if (UNLIKELY(igsd->dictionary != nullptr)) {
+		const int64_t id = igsd->dictionary->find(class_name);
+		if (id >= 0) {
+			igbinary_serialize_type_and_len(igsd, igbinary_type_object_id8, (uint32_t) id);
+			return;
 		}
-		igbinary_serialize_append_bytes(igsd, class_name->data(), class_name->size());
+	}
+	const auto result = igsd->strings.insert(std::pair<const StringData*, uint32_t>(class_name, igsd->strings_start + (uint32_t)igsd->strings_defined));
+	if (result.second) {  // First time the class name was used as a string.
+		igbinary_serialize_type_and_len_and_bytes(igsd, igbinary_type_object8, class_name->data(), class_name->size());
+		igsd->strings_defined++;
 		return;
 	}
-	const uint32_t t = result.first->second;
 	/* already serialized string */
-	if (t <= 0xff) {
-		igbinary_serialize8(igsd, (uint8_t) igbinary_type_object_id8);
-		igbinary_serialize8(igsd, (uint8_t) t);
-	} else if (t <= 0xffff) {
-		igbinary_serialize8(igsd, (uint8_t) igbinary_type_object_id16);
-		igbinary_serialize16(igsd, (uint16_t) t);
-	} else {
-		igbinary_serialize8(igsd, (uint8_t) igbinary_type_object_id32 TSRMLS_CC);
-		igbinary_serialize32(igsd, (uint32_t) t);
+	igbinary_serialize_type_and_len(igsd, igbinary_type_object_id8, result.first->second);
+}
+/* }}} */
+/* {{{ igbinary_serialize_collection */
+/**
+ * Serializes the class name of a collection, followed by its backing array:
+ * Vector and ImmVector as a vec, Map and ImmMap as a dict, and Set and ImmSet as a keyset.
+ */
+inline static void igbinary_serialize_collection(struct igbinary_serialize_data *igsd, const ObjectData* obj) {
+	enum igbinary_type type8;
+	switch (obj->collectionType()) {
+		case CollectionType::Vector:
+		case CollectionType::ImmVector:
+			type8 = igbinary_type_vec8;
+			break;
+		case CollectionType::Map:
+		case CollectionType::ImmMap:
+			type8 = igbinary_type_dict8;
+			break;
+		case CollectionType::Set:
+		case CollectionType::ImmSet:
+			type8 = igbinary_type_keyset8;
+			break;
+		default:
+			throw IgbinaryWarning("igbinary_serialize_object: HPHP type Pair unsupported, incompatible with php5/php7 implementation");
 	}
+	igbinary_serialize_object_name(igsd, obj->getClassName().get());
+	igbinary_serialize_hack_array(igsd, collections::asArray(obj), type8);
 }
 /* }}} */
 /* {{{ igbinary_serialize_object_serialize_data */
 inline static void igbinary_serialize_object_serialize_data(struct igbinary_serialize_data* igsd, const StrNR& classname, const String& serializedData) {
 	igbinary_serialize_object_name(igsd, classname.get());
 	const size_t serialized_len = serializedData.length();
-	if (serialized_len <= 0xff) {
-		igbinary_serialize8(igsd, (uint8_t) igbinary_type_object_ser8);
-		igbinary_serialize8(igsd, (uint8_t) serialized_len TSRMLS_CC);
-	} else if (serialized_len <= 0xffff) {
-		igbinary_serialize8(igsd, (uint8_t) igbinary_type_object_ser16);
-		igbinary_serialize16(igsd, (uint16_t) serialized_len TSRMLS_CC);
-	} else if (LIKELY(serialized_len <= 0xffffffffL)) {
-		igbinary_serialize8(igsd, (uint8_t) igbinary_type_object_ser32 TSRMLS_CC);
-		igbinary_serialize32(igsd, (uint32_t) serialized_len TSRMLS_CC);
-	} else {
+	if (UNLIKELY(serialized_len > 0xffffffffL)) {
 		throw IgbinaryWarning("igbinary_serialize_object_serialize_data: Data is too long?");
 	}
 
-	igbinary_serialize_append_bytes(igsd, serializedData.data(), serialized_len);
+	igbinary_serialize_type_and_len_and_bytes(igsd, igbinary_type_object_ser8, serializedData.data(), serialized_len);
+}
+/* }}} */
+/* {{{ igbinary_serialize_object_sleep_other_prop */
+/** Serializes a name returned by __sleep which isn't an initialized declared property: A dynamic property, or null (with a notice). */
+inline static void igbinary_serialize_object_sleep_other_prop(struct igbinary_serialize_data *igsd, const ObjectData* obj, const String& memberName) {
+	if (UNLIKELY(obj->getAttribute(ObjectData::HasDynPropArr))) {
+		// TODO: look in depth at e513c6d6d4a847fd7d09e27f23e4554b6955c0f0
+		HPHP::member_rval prop = obj->dynPropArray()->rval(memberName.get());
+		if (prop) {
+			igbinary_serialize_string(igsd, memberName.get());  // TODO: Integer keys? Can probably ignore.
+			igbinary_serialize_variant(igsd, tvAsCVarRef(prop.tv_ptr()));
+			return;
+		}
+	}
+	raise_notice("igbinary_serialize(): \"%s\" returned as member variable from "
+				 "__sleep() but does not exist", memberName.data());
+	// Note: Serialize null as both
+	igbinary_serialize_string(igsd, memberName.get());  // TODO: Integer keys?
+	igbinary_serialize_null(igsd);
+}
+/* }}} */
+/* {{{ igbinary_serialize_object_props */
+/**
+ * Serializes the class name and properties of an object without __sleep, as the array that obj->toArray() would return,
+ * but without creating that array.
+ * references_start is igsd->references_id before the object got its reference id.
+ */
+inline static void igbinary_serialize_object_props(struct igbinary_serialize_data *igsd, const ObjectData* obj, const IgbinaryClassLayout* layout, int references_start) {
+	const TypedValue* prop_vec = obj->propVec();
+	const bool has_dynamic_props = obj->getAttribute(ObjectData::HasDynPropArr);
+	// toArray() skips properties that were unset.
+	size_t n = has_dynamic_props ? obj->dynPropArray().size() : 0;
+	for (const auto& prop : layout->serialized_props) {
+		if (prop_vec[prop.slot].m_type != KindOfUninit) {
+			n++;
+		}
+	}
+	struct igbinary_serialize_index object_index;
+	struct igbinary_serialize_index* const index = igbinary_serialize_index_begin(igsd, &object_index, n, references_start);
+	igbinary_serialize_object_name(igsd, obj->getClassName().get());
+	igbinary_serialize_type_and_len(igsd, igbinary_type_array8, n);
+
+	for (const auto& prop : layout->serialized_props) {
+		const TypedValue* tv = &prop_vec[prop.slot];
+		if (tv->m_type == KindOfUninit) {
+			continue;
+		}
+		if (UNLIKELY(index != nullptr)) {
+			igbinary_serialize_index_key(igsd, index, igbinary_indexed_hash_string(prop.name->data(), prop.name->size()));
+		}
+		igbinary_serialize_string(igsd, prop.name);
+		igbinary_serialize_variant(igsd, tvAsCVarRef(tv));
+	}
+	if (UNLIKELY(has_dynamic_props)) {
+		for (ArrayIter iter(obj->dynPropArray()); iter; ++iter) {
+			const Variant key = iter.first();
+			if (UNLIKELY(index != nullptr)) {
+				igbinary_serialize_index_key_variant(igsd, index, key);
+			}
+			igbinary_serialize_array_key(igsd, key);
+			igbinary_serialize_variant(igsd, iter.secondRef());
+		}
+	}
+	if (UNLIKELY(index != nullptr)) {
+		igbinary_serialize_index_end(igsd, index);
+	}
+}
+/* }}} */
+/* {{{ igbinary_serialize_object_schema */
+/**
+ * Serializes an object without __sleep as the values of its declared properties, in the order of its class's schema.
+ * The first object of each class in the data also defines the schema, see igbinary_schema.hpp.
+ * Returns false without writing anything if the class has no schema, or the object has dynamic or unset properties.
+ * Not used inside indexed containers, whose key tables need the property names.
+ */
+inline static bool igbinary_serialize_object_schema(struct igbinary_serialize_data *igsd, const ObjectData* obj, const IgbinaryClassLayout* layout) {
+	if (igsd->index_depth > 0 || (obj->getAttribute(ObjectData::HasDynPropArr) && !obj->dynPropArray().empty())) {
+		return false;
+	}
+	auto result = igsd->schemas.emplace(layout->cls, igbinary_serialize_schema{nullptr, {}, -1});
+	igbinary_serialize_schema& entry = result.first->second;
+	if (result.second) {
+		const IgbinarySchema* schema = igbinary_schema_latest(layout->cls->name());
+		if (schema != nullptr && igbinary_schema_props(schema, layout, entry.props)) {
+			entry.schema = schema;
+		}
+	}
+	if (entry.schema == nullptr) {
+		return false;
+	}
+	const TypedValue* prop_vec = obj->propVec();
+	for (const auto& prop : entry.props) {
+		if (prop_vec[prop.slot].m_type == KindOfUninit) {
+			return false;
+		}
+	}
+
+	if (entry.id >= 0) {
+		igbinary_serialize_type_and_len(igsd, igbinary_type_object_schema8, (uint32_t) entry.id);
+	} else {
+		entry.id = igsd->schemas_defined++;
+		igbinary_serialize_type_and_len(igsd, igbinary_type_object_schema8, (uint32_t) entry.id);
+		const StringData* class_name = layout->cls->name();
+		igbinary_serialize_type_and_len_and_bytes(igsd, igbinary_type_string8, class_name->data(), class_name->size());
+		igbinary_serialize_int64(igsd, entry.schema->version);
+		igbinary_serialize_type_and_len(igsd, igbinary_type_array8, entry.props.size());
+		for (const auto& prop : entry.props) {
+			igbinary_serialize_type_and_len_and_bytes(igsd, igbinary_type_string8, prop.name->data(), prop.name->size());
+		}
+	}
+	for (const auto& prop : entry.props) {
+		igbinary_serialize_variant(igsd, tvAsCVarRef(&prop_vec[prop.slot]));
+	}
+	return true;
 }
 /* }}} */
 /* {{{ igbinary_serialize_object */
@@ -422,12 +1007,14 @@ inline static void igbinary_serialize_object(struct igbinary_serialize_data *igs
 	}
 
 	const uintptr_t key = reinterpret_cast<uintptr_t>(obj);
+	const int references_start = igsd->references_id;
 	if (igbinary_serialize_array_ref_by_key(igsd, key, true) == 0) {
 		return;
 	}
 
 	if (obj->isCollection()) {
-		throw IgbinaryWarning("igbinary_serialize_object: Unsupported type isCollection");
+		igbinary_serialize_collection(igsd, obj);
+		return;
 	}
 
 	if (obj->instanceof(SystemLib::s_SerializableClass)) {
@@ -487,15 +1074,22 @@ inline static void igbinary_serialize_object(struct igbinary_serialize_data *igs
         auto const obj_cls = obj->getVMClass();
 		igbinary_serialize_object_name(igsd, obj->getClassName().get());
 		const size_t n = props.size();
-		if (n <= 0xff) {
-			igbinary_serialize8(igsd, igbinary_type_array8);
-			igbinary_serialize8(igsd, n);
-		} else if (n <= 0xffff) {
-			igbinary_serialize8(igsd, igbinary_type_array16);
-			igbinary_serialize16(igsd, n);
-		} else if (n <= 0xffffffffL) {
-			igbinary_serialize8(igsd, igbinary_type_array32);
-			igbinary_serialize32(igsd, n);
+		igbinary_serialize_type_and_len(igsd, igbinary_type_array8, n);
+		const IgbinarySleepPlan* plan = igbinary_sleep_plan(obj_cls, props);
+		if (LIKELY(plan != nullptr)) {
+			// Same as the loop below, with the lookups and mangled names computed once per class.
+			for (const auto& entry : plan->entries) {
+				if (entry.slot != kInvalidSlot) {
+					auto const prop = &obj->propVec()[entry.slot];
+					if (prop->m_type != KindOfUninit) {
+						igbinary_serialize_string(igsd, entry.serialized_name.get());
+						igbinary_serialize_variant(igsd, tvAsCVarRef(prop));
+						continue;
+					}
+				}
+				igbinary_serialize_object_sleep_other_prop(igsd, obj, entry.name);
+			}
+			return;
 		}
         for (ArrayIter iter(props); iter; ++iter) {
 			Class* ctx = obj_cls;
@@ -534,26 +1128,26 @@ inline static void igbinary_serialize_object(struct igbinary_serialize_data *igs
 					}
 				}
 			}
-			if (UNLIKELY(obj->getAttribute(ObjectData::HasDynPropArr))) {
-				// TODO: look in depth at e513c6d6d4a847fd7d09e27f23e4554b6955c0f0
-				HPHP::member_rval prop = obj->dynPropArray()->rval(memberName.get());
-				if (prop) {
-					igbinary_serialize_string(igsd, memberName.get());  // TODO: Integer keys? Can probably ignore.
-					igbinary_serialize_variant(igsd, tvAsCVarRef(prop.tv_ptr()));
-					continue;
-				}
-			}
-			raise_notice("igbinary_serialize(): \"%s\" returned as member variable from "
-						 "__sleep() but does not exist", propName.data());
-			// Note: Serialize null as both
-			igbinary_serialize_string(igsd, memberName.get());  // TODO: Integer keys?
-			igbinary_serialize_null(igsd);
+			igbinary_serialize_object_sleep_other_prop(igsd, obj, propName);
 		}
 		return;
 	}
+	const IgbinaryClassLayout* layout = igbinary_class_layout(cls);
+	if (LIKELY(layout->serialize_from_slots)) {
+		if (UNLIKELY(igsd->use_schemas) && igbinary_serialize_object_schema(igsd, obj, layout)) {
+			return;
+		}
+		igbinary_serialize_object_props(igsd, obj, layout, references_start);
+		return;
+	}
 	Array properties = obj->toArray();  // FIXME do names differ by visibility?
+	struct igbinary_serialize_index object_index;
+	struct igbinary_serialize_index* const index = igbinary_serialize_index_begin(igsd, &object_index, properties.size(), references_start);
 	igbinary_serialize_object_name(igsd, obj->getClassName().get());
-	igbinary_serialize_array(igsd, properties, true);
+	igbinary_serialize_array(igsd, properties, true, index);
+	if (UNLIKELY(index != nullptr)) {
+		igbinary_serialize_index_end(igsd, index);
+	}
 }
 /* }}} */
 /* {{{ igbinary_serialize_array_ref_by_key */
@@ -569,23 +1163,13 @@ inline static int igbinary_serialize_array_ref_by_key(struct igbinary_serialize_
 		/* Does this work with different forms of recursive arrays? */
 		if (t > 0 || object) {
 			hash_si_ptr_insert(&igsd->references, key, t);  /* TODO: Add a specialization for fixed-length numeric keys? */
+			if (UNLIKELY(igsd->fragment != nullptr)) {
+				igsd->fragment->arrays.emplace_back(reinterpret_cast<const ArrayData*>(key), (uint32_t) t);
+			}
 		}
 		return 1;
 	} else {
-		enum igbinary_type type;
-		if (*i <= 0xff) {
-			type = object ? igbinary_type_objref8 : igbinary_type_ref8;
-			igbinary_serialize8(igsd, (uint8_t) type);
-			igbinary_serialize8(igsd, (uint8_t) *i);
-		} else if (*i <= 0xffff) {
-			type = object ? igbinary_type_objref16 : igbinary_type_ref16;
-			igbinary_serialize8(igsd, (uint8_t) type);
-			igbinary_serialize16(igsd, (uint16_t) *i);
-		} else {
-			type = object ? igbinary_type_objref32 : igbinary_type_ref32;
-			igbinary_serialize8(igsd, (uint8_t) type);
-			igbinary_serialize32(igsd, (uint32_t) *i);
-		}
+		igbinary_serialize_id(igsd, object ? igbinary_type_objref8 : igbinary_type_ref8, *i);
 
 		return 0;
 	}
@@ -606,6 +1190,18 @@ inline static int igbinary_serialize_array_ref(struct igbinary_serialize_data *i
 		case KindOfPersistentArray:
 #endif
 		case KindOfArray:
+		case KindOfPersistentVec:
+		case KindOfVec:
+		case KindOfPersistentDict:
+		case KindOfDict:
+		case KindOfPersistentKeyset:
+		case KindOfKeyset:
+			if (tv->m_data.parr->hasExactlyOneRef()) {
+				// Only this value holds the array (a reference to it would hold a RefData instead), so it can't be seen again.
+				// It still takes a reference id, to keep the numbering the same as the unserializer's, but isn't tracked.
+				igsd->references_id++;
+				return 1;
+			}
 			key = reinterpret_cast<uintptr_t>(tv->m_data.parr);
 			break;
 		case KindOfObject:
@@ -640,6 +1236,10 @@ inline static void igbinary_serialize_variant(struct igbinary_serialize_data *ig
 	/* TODO: Figure out how to handle references and garbage collection */
 	auto tv = self.asTypedValue();
 
+	if (UNLIKELY(igsd->buffer.size() >= igsd->flush_threshold) && igsd->index_depth == 0) {
+		igbinary_serialize_flush(igsd);
+	}
+
 	switch (tv->m_type) {
 		case KindOfUninit:
 		case KindOfNull:
@@ -666,14 +1266,20 @@ inline static void igbinary_serialize_variant(struct igbinary_serialize_data *ig
 			return;
 		case KindOfPersistentArray:
 		case KindOfArray:
-			igbinary_serialize_array(igsd, self, false);
+		case KindOfPersistentVec:
+		case KindOfVec:
+		case KindOfPersistentDict:
+		case KindOfDict:
+		case KindOfPersistentKeyset:
+		case KindOfKeyset:
+			igbinary_serialize_array(igsd, self, false, nullptr);
 			return;
 		case KindOfRef:
 			{
 				Variant& self_deref = *tv->m_data.pref->var();
 				igbinary_serialize8(igsd, (uint8_t) igbinary_type_ref);
 				if (self_deref.isArray()) {
-					igbinary_serialize_array(igsd, self, false);
+					igbinary_serialize_array(igsd, self, false, nullptr);
 					return;
 				} else if (self_deref.isObject()) {
 					// Nothing else to do, already recorded that it was an object and a reference.
@@ -693,16 +1299,72 @@ inline static void igbinary_serialize_variant(struct igbinary_serialize_data *ig
 } // namespace
 
 namespace HPHP {
-Variant igbinary_serialize(const Variant& variant) {
-	struct igbinary_serialize_data igsd;
-	igbinary_serialize_data_init(&igsd, !variant.isObject() && !variant.isArray());
-	igbinary_serialize_header(&igsd);
+Variant igbinary_serialize(const Variant& variant, uint32_t dictionary_id) {
+	IgbinaryContextPool<igbinary_serialize_data>::Lease lease(*s_serialize_contexts);  // Released by destructor
+	struct igbinary_serialize_data* igsd = lease.get();
+	const bool scalar = !variant.isObject() && !variant.isArray();
+	igbinary_serialize_data_init(igsd, scalar);
+	const size_t scalar_size = scalar ? igbinary_serialized_scalar_size(variant) : 0;
+	// Scalars get exactly the space they need. Arrays and objects start out with room for what this thread's recent ones needed.
+	igbinary_serialize_data_reserve(igsd, scalar_size ? (dictionary_id ? 8 : 4) + scalar_size : igbinary_serialize_size_hint());
+	try {
+		igbinary_serialize_dictionary(igsd, dictionary_id);
+		igbinary_serialize_header(igsd);
+		igbinary_serialize_variant(igsd, variant);  // Succeed or throw
+	} catch (IgbinaryWarning& e) {
+		raise_warning(e.getMessage());
+		return false;
+	}
+	if (!scalar) {
+		igbinary_record_serialized_size(igsd->buffer.size());
+	}
+	const size_t compression_threshold = igbinary_compression_threshold();
+	if (compression_threshold > 0 && igsd->buffer.size() - 4 >= compression_threshold) {
+		String compressed = igbinary_serialize_data_compress(igsd);
+		if (!compressed.isNull()) {
+			return compressed;
+		}
+	}
+	return igbinary_serialize_data_detach(igsd);
+}
+
+Variant igbinary_serialized_size(const Variant& variant) {
+	const bool scalar = !variant.isObject() && !variant.isArray();
+	const size_t scalar_size = scalar ? igbinary_serialized_scalar_size(variant) : 0;
+	if (scalar_size) {
+		return (int64_t) (4 + scalar_size);
+	}
+	IgbinaryContextPool<igbinary_serialize_data>::Lease lease(*s_serialize_contexts);  // Released by destructor
+	struct igbinary_serialize_data* igsd = lease.get();
+	igbinary_serialize_data_init(igsd, scalar);
+	// Only the byte count is needed, so the output is thrown away whenever it grows past this size.
+	igsd->flush_threshold = IGBINARY_SERIALIZED_SIZE_CHUNK;
+	igbinary_serialize_header(igsd);
+	try {
+		igbinary_serialize_variant(igsd, variant);  // Succeed or throw
+	} catch (IgbinaryWarning& e) {
+		raise_warning(e.getMessage());
+		return false;
+	}
+	return (int64_t) (igsd->flushed_bytes + igsd->buffer.size());
+}
+
+Variant igbinary_serialize_to_stream(const Variant& variant, File* stream, size_t chunk_size) {
+	IgbinaryContextPool<igbinary_serialize_data>::Lease lease(*s_serialize_contexts);  // Released by destructor
+	struct igbinary_serialize_data* igsd = lease.get();
+	igbinary_serialize_data_init(igsd, !variant.isObject() && !variant.isArray());
+	igsd->stream = stream;
+	// The buffer is flushed between values, so it can exceed chunk_size by the size of one string.
+	igsd->flush_threshold = (uint32_t) std::min<size_t>(chunk_size, StringData::MaxSize / 2);
+	igbinary_serialize_data_reserve(igsd, igsd->flush_threshold);
+	igbinary_serialize_header(igsd);
 	try {
-		igbinary_serialize_variant(&igsd, variant);  // Succeed or throw
+		igbinary_serialize_variant(igsd, variant);  // Succeed or throw
+		igbinary_serialize_flush(igsd);
 	} catch (IgbinaryWarning& e) {
 		raise_warning(e.getMessage());
 		return false;
 	}
-	return igsd.buffer.detach();
+	return (int64_t) igsd->flushed_bytes;
 }
 } // HPHP
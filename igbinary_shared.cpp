@@ -0,0 +1,202 @@
+/*
+  +----------------------------------------------------------------------+
+  | See COPYING file for further copyright information                   |
+  +----------------------------------------------------------------------+
+  | Author of hhvm fork: Tyson Andre <tysonandre775@hotmail.com>         |
+  | See CREDITS for contributors                                         |
+  | This is a process-wide cache of unserialized arrays, which are       |
+  | shared by all requests as uncounted arrays, like APC's.              |
+  +----------------------------------------------------------------------+
+*/
+
+#include "ext_igbinary.hpp"
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "folly/SharedMutex.h"
+
+#include "hphp/runtime/base/apc-stats.h"
+#include "hphp/runtime/base/apc-typed-value.h"
+#include "hphp/runtime/base/mixed-array.h"
+#include "hphp/runtime/base/packed-array.h"
+#include "hphp/runtime/base/runtime-error.h"
+#include "hphp/runtime/base/set-array.h"
+#include "hphp/runtime/vm/treadmill.h"
+#include "hphp/util/hash.h"
+
+namespace HPHP {
+
+namespace {
+
+/** A cached array, and the serialized data it was unserialized from. Immutable once cached, apart from used. */
+struct IgbinarySharedEntry {
+	strhash_t hash;		/**< hash_string_cs of serialized. */
+	std::string serialized;
+	ArrayData* arr;		/**< An uncounted array, or a static array. */
+	size_t memory;		/**< The bytes this entry counts against igbinary.shared_cache_size: the array with its strings, serialized and the entry. */
+	/** Set by hits and cleared by eviction, which gives used entries another round instead of evicting them (a CLOCK approximation of LRU). */
+	std::atomic<bool> used{false};
+};
+
+typedef std::shared_ptr<IgbinarySharedEntry> IgbinarySharedEntryPtr;
+
+/**
+ * The cache is split into shards by hash, each with its own lock and its share of igbinary.shared_cache_size.
+ * Hits only take a read lock, and compare the data outside of it: the shared_ptr keeps the entry alive if it is evicted meanwhile.
+ */
+struct IgbinarySharedShard {
+	folly::SharedMutex lock;
+	/** The cached entries, newest (or most recently given another round) first. */
+	std::list<IgbinarySharedEntryPtr> entries;
+	/** The entries, by the hash of their serialized data. */
+	std::unordered_multimap<strhash_t, IgbinarySharedEntryPtr> index;
+	/** The sum of the memory of entries. */
+	size_t bytes = 0;
+};
+
+constexpr size_t kSharedShards = 16;
+IgbinarySharedShard s_shared_shards[kSharedShards];
+
+/* {{{ igbinary_shared_release */
+/**
+ * Frees an uncounted array once no request can be using it: requests which got it from the cache may still be running,
+ * and the treadmill waits for all of the requests which started before this call to end.
+ */
+static void igbinary_shared_release(ArrayData* arr) {
+	if (arr->isStatic()) {
+		return;  // Empty arrays are the static empty array.
+	}
+	Treadmill::enqueue([arr] {
+		if (arr->hasPackedLayout()) {
+			PackedArray::ReleaseUncounted(arr);
+		} else if (arr->isKeyset()) {
+			SetArray::ReleaseUncounted(arr);
+		} else {
+			MixedArray::ReleaseUncounted(arr);
+		}
+	});
+}
+/* }}} */
+/* {{{ igbinary_shared_same */
+static bool igbinary_shared_same(const IgbinarySharedEntry& entry, const String& serialized) {
+	return entry.serialized.size() == (size_t) serialized.size() && memcmp(entry.serialized.data(), serialized.data(), serialized.size()) == 0;
+}
+/* }}} */
+/* {{{ igbinary_shared_find */
+/** Returns the cached array for serialized and marks it as used, or nullptr. Takes shard's read lock, but not while comparing the data. */
+static ArrayData* igbinary_shared_find(IgbinarySharedShard& shard, strhash_t hash, const String& serialized) {
+	// Different data with the same hash and length is rare, so each candidate is looked up again rather than copying all of them.
+	for (size_t skip = 0; ; skip++) {
+		IgbinarySharedEntryPtr candidate;
+		{
+			folly::SharedMutex::ReadHolder read_lock(shard.lock);
+			auto range = shard.index.equal_range(hash);
+			size_t seen = 0;
+			for (auto it = range.first; it != range.second; ++it) {
+				if (it->second->serialized.size() == (size_t) serialized.size() && seen++ == skip) {
+					candidate = it->second;
+					break;
+				}
+			}
+		}
+		if (!candidate) {
+			return nullptr;
+		}
+		if (igbinary_shared_same(*candidate, serialized)) {
+			if (!candidate->used.load(std::memory_order_relaxed)) {
+				candidate->used.store(true, std::memory_order_relaxed);
+			}
+			return candidate->arr;
+		}
+	}
+}
+/* }}} */
+/* {{{ igbinary_shared_evict */
+/** Removes entries, oldest first, until shard holds at most budget bytes. Used entries are moved to the front once instead. shard's write lock must be held. */
+static void igbinary_shared_evict(IgbinarySharedShard& shard, size_t budget) {
+	size_t rounds = shard.entries.size();
+	while (shard.bytes > budget && !shard.entries.empty()) {
+		IgbinarySharedEntryPtr entry = std::move(shard.entries.back());
+		shard.entries.pop_back();
+		if (rounds > 0 && entry->used.exchange(false, std::memory_order_relaxed)) {
+			rounds--;
+			shard.entries.push_front(std::move(entry));
+			continue;
+		}
+		auto range = shard.index.equal_range(entry->hash);
+		for (auto it = range.first; it != range.second; ++it) {
+			if (it->second == entry) {
+				shard.index.erase(it);
+				break;
+			}
+		}
+		shard.bytes -= entry->memory;
+		// Requests which found the entry before this may still be comparing its data; they hold their own reference to it.
+		igbinary_shared_release(entry->arr);
+	}
+}
+/* }}} */
+/* {{{ igbinary_shared_variant */
+/** Returns a Variant for a cached array, which doesn't count references to it. */
+static Variant igbinary_shared_variant(const ArrayData* arr) {
+	const DataType type = arr->isVecArray() ? KindOfPersistentVec : arr->isDict() ? KindOfPersistentDict :
+		arr->isKeyset() ? KindOfPersistentKeyset : KindOfPersistentArray;
+	return Variant(arr, type, Variant::PersistentArrInit{});
+}
+/* }}} */
+
+} // namespace
+
+/* {{{ igbinary_unserialize_shared */
+Variant igbinary_unserialize_shared(const String& serialized) {
+	const size_t budget = igbinary_shared_cache_size() / kSharedShards;
+	const strhash_t hash = hash_string_cs(serialized.data(), serialized.size());
+	IgbinarySharedShard& shard = s_shared_shards[(uint32_t) hash % kSharedShards];
+	if (budget > 0) {
+		if (const ArrayData* arr = igbinary_shared_find(shard, hash, serialized)) {
+			return igbinary_shared_variant(arr);
+		}
+	}
+
+	Variant result;
+	if (!igbinary_unserialize_values(reinterpret_cast<const uint8_t*>(serialized.data()), serialized.size(), result)) {
+		return false;
+	}
+	if (!result.isArray() || (size_t) serialized.size() > budget) {
+		return result;  // Scalars are cheap to unserialize, and data larger than the cache would only evict everything else.
+	}
+	// Strings and nested arrays are copied along with the array.
+	ArrayData* arr = result.getArrayData()->isStatic() ? result.getArrayData() : MakeUncountedArray(result.getArrayData());
+	auto entry = std::make_shared<IgbinarySharedEntry>();
+	entry->hash = hash;
+	entry->serialized.assign(serialized.data(), serialized.size());
+	entry->arr = arr;
+	entry->memory = sizeof(IgbinarySharedEntry) + entry->serialized.capacity() + (arr->isStatic() ? 0 : getMemSize(arr));
+	if (entry->memory > budget) {
+		igbinary_shared_release(arr);  // Nothing else can see arr yet.
+		return result;
+	}
+
+	folly::SharedMutex::WriteHolder write_lock(shard.lock);
+	auto range = shard.index.equal_range(hash);
+	for (auto it = range.first; it != range.second; ++it) {
+		// Misses are rare and already paid for unserializing the data, so this comparison is done under the lock.
+		if (igbinary_shared_same(*it->second, serialized)) {
+			// Another request cached the same data while this one was unserializing it. Nothing else can see arr yet.
+			igbinary_shared_release(arr);
+			return igbinary_shared_variant(it->second->arr);
+		}
+	}
+	shard.bytes += entry->memory;
+	shard.index.emplace(hash, entry);
+	shard.entries.push_front(std::move(entry));
+	igbinary_shared_evict(shard, budget);
+	return igbinary_shared_variant(arr);
+}
+/* }}} */
+
+} // namespace HPHP
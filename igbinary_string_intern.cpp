@@ -0,0 +1,72 @@
+/*
+  +----------------------------------------------------------------------+
+  | See COPYING file for further copyright information                   |
+  +----------------------------------------------------------------------+
+  | Author of hhvm fork: Tyson Andre <tysonandre775@hotmail.com>         |
+  | See CREDITS for contributors                                         |
+  | This is a bounded, process-wide table of static strings that are     |
+  | commonly used as array keys, property names and class names.         |
+  +----------------------------------------------------------------------+
+*/
+
+#include "ext_igbinary.hpp"
+
+#include <atomic>
+#include <string.h>
+
+#include "hphp/runtime/base/static-string-table.h"
+#include "hphp/util/hash.h"
+
+namespace HPHP {
+
+namespace {
+
+/** Number of slots. Must be a power of 2. At most this many strings are ever interned by igbinary. */
+constexpr size_t kInternTableSize = 8192;
+/** Number of slots checked for a given hash before giving up. */
+constexpr size_t kInternMaxProbes = 8;
+
+/**
+ * Slots are filled at most once (null -> static string) and never cleared, so readers need no locks.
+ * The strings are static strings which already existed, e.g. declared property names, class names and string literals.
+ * Strings from the serialized data are never made static, so untrusted payloads can't grow the process's static string table.
+ */
+std::atomic<const StringData*> s_intern_table[kInternTableSize];
+
+inline bool igbinary_intern_matches(const StringData* sd, const char* data, size_t len) {
+	return (size_t) sd->size() == len && memcmp(sd->data(), data, len) == 0;
+}
+
+} // namespace
+
+/* {{{ igbinary_intern_string */
+String igbinary_intern_string(const char* data, size_t len) {
+	if (len > IGBINARY_INTERN_MAX_LENGTH) {
+		return String(data, len, CopyString);
+	}
+	size_t slot = hash_string_cs(data, len) & (kInternTableSize - 1);
+	size_t probe = 0;
+	for (; probe < kInternMaxProbes; probe++, slot = (slot + 1) & (kInternTableSize - 1)) {
+		const StringData* existing = s_intern_table[slot].load(std::memory_order_acquire);
+		if (existing == nullptr) {
+			break;  // Slots are never cleared, so the string isn't in a later one.
+		}
+		if (igbinary_intern_matches(existing, data, len)) {
+			return String(const_cast<StringData*>(existing));
+		}
+	}
+	String copy(data, len, CopyString);
+	StringData* known = lookupStaticString(copy.get());
+	if (known == nullptr) {
+		return copy;
+	}
+	if (probe < kInternMaxProbes) {
+		const StringData* expected = nullptr;
+		// If another thread filled this slot first, the string is looked up in the static string table again next time.
+		s_intern_table[slot].compare_exchange_strong(expected, known, std::memory_order_acq_rel);
+	}
+	return String(known);
+}
+/* }}} */
+
+} // namespace HPHP
@@ -12,7 +12,14 @@
  * Function for unserializing. This contains implementation details of  igbinary_unserialize()
  */
 
+#include <algorithm>
+
 #include "ext_igbinary.hpp"
+#include "igbinary_compress.hpp"
+#include "igbinary_cursor.hpp"
+#include "igbinary_dictionary.hpp"
+#include "igbinary_indexed.hpp"
+#include "igbinary_schema.hpp"
 
 // For HHVM_VERSION_*
 #include "hphp/runtime/version.h"
@@ -22,6 +29,7 @@
 #endif
 
 #include "hphp/runtime/base/array-init.h"
+#include "hphp/runtime/base/array-iterator.h"
 // for ::HPHP::collections::isType
 #include "hphp/runtime/base/collections.h"
 #include "hphp/runtime/base/execution-context.h"
@@ -29,6 +37,11 @@
 
 #include "hphp/runtime/base/req-containers.h"
 #include "hphp/runtime/base/type-variant.h"
+#include "hphp/runtime/vm/native-data.h"
+#include "hphp/runtime/vm/unit.h"
+
+#include "igbinary_class_layout.hpp"
+#include "igbinary_context_pool.hpp"
 
 
 using namespace HPHP;
@@ -42,37 +55,105 @@ namespace {
 const StaticString
   s_unserialize("unserialize"),
   s_PHP_Incomplete_Class("__PHP_Incomplete_Class"),
-  s_PHP_Incomplete_Class_Name("__PHP_Incomplete_Class_Name"),
-  s___wakeup("__wakeup");
+  s_PHP_Incomplete_Class_Name("__PHP_Incomplete_Class_Name");
 
 /* {{{ data types */
 
+/** An indexed container which was skipped without looking inside, see igbinary_unserialize_skipped_string. */
+struct igbinary_unserialize_skipped_range {
+	size_t strings_start;		/**< Id of the first string defined in the container. */
+	size_t strings;				/**< Number of strings defined in the container. */
+	size_t offset;				/**< Offset of the wrapped array or object. */
+	size_t references_start;	/**< Id of the first reference defined in the container. */
+};
+
+/** A schema defined by the data. See igbinary_schema.hpp. */
+struct igbinary_unserialize_schema {
+	size_t offset;				/**< Offset of the definition, after the schema id. */
+	size_t names_offset;		/**< Offset of the first property name of the definition. */
+	size_t end;					/**< Offset after the definition. */
+	String class_name;
+	int64_t version;
+	size_t n;					/**< Number of properties. */
+	req::vector<String> names;	/**< The serialized property names. Read when first needed. */
+	bool resolved;				/**< Whether the fields below are set. They are set when the first object using the schema is unserialized. */
+	const IgbinaryClassLayout* layout;	/**< nullptr if there is no such class. */
+	bool positional;			/**< Whether the values are stored into slots, instead of looking up each name for every object. */
+	req::vector<Slot> slots;	/**< The slot of each property, if positional. */
+};
+
 /** Unserializer data.
- * Uses RAII to ensure it is de-initialized.
+ * Reused between calls, see s_unserialize_contexts. igbinary_unserialize_data_init prepares it for a call.
  * Based on data structure by Oleg Grenrus <oleg.grenrus@dynamoid.com>
  */
 struct igbinary_unserialize_data {
 	const uint8_t *buffer;			/**< Buffer. */
-	const size_t buffer_size;		/**< Buffer size. */
+	size_t buffer_size;				/**< Buffer size. */
 	size_t buffer_offset;			/**< Current read offset. */
 
 	// Containers using thread-local memory.
 	req::vector<String> strings;	/**< Unserialized strings. */
 	req::vector<Variant*> references;  /**< non-refcounted pointers to objects, arrays, and references being deserialized */
 	req::vector<Object> wakeup;    /* objects for which to call __wakeup after unserialization is finished */
+	/** (string id, offset of its type) of the strings which were skipped, in order of id. Their entries in strings are null until used. */
+	req::vector<std::pair<size_t, size_t>> skipped_strings;
+	/** Indexed containers which were skipped. Their strings are added to skipped_strings when one of them is used. */
+	req::vector<igbinary_unserialize_skipped_range> skipped_ranges;
+	/** The decompressed data, if the data was compressed. buffer then points into it. Reused between calls. */
+	req::vector<uint8_t> scratch;
+	/** Elements of collections which igsd->references points at. Collections copy their elements, so these are kept until the end. */
+	req::deque<Variant> collection_elements;
+	/** The schemas defined so far, by schema id. A deque, so that the schema of an object stays in place while its values are unserialized. */
+	req::deque<igbinary_unserialize_schema> schemas;
+	/** Whether objects and references are rejected, for igbinary_unserialize_values. */
+	bool values_only;
 
 	Array m_overwrittenList;  /* Reference counted values that were overwritten. See base/variable-unserializer.cpp */
   public:
-	igbinary_unserialize_data(const uint8_t* buf, size_t buf_size);
-	~igbinary_unserialize_data();
+	igbinary_unserialize_data();
+	void release(size_t high_water_mark);
 };
-igbinary_unserialize_data::igbinary_unserialize_data(const uint8_t* buf, size_t buf_size) : buffer(buf), buffer_size(buf_size), buffer_offset(0), strings(0), references(0) {
+igbinary_unserialize_data::igbinary_unserialize_data() : buffer(nullptr), buffer_size(0), buffer_offset(0), values_only(false) {
 }
 
-igbinary_unserialize_data::~igbinary_unserialize_data() {
-	// Nothing to do for strings or references
-	// req::vector<Object> wakeup automatically handles reference counts?
+/* {{{ igbinary_unserialize_data_init */
+inline static void igbinary_unserialize_data_init(igbinary_unserialize_data *igsd, const uint8_t* buf, size_t buf_size) {
+	igsd->buffer = buf;
+	igsd->buffer_size = buf_size;
+	igsd->buffer_offset = 0;
+	igsd->values_only = false;
+}
+/* }}} */
+/* {{{ igbinary_unserialize_release_vector */
+/** Empties vec, and frees its memory if it grew to hold more than high_water_mark bytes. */
+template<typename T>
+inline static void igbinary_unserialize_release_vector(req::vector<T>& vec, size_t high_water_mark) {
+	if (vec.capacity() * sizeof(T) > high_water_mark) {
+		req::vector<T>().swap(vec);
+	} else {
+		vec.clear();
+	}
+}
+/* }}} */
+/* {{{ igbinary_unserialize_data::release */
+/** Empties the context for the next call, dropping the references it holds. */
+void igbinary_unserialize_data::release(size_t high_water_mark) {
+	igbinary_unserialize_release_vector(strings, high_water_mark);
+	igbinary_unserialize_release_vector(references, high_water_mark);
+	igbinary_unserialize_release_vector(wakeup, high_water_mark);
+	igbinary_unserialize_release_vector(skipped_strings, high_water_mark);
+	igbinary_unserialize_release_vector(skipped_ranges, high_water_mark);
+	igbinary_unserialize_release_vector(scratch, high_water_mark);
+	collection_elements.clear();
+	schemas.clear();
+	m_overwrittenList = Array();
+	buffer = nullptr;
+	buffer_size = 0;
 }
+/* }}} */
+
+/** One context per nesting level of igbinary_unserialize calls. */
+IMPLEMENT_STATIC_REQUEST_LOCAL(IgbinaryContextPool<igbinary_unserialize_data>, s_unserialize_contexts);
 
 /* }}} */
 
@@ -105,6 +186,13 @@ static void igbinary_unserialize_variant(struct igbinary_unserialize_data *igsd,
 */
 /* }}} */
 
+/* {{{ IgbinarySkippedReference */
+/** Thrown for a ref or objref to a value which was skipped instead of being unserialized. */
+class IgbinarySkippedReference : public IgbinaryWarning {
+  public:
+	explicit IgbinarySkippedReference(size_t n) : IgbinaryWarning("igbinary_unserialize_ref: reference %u is to a value which was skipped", (unsigned int) n) {}
+};
+/* }}} */
 /* {{{ igsd_defer_wakeup */
 /* Defer wakeup */
 static inline void igsd_defer_wakeup(struct igbinary_unserialize_data *igsd, const Object& o) {
@@ -112,47 +200,64 @@ static inline void igsd_defer_wakeup(struct igbinary_unserialize_data *igsd, con
 }
 /* }}} */
 
+/* {{{ igbinary_unserialize_throw_end_of_data */
+[[noreturn]] NEVER_INLINE static void igbinary_unserialize_throw_end_of_data(const char* where) {
+	throw IgbinaryWarning("%s: end-of-data", where);
+}
+/* }}} */
+/* {{{ igbinary_unserialize_advance */
+/**
+ * Returns a pointer to the next len bytes of the buffer, and moves past them.
+ * Throws "<where>: end-of-data" if fewer than len bytes are left.
+ */
+inline static const uint8_t* igbinary_unserialize_advance(igbinary_unserialize_data *igsd, size_t len, const char* where) {
+	const size_t offset = igsd->buffer_offset;
+	if (UNLIKELY(len > igsd->buffer_size - offset)) {
+		igbinary_unserialize_throw_end_of_data(where);
+	}
+	igsd->buffer_offset = offset + len;
+	return igsd->buffer + offset;
+}
+/* }}} */
 /* {{{ igbinary_unserialize8 */
 /** Unserialize 8bit value. */
-inline static uint8_t igbinary_unserialize8(igbinary_unserialize_data *igsd) {
-	uint8_t ret = 0;
-	ret = igsd->buffer[igsd->buffer_offset++];
-	return ret;
+inline static uint8_t igbinary_unserialize8(igbinary_unserialize_data *igsd, const char* where) {
+	return *igbinary_unserialize_advance(igsd, 1, where);
 }
 /* }}} */
 /* {{{ igbinary_unserialize16 */
 /** Unserialize 16bit value. */
-inline static uint16_t igbinary_unserialize16(igbinary_unserialize_data *igsd) {
-	uint16_t ret = 0;
-	ret |= ((uint16_t) igsd->buffer[igsd->buffer_offset++] << 8);
-	ret |= ((uint16_t) igsd->buffer[igsd->buffer_offset++] << 0);
-	return ret;
+inline static uint16_t igbinary_unserialize16(igbinary_unserialize_data *igsd, const char* where) {
+	return igbinary_load16(igbinary_unserialize_advance(igsd, 2, where));
 }
 /* }}} */
 /* {{{ igbinary_unserialize32 */
 /** Unserialize 32bit value. */
-inline static uint32_t igbinary_unserialize32(igbinary_unserialize_data *igsd) {
-	uint32_t ret = 0;
-	ret |= ((uint32_t) igsd->buffer[igsd->buffer_offset++] << 24);
-	ret |= ((uint32_t) igsd->buffer[igsd->buffer_offset++] << 16);
-	ret |= ((uint32_t) igsd->buffer[igsd->buffer_offset++] << 8);
-	ret |= ((uint32_t) igsd->buffer[igsd->buffer_offset++] << 0);
-	return ret;
+inline static uint32_t igbinary_unserialize32(igbinary_unserialize_data *igsd, const char* where) {
+	return igbinary_load32(igbinary_unserialize_advance(igsd, 4, where));
 }
 /* }}} */
 /* {{{ igbinary_unserialize64 */
 /** Unserialize 64bit value. */
-inline static uint64_t igbinary_unserialize64(igbinary_unserialize_data *igsd) {
-	uint64_t ret = 0;
-	ret |= ((uint64_t) igsd->buffer[igsd->buffer_offset++] << 56);
-	ret |= ((uint64_t) igsd->buffer[igsd->buffer_offset++] << 48);
-	ret |= ((uint64_t) igsd->buffer[igsd->buffer_offset++] << 40);
-	ret |= ((uint64_t) igsd->buffer[igsd->buffer_offset++] << 32);
-	ret |= ((uint64_t) igsd->buffer[igsd->buffer_offset++] << 24);
-	ret |= ((uint64_t) igsd->buffer[igsd->buffer_offset++] << 16);
-	ret |= ((uint64_t) igsd->buffer[igsd->buffer_offset++] << 8);
-	ret |= ((uint64_t) igsd->buffer[igsd->buffer_offset++] << 0);
-	return ret;
+inline static uint64_t igbinary_unserialize64(igbinary_unserialize_data *igsd, const char* where) {
+	return igbinary_load64(igbinary_unserialize_advance(igsd, 8, where));
+}
+/* }}} */
+/* {{{ igbinary_unserialize_len */
+/**
+ * Unserializes the 8, 16 or 32 bit length, id or count that follows the type t.
+ * type8 is the 8 bit variant of t, and t must be one of type8, type8 + 1 or type8 + 2.
+ */
+inline static uint32_t igbinary_unserialize_len(igbinary_unserialize_data *igsd, enum igbinary_type t, enum igbinary_type type8, const char* where) {
+	switch (t - type8) {
+		case 0:
+			return igbinary_unserialize8(igsd, where);
+		case 1:
+			return igbinary_unserialize16(igsd, where);
+		default:
+			assert(t - type8 == 2);
+			return igbinary_unserialize32(igsd, where);
+	}
 }
 /* }}} */
 
@@ -184,6 +289,38 @@ inline static void igbinary_unserialize_header_throw_for_version(struct igbinary
 }
 /* }}} */
 
+/* {{{ igbinary_unserialize_dictionary */
+/** Reads the id of the dictionary the data was serialized with, and gives its strings the first string ids. */
+static void igbinary_unserialize_dictionary(struct igbinary_unserialize_data *igsd) {
+	const uint32_t id = igbinary_unserialize32(igsd, "igbinary_unserialize_header");
+	const IgbinaryDictionary* dictionary = igbinary_dictionary_find(id);
+	if (dictionary == nullptr) {
+		throw IgbinaryWarning("igbinary_unserialize_header: dictionary %u is not registered", id);
+	}
+	igsd->strings.reserve(dictionary->strings.size());
+	for (const StringData* s : dictionary->strings) {
+		// Static strings are not reference counted, so they are shared instead of copied.
+		igsd->strings.emplace_back(const_cast<StringData*>(s));
+	}
+}
+/* }}} */
+/* {{{ igbinary_unserialize_decompress */
+/** Decompresses the rest of the data into igsd->scratch, and continues unserializing from the start of it. */
+static void igbinary_unserialize_decompress(struct igbinary_unserialize_data *igsd) {
+	const size_t len = igbinary_unserialize32(igsd, "igbinary_unserialize_header");
+	const size_t block_len = igsd->buffer_size - igsd->buffer_offset;
+	if (len / IGBINARY_LZ4_MAX_RATIO > block_len || len > StringData::MaxSize) {
+		throw IgbinaryWarning("igbinary_unserialize_header: compressed data of %llu bytes can't have %llu bytes", (unsigned long long) block_len, (unsigned long long) len);
+	}
+	igsd->scratch.resize(len);
+	if (!igbinary_lz4_decompress(igsd->buffer + igsd->buffer_offset, block_len, igsd->scratch.data(), len)) {
+		throw IgbinaryWarning("igbinary_unserialize_header: compressed data is corrupt");
+	}
+	igsd->buffer = igsd->scratch.data();
+	igsd->buffer_size = len;
+	igsd->buffer_offset = 0;
+}
+/* }}} */
 /* {{{ igbinary_unserialize_header */
 /** Unserialize header. Check for version. */
 inline static void igbinary_unserialize_header(struct igbinary_unserialize_data *igsd) {
@@ -193,136 +330,138 @@ inline static void igbinary_unserialize_header(struct igbinary_unserialize_data
 		throw IgbinaryWarning("igbinary_unserialize_header: expected at least 5 bytes of data, got %u byte(s)", (int)(igsd->buffer_size - igsd->buffer_offset));
 	}
 
-	version = igbinary_unserialize32(igsd);
+	version = igbinary_unserialize32(igsd, "igbinary_unserialize_header");
 
 	/* Support older version 1 and the current format 2 */
 	if (version == IGBINARY_FORMAT_VERSION || version == 0x00000001) {
 		return;
-	} else {
+	}
+	/* Format 2 with flags */
+	const uint32_t flags = version & IGBINARY_FLAGS_MASK;
+	if ((version & ~IGBINARY_FLAGS_MASK) != IGBINARY_FORMAT_VERSION || (flags & ~(IGBINARY_FLAG_DICTIONARY | IGBINARY_FLAG_COMPRESSED)) != 0) {
 		igbinary_unserialize_header_throw_for_version(igsd, version);
 	}
+	if (flags & IGBINARY_FLAG_COMPRESSED) {
+		igbinary_unserialize_decompress(igsd);
+	}
+	if (flags & IGBINARY_FLAG_DICTIONARY) {
+		igbinary_unserialize_dictionary(igsd);
+	}
 }
 /* }}} */
 /* {{{ igbinary_unserialize_long */
 /** Unserializes zend_long */
-inline static int igbinary_unserialize_long(struct igbinary_unserialize_data *igsd, enum igbinary_type t) {
-	if (t == igbinary_type_long8p || t == igbinary_type_long8n) {
-		if (igsd->buffer_offset + 1 > igsd->buffer_size) {
-			throw IgbinaryWarning("igbinary_unserialize_long: end-of-data");
-		}
-
-		return (t == igbinary_type_long8n ? -1 : 1) * igbinary_unserialize8(igsd);
-	} else if (t == igbinary_type_long16p || t == igbinary_type_long16n) {
-		if (igsd->buffer_offset + 2 > igsd->buffer_size) {
-			throw IgbinaryWarning("igbinary_unserialize_long: end-of-data");
-		}
-
-		return (t == igbinary_type_long16n ? -1 : 1) * igbinary_unserialize16(igsd);
-	} else if (t == igbinary_type_long32p || t == igbinary_type_long32n) {
-		if (igsd->buffer_offset + 4 > igsd->buffer_size) {
-			throw IgbinaryWarning("igbinary_unserialize_long: end-of-data");
-		}
-
-		/* check for boundaries */
-		return (t == igbinary_type_long32n ? -1 : 1) * igbinary_unserialize32(igsd);
-	} else if (t == igbinary_type_long64p || t == igbinary_type_long64n) {
-		if (igsd->buffer_offset + 8 > igsd->buffer_size) {
-			throw IgbinaryWarning("igbinary_unserialize_long: end-of-data");
-		}
-
-		/* check for boundaries */
-		uint64_t tmp64 = igbinary_unserialize64(igsd);
-		if (tmp64 > 0x8000000000000000 || (tmp64 == 0x8000000000000000 && t == igbinary_type_long64p)) {
-			throw IgbinaryWarning("igbinary_unserialize_long: too big 64bit long.");
-		}
+inline static int64_t igbinary_unserialize_long(struct igbinary_unserialize_data *igsd, enum igbinary_type t) {
+	switch (t) {
+		case igbinary_type_long8p:
+			return igbinary_unserialize8(igsd, "igbinary_unserialize_long");
+		case igbinary_type_long8n:
+			return -(int64_t)igbinary_unserialize8(igsd, "igbinary_unserialize_long");
+		case igbinary_type_long16p:
+			return igbinary_unserialize16(igsd, "igbinary_unserialize_long");
+		case igbinary_type_long16n:
+			return -(int64_t)igbinary_unserialize16(igsd, "igbinary_unserialize_long");
+		case igbinary_type_long32p:
+			return igbinary_unserialize32(igsd, "igbinary_unserialize_long");
+		case igbinary_type_long32n:
+			return -(int64_t)igbinary_unserialize32(igsd, "igbinary_unserialize_long");
+		case igbinary_type_long64p:
+		case igbinary_type_long64n:
+			{
+				/* check for boundaries */
+				uint64_t tmp64 = igbinary_unserialize64(igsd, "igbinary_unserialize_long");
+				if (tmp64 > 0x8000000000000000 || (tmp64 == 0x8000000000000000 && t == igbinary_type_long64p)) {
+					throw IgbinaryWarning("igbinary_unserialize_long: too big 64bit long.");
+				}
 
-		return (t == igbinary_type_long64n ? -1 : 1) * tmp64;
-	} else {
-		// FIXME is format string correct? Not reachable.
-		throw IgbinaryWarning("igbinary_unserialize_long: unknown type '%02x', position %ld", (unsigned char)t, igsd->buffer_offset);
+				return t == igbinary_type_long64n ? (int64_t)(0 - tmp64) : (int64_t)tmp64;
+			}
+		default:
+			// FIXME is format string correct? Not reachable.
+			throw IgbinaryWarning("igbinary_unserialize_long: unknown type '%02x', position %ld", (unsigned char)t, igsd->buffer_offset);
 	}
-
-	return 0;
 }
 /* }}} */
 /* {{{ igbinary_unserialize_double */
 /** Unserializes double. */
 inline static double igbinary_unserialize_double(struct igbinary_unserialize_data *igsd) {
-	union {
-		double d;
-		uint64_t u;
-	} u;
-
-	if (igsd->buffer_offset + 8 > igsd->buffer_size) {
-		throw IgbinaryWarning("igbinary_unserialize_double: end-of-data");
-	}
-
-	u.u = igbinary_unserialize64(igsd);
-
-	return u.d;
+	const uint64_t u = igbinary_unserialize64(igsd, "igbinary_unserialize_double");
+	double d;
+	memcpy(&d, &u, sizeof(d));
+	return d;
 }
 /* }}} */
 /* {{{ igbinary_unserialize_chararray */
-/** Unserializes chararray of string. */
-inline static const String& igbinary_unserialize_chararray(struct igbinary_unserialize_data *igsd, const enum igbinary_type t) {
+/**
+ * Unserializes chararray of string.
+ * If intern is true (array keys, property names and class names), short strings which the process already has as static strings
+ * (e.g. declared property names and string literals) are shared instead of being copied. See igbinary_intern_string.
+ */
+inline static const String& igbinary_unserialize_chararray(struct igbinary_unserialize_data *igsd, const enum igbinary_type t, bool intern) {
 	size_t l;
 
-	if (t == igbinary_type_string8 || t == igbinary_type_object8) {
-		if (igsd->buffer_offset + 1 > igsd->buffer_size) {
-			throw IgbinaryWarning("igbinary_unserialize_chararray: end-of-data");
-		}
-		l = igbinary_unserialize8(igsd);
-	} else if (t == igbinary_type_string16 || t == igbinary_type_object16) {
-		if (igsd->buffer_offset + 2 > igsd->buffer_size) {
-			throw IgbinaryWarning("igbinary_unserialize_chararray: end-of-data");
-		}
-		l = igbinary_unserialize16(igsd);
-		if (igsd->buffer_offset + l > igsd->buffer_size) {
-			throw IgbinaryWarning("igbinary_unserialize_chararray: end-of-data");
-		}
-	} else if (t == igbinary_type_string32 || t == igbinary_type_object32) {
-		if (igsd->buffer_offset + 4 > igsd->buffer_size) {
-			throw IgbinaryWarning("igbinary_unserialize_chararray: end-of-data");
-		}
-		l = igbinary_unserialize32(igsd);
-		if (igsd->buffer_offset + l > igsd->buffer_size) {
-			throw IgbinaryWarning("igbinary_unserialize_chararray: end-of-data");
-		}
+	if (t >= igbinary_type_string8 && t <= igbinary_type_string32) {
+		l = igbinary_unserialize_len(igsd, t, igbinary_type_string8, "igbinary_unserialize_chararray");
+	} else if (t >= igbinary_type_object8 && t <= igbinary_type_object32) {
+		l = igbinary_unserialize_len(igsd, t, igbinary_type_object8, "igbinary_unserialize_chararray");
 	} else {
 		throw IgbinaryWarning("igbinary_unserialize_chararray: unknown type '0x%x', position %ld", (int)t, (int64_t)igsd->buffer_offset);
 	}
-	if (igsd->buffer_offset + l > igsd->buffer_size) {
-		throw IgbinaryWarning("igbinary_unserialize_chararray: end-of-data");
-	}
-
 
-	/** TODO : Optimize after implementing it the simple way and testing.. */
-	// Make a copy of every occurence of the string.
-	igsd->strings.emplace_back(reinterpret_cast<const char*>(igsd->buffer + igsd->buffer_offset), l, CopyString);
-	igsd->buffer_offset += l;
+	const char* data = reinterpret_cast<const char*>(igbinary_unserialize_advance(igsd, l, "igbinary_unserialize_chararray"));
+	if (intern) {
+		// Static strings have precomputed hashes and are not reference counted.
+		igsd->strings.emplace_back(igbinary_intern_string(data, l));
+		return igsd->strings.back();
+	}
+	// Make a copy of the first occurence of the string. Later occurrences are serialized as string ids.
+	igsd->strings.emplace_back(data, l, CopyString);
 
 	return igsd->strings.back();
 }
 /* }}} */
+static void igbinary_unserialize_skipped_range_strings(struct igbinary_unserialize_data *igsd, size_t i);
+/* {{{ igbinary_unserialize_chararray_at */
+/** Returns the bytes of the string (or class name) whose type is at offset, and sets l to its length. Doesn't move igsd->buffer_offset. */
+static const char* igbinary_unserialize_chararray_at(struct igbinary_unserialize_data *igsd, size_t offset, size_t& l) {
+	const size_t original_offset = igsd->buffer_offset;
+	igsd->buffer_offset = offset;
+	const enum igbinary_type t = (enum igbinary_type) igbinary_unserialize8(igsd, "igbinary_unserialize_string");
+	l = t >= igbinary_type_object8 && t <= igbinary_type_object32 ?
+		igbinary_unserialize_len(igsd, t, igbinary_type_object8, "igbinary_unserialize_string") :
+		igbinary_unserialize_len(igsd, t, igbinary_type_string8, "igbinary_unserialize_string");
+	const char* data = reinterpret_cast<const char*>(igbinary_unserialize_advance(igsd, l, "igbinary_unserialize_string"));
+	igsd->buffer_offset = original_offset;
+	return data;
+}
+/* }}} */
+/* {{{ igbinary_unserialize_skipped_string */
+/** Creates the string with id i, which was skipped by the igbinary_unserialize_skip_* functions. */
+NEVER_INLINE static const String& igbinary_unserialize_skipped_string(struct igbinary_unserialize_data *igsd, size_t i) {
+	const auto& skipped = igsd->skipped_strings;
+	auto it = std::lower_bound(skipped.begin(), skipped.end(), std::make_pair(i, (size_t) 0));
+	if (it == skipped.end() || it->first != i) {
+		// The string is in an indexed container that was skipped without looking inside.
+		igbinary_unserialize_skipped_range_strings(igsd, i);
+		it = std::lower_bound(skipped.begin(), skipped.end(), std::make_pair(i, (size_t) 0));
+		if (it == skipped.end() || it->first != i) {
+			throw IgbinaryWarning("igbinary_unserialize_string: string index is out-of-bounds");
+		}
+	}
+	size_t l;
+	const char* data = igbinary_unserialize_chararray_at(igsd, it->second, l);
+	igsd->strings[i] = String(data, l, CopyString);
+	return igsd->strings[i];
+}
+/* }}} */
 /* {{{ igbinary_unserialize_string */
 /** Unserializes string. Unserializes by string id. */
 inline static const String& igbinary_unserialize_string(struct igbinary_unserialize_data *igsd, enum igbinary_type t) {
 	size_t i;
-	if (t == igbinary_type_string_id8 || t == igbinary_type_object_id8) {
-		if (igsd->buffer_offset + 1 > igsd->buffer_size) {
-			throw IgbinaryWarning("igbinary_unserialize_string: end-of-data");
-		}
-		i = igbinary_unserialize8(igsd);
-	} else if (t == igbinary_type_string_id16 || t == igbinary_type_object_id16) {
-		if (igsd->buffer_offset + 2 > igsd->buffer_size) {
-			throw IgbinaryWarning("igbinary_unserialize_string: end-of-data");
-		}
-		i = igbinary_unserialize16(igsd);
-	} else if (t == igbinary_type_string_id32 || t == igbinary_type_object_id32) {
-		if (igsd->buffer_offset + 4 > igsd->buffer_size) {
-			throw IgbinaryWarning("igbinary_unserialize_string: end-of-data");
-		}
-		i = igbinary_unserialize32(igsd);
+	if (t >= igbinary_type_string_id8 && t <= igbinary_type_string_id32) {
+		i = igbinary_unserialize_len(igsd, t, igbinary_type_string_id8, "igbinary_unserialize_string");
+	} else if (t >= igbinary_type_object_id8 && t <= igbinary_type_object_id32) {
+		i = igbinary_unserialize_len(igsd, t, igbinary_type_object_id8, "igbinary_unserialize_string");
 	} else {
 		throw IgbinaryWarning("igbinary_unserialize_string: unknown type '0x%x', position %ld", (int)t, (uint64_t)igsd->buffer_offset);
 	}
@@ -331,19 +470,30 @@ inline static const String& igbinary_unserialize_string(struct igbinary_unserial
 		throw IgbinaryWarning("igbinary_unserialize_string: string index is out-of-bounds");
 	}
 
-	return igsd->strings[i];
+	const String& s = igsd->strings[i];
+	if (UNLIKELY(s.isNull())) {
+		return igbinary_unserialize_skipped_string(igsd, i);
+	}
+	return s;
 }
 /* }}} */
 /* {{{ igbinary_unserialize_object_prop */
-/* Similar to unserializeProp. nProp is the number of remaining dynamic properties. */
-inline static void igbinary_unserialize_object_prop(igbinary_unserialize_data *igsd, ObjectData* obj, const Variant& key, int nProp) {
+/*
+ * Similar to unserializeProp. nProp is the number of remaining dynamic properties.
+ * layout is the layout of obj's class, or nullptr for __PHP_Incomplete_Class.
+ */
+inline static void igbinary_unserialize_object_prop(igbinary_unserialize_data *igsd, ObjectData* obj, const IgbinaryClassLayout* layout, const Variant& key, int nProp) {
 	// Do a two-step look up
 	// FIXME not sure how protected variables are handled in igbinary in php5. Try to imitate that.
 	// For now, assume it can be from the class or any parent class.
 	Variant* t;
+	Slot slot;
 	if (UNLIKELY(key.isInteger())) {
 		// Integer keys are guaranteed to be dynamic properties.
 		t = &obj->reserveProperties(nProp).lvalAt(key, AccessFlags::Key);
+	} else if (layout != nullptr && (slot = layout->lookupSlot(key.getStringData())) != kInvalidSlot) {
+		// Declared property, found without looking it up in the class.
+		t = &tvAsVariant(&obj->propVec()[slot]);
 	} else {
 		const String strKey = key.toString();
 		auto const lookup = obj->getProp(nullptr, strKey.get());
@@ -395,7 +545,7 @@ inline static void igbinary_unserialize_object_prop(igbinary_unserialize_data *i
  * Inefficiently unserialize the remaining properties of an object, given an incomplete object with class set but no properties.
  * TODO: Pass this a list.
  */
-inline static void igbinary_unserialize_object_new_contents_leftover(struct igbinary_unserialize_data* igsd, enum igbinary_type t, Object* obj, int n) {
+inline static void igbinary_unserialize_object_new_contents_leftover(struct igbinary_unserialize_data* igsd, enum igbinary_type t, Object* obj, const IgbinaryClassLayout* layout, int n) {
 	//Class* objCls = obj->getVMClass();
 	for (int remainingProps = n; remainingProps > 0; --remainingProps) {
 		/*
@@ -407,7 +557,7 @@ inline static void igbinary_unserialize_object_new_contents_leftover(struct igbi
 		if (!igbinary_unserialize_array_key(igsd, v)) {
 			continue;
 		}
-		igbinary_unserialize_object_prop(igsd, obj->get(), v, remainingProps);
+		igbinary_unserialize_object_prop(igsd, obj->get(), layout, v, remainingProps);
 	}
 }
 /* }}} */
@@ -415,23 +565,10 @@ inline static void igbinary_unserialize_object_new_contents_leftover(struct igbi
 /**
  * Unserialize the properties of an object, given an incomplete object with class set but no properties.
  */
-inline static void igbinary_unserialize_object_new_contents(struct igbinary_unserialize_data* igsd, enum igbinary_type t, Object* obj) {
-	int n;
-	if (t == igbinary_type_array8) {
-		if (igsd->buffer_offset + 1 > igsd->buffer_size) {
-			throw IgbinaryWarning("igbinary_unserialize_array: end-of-data");
-		}
-		n = igbinary_unserialize8(igsd);
-	} else if (t == igbinary_type_array16) {
-		if (igsd->buffer_offset + 2 > igsd->buffer_size) {
-			throw IgbinaryWarning("igbinary_unserialize_array: end-of-data");
-		}
-		n = igbinary_unserialize16(igsd);
-	} else if (t == igbinary_type_array32) {
-		if (igsd->buffer_offset + 4 > igsd->buffer_size) {
-			throw IgbinaryWarning("igbinary_unserialize_object_contents: end-of-data");
-		}
-		n = igbinary_unserialize32(igsd);
+inline static void igbinary_unserialize_object_new_contents(struct igbinary_unserialize_data* igsd, enum igbinary_type t, Object* obj, const IgbinaryClassLayout* layout) {
+	size_t n;
+	if (t >= igbinary_type_array8 && t <= igbinary_type_array32) {
+		n = igbinary_unserialize_len(igsd, t, igbinary_type_array8, "igbinary_unserialize_object_contents");
 	} else {
 		throw IgbinaryWarning("igbinary_unserialize_object_contents: unknown type '%02x', position %lld", (int) t, (long long) igsd->buffer_offset);
 	}
@@ -446,7 +583,7 @@ inline static void igbinary_unserialize_object_new_contents(struct igbinary_unse
 		return;
 	}
 	// FIXME: Iterate over object properties first(and figure out demangling), it's probably faster that way.
-	igbinary_unserialize_object_new_contents_leftover(igsd, t, obj, n);
+	igbinary_unserialize_object_new_contents_leftover(igsd, t, obj, layout, n);
 
 	// Wakeup will be deferred by caller.
 }
@@ -458,40 +595,255 @@ inline static void igbinary_unserialize_object_ser(struct igbinary_unserialize_d
 		return;
 	}
 	size_t n;
-	if (t == igbinary_type_object_ser8) {
-		if (igsd->buffer_offset + 1 > igsd->buffer_size) {
-			throw IgbinaryWarning("igbinary_unserialize_object_ser: end-of-data");
+	if (t >= igbinary_type_object_ser8 && t <= igbinary_type_object_ser32) {
+		n = igbinary_unserialize_len(igsd, t, igbinary_type_object_ser8, "igbinary_unserialize_object_ser");
+	} else {
+		throw IgbinaryWarning("igbinary_unserialize_object_ser: unknown type '%02x', position %llu", (int)t, (unsigned long long)igsd->buffer_offset);
+	}
+
+	const uint8_t* data = igbinary_unserialize_advance(igsd, n, "igbinary_unserialize_object_ser");
+	// A request-local copy: unserialize() may keep the string after the input buffer is gone,
+	// and static strings would never be freed.
+	String serialized(reinterpret_cast<const char*>(data), n, CopyString);
+	obj->o_invoke_few_args(s_unserialize, 1, serialized);
+	obj.get()->clearNoDestruct();  // Allow destructor to be called (???)
+}
+
+/* {{{ igbinary_unserialize_hack_type8 */
+/** Returns the 8 bit variant (igbinary_type_vec8, igbinary_type_dict8 or igbinary_type_keyset8) of the vec, dict or keyset type t. */
+inline static enum igbinary_type igbinary_unserialize_hack_type8(enum igbinary_type t) {
+	return t >= igbinary_type_keyset8 ? igbinary_type_keyset8 : t >= igbinary_type_dict8 ? igbinary_type_dict8 : igbinary_type_vec8;
+}
+/* }}} */
+/* {{{ igbinary_unserialize_check_hack_value */
+/**
+ * Throws if the next value is a PHP reference (igbinary_type_ref). The values of vecs, dicts and collections can't be references,
+ * so the serializer never writes one there.
+ */
+inline static void igbinary_unserialize_check_hack_value(struct igbinary_unserialize_data *igsd) {
+	if (UNLIKELY(igsd->buffer_offset < igsd->buffer_size && igsd->buffer[igsd->buffer_offset] == igbinary_type_ref)) {
+		throw IgbinaryWarning("igbinary_unserialize_array: a vec, dict or collection can't contain a reference, at offset %lld", (long long) igsd->buffer_offset);
+	}
+}
+/* }}} */
+/* {{{ igbinary_unserialize_collection_contents */
+/**
+ * Unserializes the elements of a collection, given an empty collection: a vec for a Vector or ImmVector,
+ * a dict for a Map or ImmMap, and a keyset for a Set or ImmSet. Room for all of the elements is reserved first.
+ */
+static void igbinary_unserialize_collection_contents(struct igbinary_unserialize_data *igsd, enum igbinary_type t, ObjectData* obj) {
+	const enum igbinary_type type8 = igbinary_unserialize_hack_type8(t);
+	enum igbinary_type expected;
+	switch (obj->collectionType()) {
+		case CollectionType::Vector:
+		case CollectionType::ImmVector:
+			expected = igbinary_type_vec8;
+			break;
+		case CollectionType::Map:
+		case CollectionType::ImmMap:
+			expected = igbinary_type_dict8;
+			break;
+		case CollectionType::Set:
+		case CollectionType::ImmSet:
+			expected = igbinary_type_keyset8;
+			break;
+		default:
+			expected = igbinary_type_null;
+			break;
+	}
+	if (type8 != expected) {
+		throw IgbinaryWarning("igbinary_unserialize_collection: unexpected type '%02x' for %s, position %lld", (int) t, obj->getClassName().data(), (long long) igsd->buffer_offset);
+	}
+	const size_t n = igbinary_unserialize_len(igsd, t, type8, "igbinary_unserialize_collection");
+	/* n cannot be larger than the number of minimum "objects" in the array */
+	if (n > igsd->buffer_size - igsd->buffer_offset) {
+		throw IgbinaryWarning("igbinary_unserialize_collection: data size %llu smaller that requested collection length %llu.", (long long)(igsd->buffer_size - igsd->buffer_offset), (long long) n);
+	}
+	collections::reserve(obj, n);
+	for (size_t i = 0; i < n; i++) {
+		Variant key;
+		if (type8 != igbinary_type_vec8 && !igbinary_unserialize_array_key(igsd, key)) {
+			continue;
+		}
+		if (type8 == igbinary_type_keyset8) {
+			collections::initElem(obj, key.asTypedValue());
+			continue;
+		}
+		const size_t references_start = igsd->references.size();
+		Variant value;
+		igbinary_unserialize_check_hack_value(igsd);
+		igbinary_unserialize_variant(igsd, value, WANT_CLEAR);
+		if (type8 == igbinary_type_vec8) {
+			collections::initElem(obj, value.asTypedValue());
+		} else {
+			collections::initMapElem(obj, key.asTypedValue(), value.asTypedValue());
 		}
-		n = igbinary_unserialize8(igsd TSRMLS_CC);
-	} else if (t == igbinary_type_object_ser16) {
-		if (igsd->buffer_offset + 2 > igsd->buffer_size) {
-			throw IgbinaryWarning("igbinary_unserialize_object_ser: end-of-data");
+		if (igsd->references.size() > references_start && igsd->references[references_start] == &value) {
+			// The element is an array or object which a later ref may point at. The collection has its own copy.
+			igsd->collection_elements.emplace_back(std::move(value));
+			igsd->references[references_start] = &igsd->collection_elements.back();
+		}
+	}
+}
+/* }}} */
+/* {{{ igbinary_unserialize_schema_chararray */
+/** Moves past the class name or a property name of a schema definition, which don't define string ids. Returns its bytes, and sets l to its length. */
+static const char* igbinary_unserialize_schema_chararray(struct igbinary_unserialize_data *igsd, size_t& l) {
+	const enum igbinary_type t = (enum igbinary_type) igbinary_unserialize8(igsd, "igbinary_unserialize_schema");
+	if (t < igbinary_type_string8 || t > igbinary_type_string32) {
+		throw IgbinaryWarning("igbinary_unserialize_schema: unexpected type '%02x' in a schema definition, position %lld", (int) t, (long long) igsd->buffer_offset);
+	}
+	l = igbinary_unserialize_len(igsd, t, igbinary_type_string8, "igbinary_unserialize_schema");
+	return reinterpret_cast<const char*>(igbinary_unserialize_advance(igsd, l, "igbinary_unserialize_schema"));
+}
+/* }}} */
+/* {{{ igbinary_unserialize_schema_string */
+/** Returns the class name or property name of a schema definition, shared with the existing static string if there is one. See igbinary_intern_string. */
+static String igbinary_unserialize_schema_string(struct igbinary_unserialize_data *igsd) {
+	size_t l;
+	const char* data = igbinary_unserialize_schema_chararray(igsd, l);
+	return igbinary_intern_string(data, l);
+}
+/* }}} */
+/* {{{ igbinary_unserialize_schema_id */
+/**
+ * Unserializes the schema id which follows the type t of an object with a schema, and moves past the definition of the schema
+ * if the data defines it here. Returns the schema, which isn't resolved if it was just defined.
+ */
+static igbinary_unserialize_schema& igbinary_unserialize_schema_id(struct igbinary_unserialize_data *igsd, enum igbinary_type t) {
+	const size_t id = igbinary_unserialize_len(igsd, t, igbinary_type_object_schema8, "igbinary_unserialize_schema");
+	auto& schemas = igsd->schemas;
+	if (id < schemas.size()) {
+		igbinary_unserialize_schema& schema = schemas[id];
+		if (schema.offset == igsd->buffer_offset) {
+			// The definition was already read while skipping over this data.
+			igsd->buffer_offset = schema.end;
 		}
-		n = igbinary_unserialize16(igsd TSRMLS_CC);
-	} else if (t == igbinary_type_object_ser32) {
-		if (igsd->buffer_offset + 4 > igsd->buffer_size) {
-			throw IgbinaryWarning("igbinary_unserialize_object_ser: end-of-data");
+		return schema;
+	}
+	if (id > schemas.size()) {
+		throw IgbinaryWarning("igbinary_unserialize_schema: schema id %llu is out-of-bounds, position %lld", (unsigned long long) id, (long long) igsd->buffer_offset);
+	}
+	schemas.emplace_back();
+	igbinary_unserialize_schema& schema = schemas.back();
+	schema.offset = igsd->buffer_offset;
+	schema.class_name = igbinary_unserialize_schema_string(igsd);
+	schema.version = igbinary_unserialize_long(igsd, (enum igbinary_type) igbinary_unserialize8(igsd, "igbinary_unserialize_schema"));
+	t = (enum igbinary_type) igbinary_unserialize8(igsd, "igbinary_unserialize_schema");
+	if (t < igbinary_type_array8 || t > igbinary_type_array32) {
+		throw IgbinaryWarning("igbinary_unserialize_schema: unexpected type '%02x' in a schema definition, position %lld", (int) t, (long long) igsd->buffer_offset);
+	}
+	schema.n = igbinary_unserialize_len(igsd, t, igbinary_type_array8, "igbinary_unserialize_schema");
+	/* n cannot be larger than the number of minimum "objects" in the array */
+	if (schema.n > igsd->buffer_size - igsd->buffer_offset) {
+		throw IgbinaryWarning("igbinary_unserialize_schema: data size %lld smaller than requested schema length %lld.", (long long)(igsd->buffer_size - igsd->buffer_offset), (long long) schema.n);
+	}
+	schema.names_offset = igsd->buffer_offset;
+	for (size_t i = 0; i < schema.n; i++) {
+		size_t l;
+		igbinary_unserialize_schema_chararray(igsd, l);
+	}
+	schema.end = igsd->buffer_offset;
+	schema.resolved = false;
+	return schema;
+}
+/* }}} */
+/* {{{ igbinary_unserialize_schema_names */
+/** Reads the property names of schema from its definition, if they weren't read yet. */
+static void igbinary_unserialize_schema_names(struct igbinary_unserialize_data *igsd, igbinary_unserialize_schema& schema) {
+	if (schema.names.size() == schema.n) {
+		return;
+	}
+	const size_t original_offset = igsd->buffer_offset;
+	igsd->buffer_offset = schema.names_offset;
+	schema.names.reserve(schema.n);
+	for (size_t i = 0; i < schema.n; i++) {
+		schema.names.push_back(igbinary_unserialize_schema_string(igsd));
+	}
+	igsd->buffer_offset = original_offset;
+}
+/* }}} */
+/* {{{ igbinary_unserialize_schema_resolve */
+/**
+ * Looks up the class of schema (with autoloading), and the slots of its properties if the same version of the schema is registered,
+ * once for all of the objects using the schema. For other versions, each property name is looked up like those of other objects.
+ */
+static void igbinary_unserialize_schema_resolve(struct igbinary_unserialize_data *igsd, igbinary_unserialize_schema& schema) {
+	igbinary_unserialize_schema_names(igsd, schema);
+	schema.resolved = true;
+	schema.positional = false;
+	schema.layout = igbinary_class_layout_for_name(schema.class_name.get());
+	if (schema.layout == nullptr) {
+		return;  // Unserialized as __PHP_Incomplete_Class.
+	}
+	Class* cls = schema.layout->cls;
+	if (!schema.layout->serialize_from_slots) {
+		throw IgbinaryWarning("igbinary_unserialize_schema: Instances of %s can't be unserialized from a schema", cls->name()->data());
+	}
+	if (igbinary_schema_find(cls->name(), schema.version) == nullptr) {
+		return;
+	}
+	req::vector<bool> listed(cls->numDeclProperties(), false);
+	req::vector<Slot> slots;
+	slots.reserve(schema.n);
+	for (const String& name : schema.names) {
+		const Slot slot = schema.layout->lookupSlot(name.get());
+		if (slot == kInvalidSlot || listed[slot]) {
+			return;  // A property which the class no longer declares, or a name that isn't unique.
 		}
-		n = igbinary_unserialize32(igsd TSRMLS_CC);
+		listed[slot] = true;
+		slots.push_back(slot);
+	}
+	schema.slots.swap(slots);
+	schema.positional = true;
+}
+/* }}} */
+/* {{{ igbinary_unserialize_object_schema */
+/** Unserializes an object with a schema (the schema id, followed by its property values in the schema's order), store into v. */
+static void igbinary_unserialize_object_schema(struct igbinary_unserialize_data *igsd, enum igbinary_type t, Variant& v, int flags) {
+	igbinary_unserialize_schema& schema = igbinary_unserialize_schema_id(igsd, t);
+	if (!schema.resolved) {
+		igbinary_unserialize_schema_resolve(igsd, schema);
+	}
+
+	Object obj;
+	if (schema.layout != nullptr) {
+		obj = Object{schema.layout->cls};
 	} else {
-		throw IgbinaryWarning("igbinary_unserialize_object_ser: unknown type '%02x', position %llu", (int)t, (unsigned long long)igsd->buffer_offset);
+		obj = Object{SystemLib::s___PHP_Incomplete_ClassClass};
+		obj->o_set(s_PHP_Incomplete_Class_Name, schema.class_name);
+	}
+	v = obj;
+	if (flags & WANT_REF) {
+		v.asRef();
 	}
+	igsd->references.push_back(&v);  // FIXME: Account for flags & WANT_REF
 
-	if (igsd->buffer_offset + n > igsd->buffer_size) {
-		throw IgbinaryWarning("igbinary_unserialize_object_ser: end-of-data");
+	if (schema.positional) {
+		TypedValue* prop_vec = obj->propVec();
+		for (const Slot slot : schema.slots) {
+			Variant& prop = tvAsVariant(&prop_vec[slot]);
+			if (UNLIKELY(isRefcountedType(prop.getRawType()))) {
+				igsd->m_overwrittenList.append(prop);
+			}
+			igbinary_unserialize_variant(igsd, prop, WANT_CLEAR);
+		}
+	} else {
+		for (size_t i = 0; i < schema.n; i++) {
+			igbinary_unserialize_object_prop(igsd, obj.get(), schema.layout, Variant(schema.names[i]), schema.n - i);
+		}
 	}
 
-	String serialized = String::attach(makeStaticString(reinterpret_cast<const char*>(igsd->buffer + igsd->buffer_offset), n));
-	obj->o_invoke_few_args(s_unserialize, 1, serialized);
-	igsd->buffer_offset += n;
-	obj.get()->clearNoDestruct();  // Allow destructor to be called (???)
+	if (schema.layout != nullptr && schema.layout->has_wakeup) {
+		igsd_defer_wakeup(igsd, obj);
+	}
 }
-
+/* }}} */
 /** Unserialize object, store into v. */
 inline static void igbinary_unserialize_object(struct igbinary_unserialize_data *igsd, enum igbinary_type t, Variant& v, int flags) {
 	String class_name;
 	if (t == igbinary_type_object8 || t == igbinary_type_object16 || t == igbinary_type_object32) {
-		class_name = igbinary_unserialize_chararray(igsd, t);
+		class_name = igbinary_unserialize_chararray(igsd, t, true);
 	} else if (t == igbinary_type_object_id8 || t == igbinary_type_object_id16 || t == igbinary_type_object_id32) {
 		class_name = igbinary_unserialize_string(igsd, t);
 	} else {
@@ -499,12 +851,10 @@ inline static void igbinary_unserialize_object(struct igbinary_unserialize_data
 	}
 
 	// Unserialize the inner type (The byte after the class name).
-	if (igsd->buffer_offset + 1 > igsd->buffer_size) {
-		throw IgbinaryWarning("igbinary_unserialize_object: end-of-data");
-	}
-	t = (enum igbinary_type) igbinary_unserialize8(igsd);
+	t = (enum igbinary_type) igbinary_unserialize8(igsd, "igbinary_unserialize_object");
 
-	Class* cls = Unit::loadClass(class_name.get());  // with autoloading
+	const IgbinaryClassLayout* layout = igbinary_class_layout_for_name(class_name.get());  // with autoloading
+	Class* cls = layout != nullptr ? layout->cls : nullptr;
 	Object obj;
 	if (cls) {
 		// Only unserialize CPP extension types which can actually
@@ -524,6 +874,15 @@ inline static void igbinary_unserialize_object(struct igbinary_unserialize_data
 				case igbinary_type_array8:
 				case igbinary_type_array16:
 				case igbinary_type_array32:
+				case igbinary_type_vec8:
+				case igbinary_type_vec16:
+				case igbinary_type_vec32:
+				case igbinary_type_dict8:
+				case igbinary_type_dict16:
+				case igbinary_type_dict32:
+				case igbinary_type_keyset8:
+				case igbinary_type_keyset16:
+				case igbinary_type_keyset32:
 					obj = Object{cls};
 					break;
 				default:
@@ -553,7 +912,21 @@ inline static void igbinary_unserialize_object(struct igbinary_unserialize_data
 		case igbinary_type_array8:
 		case igbinary_type_array16:
 		case igbinary_type_array32:
-			igbinary_unserialize_object_new_contents(igsd, t, &obj);
+			igbinary_unserialize_object_new_contents(igsd, t, &obj, layout);
+			break;
+		case igbinary_type_vec8:
+		case igbinary_type_vec16:
+		case igbinary_type_vec32:
+		case igbinary_type_dict8:
+		case igbinary_type_dict16:
+		case igbinary_type_dict32:
+		case igbinary_type_keyset8:
+		case igbinary_type_keyset16:
+		case igbinary_type_keyset32:
+			if (!obj->isCollection()) {
+				throw IgbinaryWarning("igbinary_unserialize_object: %s is not a collection, position %lld", obj->getClassName().data(), (long long)igsd->buffer_offset);
+			}
+			igbinary_unserialize_collection_contents(igsd, t, obj.get());
 			break;
 		case igbinary_type_object_ser8:
 		case igbinary_type_object_ser16:
@@ -564,7 +937,7 @@ inline static void igbinary_unserialize_object(struct igbinary_unserialize_data
 			throw IgbinaryWarning("igbinary_unserialize_object: unknown object inner type '%02x', position %lld", (int)t, (long long)igsd->buffer_offset);
 	}
 
-	if (cls && cls->lookupMethod(s___wakeup.get())) {
+	if (layout != nullptr && layout->has_wakeup) {
 		igsd_defer_wakeup(igsd, obj);
 	}
 }
@@ -579,10 +952,7 @@ inline static void igbinary_unserialize_object(struct igbinary_unserialize_data
 static bool igbinary_unserialize_array_key(igbinary_unserialize_data *igsd, Variant& v) {
 	enum igbinary_type t;
 
-	if (igsd->buffer_offset + 1 > igsd->buffer_size) {
-		throw IgbinaryWarning("igbinary_unserialize_array_key: end-of-data");
-	}
-	t = (enum igbinary_type) igbinary_unserialize8(igsd);
+	t = (enum igbinary_type) igbinary_unserialize8(igsd, "igbinary_unserialize_array_key");
 	switch (t) {
 		case igbinary_type_string_empty:
 			{
@@ -604,7 +974,7 @@ static bool igbinary_unserialize_array_key(igbinary_unserialize_data *igsd, Vari
 		case igbinary_type_string8:
 		case igbinary_type_string16:
 		case igbinary_type_string32:
-			v = igbinary_unserialize_chararray(igsd, t);
+			v = igbinary_unserialize_chararray(igsd, t, true);
 			return true;
 		case igbinary_type_string_id8:
 		case igbinary_type_string_id16:
@@ -618,26 +988,70 @@ static bool igbinary_unserialize_array_key(igbinary_unserialize_data *igsd, Vari
 	}
 	return true;
 }
+/* {{{ igbinary_unserialize_array_next_index */
+/**
+ * Consumes the next array key if it is the integer `expected`, without creating a Variant for it.
+ * Otherwise, leaves buffer_offset unchanged and returns false.
+ */
+inline static bool igbinary_unserialize_array_next_index(igbinary_unserialize_data *igsd, int64_t expected) {
+	const size_t original_offset = igsd->buffer_offset;
+	const enum igbinary_type t = (enum igbinary_type) igbinary_unserialize8(igsd, "igbinary_unserialize_array_key");
+	switch (t) {
+		case igbinary_type_long8p:
+		case igbinary_type_long16p:
+		case igbinary_type_long32p:
+		case igbinary_type_long64p:
+			if (igbinary_unserialize_long(igsd, t) == expected) {
+				return true;
+			}
+			break;
+		default:
+			break;
+	}
+	igsd->buffer_offset = original_offset;
+	return false;
+}
+/* }}} */
+/* {{{ igbinary_unserialize_array_convert_to_mixed */
+/**
+ * Called when an array that was being built as a packed array gets a key other than the next index.
+ * Moves the elements decoded so far into a mixed array with room for all n elements.
+ *
+ * igsd->references may point at elements of the packed array (references_start is the size igsd->references had
+ * before the first element was decoded). Those are re-pointed at the corresponding elements of the new array.
+ */
+static void igbinary_unserialize_array_convert_to_mixed(igbinary_unserialize_data *igsd, Array* arr, size_t n, size_t references_start) {
+	const int64_t count = arr->size();
+	Array mixed = ArrayInit(n, ArrayInit::Mixed{}).toArray();
+	if (count == 0) {
+		*arr = std::move(mixed);
+		return;
+	}
+	// The elements of a packed array are stored contiguously, in key order.
+	Variant* const old_begin = &arr->lvalAt((int64_t)0, AccessFlags::Key);
+	assert(&arr->lvalAt(count - 1, AccessFlags::Key) == old_begin + (count - 1));
+	for (int64_t i = 0; i < count; i++) {
+		TypedValue* from = old_begin[i].asTypedValue();
+		// Move the raw value so that references (KindOfRef) stay bound to the same RefData.
+		tvMove(*from, *mixed.lvalAt(i, AccessFlags::Key).asTypedValue());
+		tvWriteUninit(from);
+	}
+	for (size_t r = references_start; r < igsd->references.size(); r++) {
+		Variant*& ref = igsd->references[r];
+		if (ref >= old_begin && ref < old_begin + count) {
+			ref = &mixed.lvalAt((int64_t)(ref - old_begin), AccessFlags::Key);
+		}
+	}
+	*arr = std::move(mixed);
+}
+/* }}} */
 /* {{{ igbinary_unserialize_array */
 /** Unserializes array. */
 inline static void igbinary_unserialize_array(struct igbinary_unserialize_data *igsd, enum igbinary_type t, Variant& v, bool wantRef) {
 	/* wantRef means that z will be wrapped by an IS_REFERENCE */
 	size_t n;
-	if (t == igbinary_type_array8) {
-		if (igsd->buffer_offset + 1 > igsd->buffer_size) {
-			throw IgbinaryWarning("igbinary_unserialize_array: end-of-data");
-		}
-		n = igbinary_unserialize8(igsd);
-	} else if (t == igbinary_type_array16) {
-		if (igsd->buffer_offset + 2 > igsd->buffer_size) {
-			throw IgbinaryWarning("igbinary_unserialize_array: end-of-data");
-		}
-		n = igbinary_unserialize16(igsd);
-	} else if (t == igbinary_type_array32) {
-		if (igsd->buffer_offset + 4 > igsd->buffer_size) {
-			throw IgbinaryWarning("igbinary_unserialize_array: end-of-data");
-		}
-		n = igbinary_unserialize32(igsd);
+	if (t >= igbinary_type_array8 && t <= igbinary_type_array32) {
+		n = igbinary_unserialize_len(igsd, t, igbinary_type_array8, "igbinary_unserialize_array");
 	} else {
 		throw IgbinaryWarning("igbinary_unserialize_array: unknown type 0x%02x, position %ld", t, igsd->buffer_offset);
 	}
@@ -657,7 +1071,19 @@ inline static void igbinary_unserialize_array(struct igbinary_unserialize_data *
 		return;
 	}
 
-	v = ArrayInit(n, ArrayInit::Mixed{}).toArray();
+	/*
+	 * Lists are serialized with the keys 0..n-1, in order. If the first key is 0, build a packed array,
+	 * and only fall back to a mixed array if a later key turns out not to be the next index.
+	 */
+	bool packed = igsd->buffer_offset + 2 <= igsd->buffer_size &&
+		igsd->buffer[igsd->buffer_offset] == igbinary_type_long8p &&
+		igsd->buffer[igsd->buffer_offset + 1] == 0;
+	if (packed) {
+		v = PackedArrayInit(n).toArray();
+	} else {
+		v = ArrayInit(n, ArrayInit::Mixed{}).toArray();
+	}
+	const size_t references_start = igsd->references.size();
 
 	// FIXME: Need to add a reference just in case of a duplicate key causing the original variant reference count to be decremented.
 	Array* arr;
@@ -671,6 +1097,14 @@ inline static void igbinary_unserialize_array(struct igbinary_unserialize_data *
 	}
 
 	for (size_t i = 0; i < n; i++) {
+		if (packed) {
+			if (igbinary_unserialize_array_next_index(igsd, arr->size())) {
+				igbinary_unserialize_variant(igsd, arr->lvalAt(), WANT_CLEAR);
+				continue;
+			}
+			igbinary_unserialize_array_convert_to_mixed(igsd, arr, n, references_start);
+			packed = false;
+		}
 		Variant key;
 		if (!igbinary_unserialize_array_key(igsd, key)) {
 			continue;
@@ -685,50 +1119,159 @@ inline static void igbinary_unserialize_array(struct igbinary_unserialize_data *
 	}
 }
 /* }}} */
-/* {{{ */
-static void igbinary_unserialize_ref(igbinary_unserialize_data *igsd, enum igbinary_type t, Variant& v, int flags) {
-	size_t n;
-
-	if (t == igbinary_type_ref8 || t == igbinary_type_objref8) {
-		if (igsd->buffer_offset + 1 > igsd->buffer_size) {
-			throw IgbinaryWarning("igbinary_unserialize_ref: end-of-data");
-		}
-		n = igbinary_unserialize8(igsd TSRMLS_CC);
-	} else if (t == igbinary_type_ref16 || t == igbinary_type_objref16) {
-		if (igsd->buffer_offset + 2 > igsd->buffer_size) {
-			throw IgbinaryWarning("igbinary_unserialize_ref: end-of-data");
-		}
-		n = igbinary_unserialize16(igsd TSRMLS_CC);
-	} else if (LIKELY(t == igbinary_type_ref32 || t == igbinary_type_objref32)) {
-		if (igsd->buffer_offset + 4 > igsd->buffer_size) {
-			throw IgbinaryWarning("igbinary_unserialize_ref: end-of-data");
-		}
-		n = igbinary_unserialize32(igsd TSRMLS_CC);
-	} else {
-		throw IgbinaryWarning("igbinary_unserialize_ref: unknown type '%02x', position %lld", (int)t, (long long)igsd->buffer_offset);
-	}
-
-	if (n >= igsd->references.size()) {
-		throw IgbinaryWarning("igbinary_unserialize_ref: invalid reference %u >= %u", (int) n, (int)igsd->references.size());
+/* {{{ igbinary_unserialize_hack_array */
+/** Unserializes a vec, dict or keyset of type t. See igbinary_unserialize_array. */
+static void igbinary_unserialize_hack_array(struct igbinary_unserialize_data *igsd, enum igbinary_type t, Variant& v, bool wantRef) {
+	const enum igbinary_type type8 = igbinary_unserialize_hack_type8(t);
+	const size_t n = igbinary_unserialize_len(igsd, t, type8, "igbinary_unserialize_array");
+	/* n cannot be larger than the number of minimum "objects" in the array */
+	if (n > igsd->buffer_size - igsd->buffer_offset) {
+		throw IgbinaryWarning("igbinary_unserialize_array: data size %llu smaller that requested array length %llu.", (long long)(igsd->buffer_size - igsd->buffer_offset), (long long) n);
 	}
 
-	Variant*& data = igsd->references[n];
-
-	if ((flags & WANT_REF) != 0) {
-		if (data->getRawType() != KindOfRef) {
-			v = *data;
+	igsd->references.push_back(&v);
+	if (type8 == igbinary_type_keyset8) {
+		// A keyset only has keys, which can't be referred to, so it is built before being stored in v.
+		KeysetInit init(n);
+		for (size_t i = 0; i < n; i++) {
+			Variant key;
+			if (!igbinary_unserialize_array_key(igsd, key)) {
+				continue;
+			}
+			if (key.isInteger()) {
+				init.add(key.toInt64());
+			} else {
+				init.add(key.toString());
+			}
+		}
+		v = init.toArray();
+		if (wantRef) {
 			v.asRef();
-			data = &v;
-		} else {
-			v.assignRef(*data);
 		}
-	} else {
-		// Copy underlying data of ref or non-ref. Deletes old data?
-		// v.constructValHelper(*data);
-		cellDup(tvToInitCell(data->asTypedValue()), *v.asTypedValue());
+		return;
 	}
 
+	// Values are unserialized in place, since igsd->references may point at them. There is room for all n of them.
+	v = type8 == igbinary_type_vec8 ? VecArrayInit(n).toArray() : DictInit(n).toArray();
+	Array* arr;
+	if (wantRef) {
+		v.asRef();
+		auto tv = v.asTypedValue();
+		Variant& v_deref = *tv->m_data.pref->var();
+		arr = &(v_deref.asArrRef());
+	} else {
+		arr = &(v.asArrRef());
+	}
+	for (size_t i = 0; i < n; i++) {
+		if (type8 == igbinary_type_vec8) {
+			igbinary_unserialize_check_hack_value(igsd);
+			igbinary_unserialize_variant(igsd, arr->lvalAt(), WANT_CLEAR);
+			continue;
+		}
+		Variant key;
+		if (!igbinary_unserialize_array_key(igsd, key)) {
+			continue;
+		}
+		igbinary_unserialize_check_hack_value(igsd);
+		// Dicts keep string keys such as "1" as strings, which AccessFlags::Key does.
+		igbinary_unserialize_variant(igsd, arr->lvalAt(key, AccessFlags::Key), WANT_CLEAR);
+	}
+}
+/* }}} */
+/* {{{ */
+static void igbinary_unserialize_ref(igbinary_unserialize_data *igsd, enum igbinary_type t, Variant& v, int flags) {
+	size_t n;
 
+	if (t >= igbinary_type_ref8 && t <= igbinary_type_ref32) {
+		n = igbinary_unserialize_len(igsd, t, igbinary_type_ref8, "igbinary_unserialize_ref");
+	} else if (LIKELY(t >= igbinary_type_objref8 && t <= igbinary_type_objref32)) {
+		n = igbinary_unserialize_len(igsd, t, igbinary_type_objref8, "igbinary_unserialize_ref");
+	} else {
+		throw IgbinaryWarning("igbinary_unserialize_ref: unknown type '%02x', position %lld", (int)t, (long long)igsd->buffer_offset);
+	}
+
+	if (n >= igsd->references.size()) {
+		throw IgbinaryWarning("igbinary_unserialize_ref: invalid reference %u >= %u", (int) n, (int)igsd->references.size());
+	}
+
+	Variant*& data = igsd->references[n];
+	if (UNLIKELY(data == nullptr)) {
+		throw IgbinarySkippedReference(n);
+	}
+
+	if ((flags & WANT_REF) != 0) {
+		if (data->getRawType() != KindOfRef) {
+			v = *data;
+			v.asRef();
+			data = &v;
+		} else {
+			v.assignRef(*data);
+		}
+	} else {
+		// Copy underlying data of ref or non-ref. Deletes old data?
+		// v.constructValHelper(*data);
+		cellDup(tvToInitCell(data->asTypedValue()), *v.asTypedValue());
+	}
+
+
+}
+/* }}} */
+/* {{{ igbinary_unserialize_indexed_header */
+/** The header of an indexed container. See igbinary_indexed.hpp. */
+struct igbinary_unserialize_indexed_data {
+	size_t body_len;
+	size_t strings;
+	size_t references;
+	size_t table_len;
+	size_t table_offset;
+	size_t body_offset;
+};
+/** Unserializes the header of an indexed container, and moves past its key table to the wrapped array or object. */
+inline static igbinary_unserialize_indexed_data igbinary_unserialize_indexed_header(igbinary_unserialize_data *igsd) {
+	igbinary_unserialize_indexed_data h;
+	const uint8_t* header = igbinary_unserialize_advance(igsd, IGBINARY_INDEXED_HEADER_SIZE, "igbinary_unserialize_indexed");
+	h.body_len = igbinary_load32(header);
+	h.strings = igbinary_load32(header + 4);
+	h.references = igbinary_load32(header + 8);
+	h.table_len = igbinary_load32(header + 12);
+	h.table_offset = igsd->buffer_offset;
+	igbinary_unserialize_advance(igsd, h.table_len * IGBINARY_INDEXED_ENTRY_SIZE, "igbinary_unserialize_indexed");
+	h.body_offset = igsd->buffer_offset;
+	if (h.body_len > igsd->buffer_size - h.body_offset) {
+		throw IgbinaryWarning("igbinary_unserialize_indexed: data size %llu smaller than the container length %llu", (unsigned long long)(igsd->buffer_size - h.body_offset), (unsigned long long) h.body_len);
+	}
+	// Each string and reference takes at least one byte, so this bounds the placeholders added when skipping it.
+	if (h.strings > h.body_len || h.references > h.body_len) {
+		throw IgbinaryWarning("igbinary_unserialize_indexed: container of %llu bytes can't define %llu strings and %llu references", (unsigned long long) h.body_len, (unsigned long long) h.strings, (unsigned long long) h.references);
+	}
+	const enum igbinary_type t = h.body_len > 0 ? (enum igbinary_type) igsd->buffer[h.body_offset] : igbinary_type_null;
+	if (!(t >= igbinary_type_array8 && t <= igbinary_type_array32) && !(t >= igbinary_type_object8 && t <= igbinary_type_object_id32)) {
+		throw IgbinaryWarning("igbinary_unserialize_indexed: expected an array or object, got igbinary_type 0x%02x", (int) t);
+	}
+	return h;
+}
+/* }}} */
+/* {{{ igbinary_unserialize_indexed_end */
+/** Checks that the wrapped array or object of an indexed container ended where the container's header said it would. */
+inline static void igbinary_unserialize_indexed_end(igbinary_unserialize_data *igsd, const igbinary_unserialize_indexed_data& h) {
+	if (igsd->buffer_offset != h.body_offset + h.body_len) {
+		throw IgbinaryWarning("igbinary_unserialize_indexed: expected the container to end at offset %llu, got %llu", (unsigned long long)(h.body_offset + h.body_len), (unsigned long long) igsd->buffer_offset);
+	}
+}
+/* }}} */
+/* {{{ igbinary_unserialize_indexed */
+/** Unserializes an indexed container, which is the same as unserializing the array or object it wraps. */
+static void igbinary_unserialize_indexed(igbinary_unserialize_data *igsd, Variant& v, int flags) {
+	const igbinary_unserialize_indexed_data h = igbinary_unserialize_indexed_header(igsd);
+	const size_t strings_start = igsd->strings.size();
+	const size_t references_start = igsd->references.size();
+	igbinary_unserialize_variant(igsd, v, flags);
+	igbinary_unserialize_indexed_end(igsd, h);
+	if (igsd->strings.size() - strings_start != h.strings || igsd->references.size() - references_start != h.references) {
+		throw IgbinaryWarning("igbinary_unserialize_indexed: container defined %llu strings and %llu references, expected %llu and %llu",
+			(unsigned long long)(igsd->strings.size() - strings_start), (unsigned long long)(igsd->references.size() - references_start),
+			(unsigned long long) h.strings, (unsigned long long) h.references);
+	}
 }
 /* }}} */
 /* {{{ igbinary_unserialize_variant */
@@ -736,10 +1279,11 @@ static void igbinary_unserialize_ref(igbinary_unserialize_data *igsd, enum igbin
 static void igbinary_unserialize_variant(igbinary_unserialize_data *igsd, Variant& v, int flags) {
 	enum igbinary_type t;
 
-	if (igsd->buffer_offset + 1 > igsd->buffer_size) {
-		throw IgbinaryWarning("igbinary_unserialize_variant: end-of-data");
+	t = (enum igbinary_type) igbinary_unserialize8(igsd, "igbinary_unserialize_variant");
+	if (UNLIKELY(igsd->values_only) && (t == igbinary_type_ref || (t >= igbinary_type_object8 && t <= igbinary_type_object_id32) ||
+			(t >= igbinary_type_object_schema8 && t <= igbinary_type_object_schema32))) {
+		throw IgbinaryWarning("igbinary_unserialize_variant: %s can't be shared, at offset %lld", t == igbinary_type_ref ? "references" : "objects", (long long) igsd->buffer_offset);
 	}
-	t = (enum igbinary_type) igbinary_unserialize8(igsd);
 	switch (t) {
 		case igbinary_type_ref:
 			{
@@ -751,6 +1295,7 @@ static void igbinary_unserialize_variant(igbinary_unserialize_data *igsd, Varian
 				}
 				switch (type) {
 					case KindOfString:
+					case KindOfPersistentString:  // Empty and interned strings
 					case KindOfInt64:
 					case KindOfNull:
 					case KindOfDouble:
@@ -781,6 +1326,11 @@ static void igbinary_unserialize_variant(igbinary_unserialize_data *igsd, Varian
 		case igbinary_type_object_id32:
 			igbinary_unserialize_object(igsd, t, v, flags);
 			break;
+		case igbinary_type_object_schema8:
+		case igbinary_type_object_schema16:
+		case igbinary_type_object_schema32:
+			igbinary_unserialize_object_schema(igsd, t, v, flags);
+			break;
 		case igbinary_type_array8:
 		case igbinary_type_array16:
 		case igbinary_type_array32:
@@ -788,6 +1338,20 @@ static void igbinary_unserialize_variant(igbinary_unserialize_data *igsd, Varian
 				igbinary_unserialize_array(igsd, t, v, (flags & WANT_REF) != 0);
 			}
 			break;
+		case igbinary_type_indexed:
+			igbinary_unserialize_indexed(igsd, v, flags);
+			return;
+		case igbinary_type_vec8:
+		case igbinary_type_vec16:
+		case igbinary_type_vec32:
+		case igbinary_type_dict8:
+		case igbinary_type_dict16:
+		case igbinary_type_dict32:
+		case igbinary_type_keyset8:
+		case igbinary_type_keyset16:
+		case igbinary_type_keyset32:
+			igbinary_unserialize_hack_array(igsd, t, v, (flags & WANT_REF) != 0);
+			break;
 		case igbinary_type_string_empty:
 			{
 				String s = "";
@@ -808,7 +1372,7 @@ static void igbinary_unserialize_variant(igbinary_unserialize_data *igsd, Varian
 		case igbinary_type_string8:
 		case igbinary_type_string16:
 		case igbinary_type_string32:
-			v = igbinary_unserialize_chararray(igsd, t);
+			v = igbinary_unserialize_chararray(igsd, t, false);
 			break;
 		case igbinary_type_string_id8:
 		case igbinary_type_string_id16:
@@ -832,25 +1396,1092 @@ static void igbinary_unserialize_variant(igbinary_unserialize_data *igsd, Varian
 	}
 }
 /* }}} */
+/* {{{ igbinary_unserialize_skip_stats */
+/** Limits checked and counts collected by the igbinary_unserialize_skip_* functions for igbinary_validate. */
+struct igbinary_unserialize_skip_stats {
+	size_t max_depth;			/**< Deepest nesting of arrays and objects allowed. */
+	size_t max_elements;		/**< Most array elements and object properties allowed in total. */
+	size_t max_string_length;	/**< Longest string, class name or Serializable data allowed. */
+
+	size_t depth;				/**< Nesting of the array or object being skipped. */
+	size_t deepest;				/**< Deepest nesting seen. */
+	size_t elements;			/**< Array elements and object properties seen. */
+	Array classes;				/**< Number of objects of each class name. */
+};
+/* }}} */
+/* {{{ igbinary_unserialize_skip_data */
+/**
+ * Counts what the igbinary_unserialize_skip_* functions moved past, so that the string ids and reference ids
+ * in the rest of the data can be checked and resolved.
+ */
+struct igbinary_unserialize_skip_data {
+	size_t strings;					/**< Number of strings defined so far, i.e. the next string id. */
+	size_t references;				/**< Number of reference ids defined so far. */
+	req::vector<bool>* referenced;	/**< If non-null, has an entry for each reference id, set if a ref or objref points back to it. */
+	/**
+	 * If true, adds placeholders for the skipped strings and references to igsd, so that unserializing can continue after them.
+	 * Indexed containers are then skipped without looking inside.
+	 */
+	bool define;
+	bool record;					/**< If true, adds the offsets of the skipped strings to igsd->skipped_strings, even if define is false. */
+	igbinary_unserialize_skip_stats* stats;  /**< If non-null, limits to check and counts to collect. Requires record. */
+};
+/* }}} */
+static void igbinary_unserialize_skip_variant(igbinary_unserialize_data *igsd, igbinary_unserialize_skip_data *skip);
+/* {{{ igbinary_unserialize_skip_reference */
+/** Defines the next reference id, where igbinary_unserialize_variant would add to igsd->references. */
+inline static void igbinary_unserialize_skip_reference(igbinary_unserialize_data *igsd, igbinary_unserialize_skip_data *skip) {
+	skip->references++;
+	if (skip->referenced != nullptr) {
+		skip->referenced->push_back(false);
+	}
+	if (skip->define) {
+		igsd->references.push_back(nullptr);
+	}
+}
+/* }}} */
+/* {{{ igbinary_unserialize_skip_chararray */
+/**
+ * Moves past the string (or class name) of type t whose type is at offset, and defines the next string id.
+ * Returns its length. The string ends at igsd->buffer_offset.
+ */
+inline static size_t igbinary_unserialize_skip_chararray(igbinary_unserialize_data *igsd, igbinary_unserialize_skip_data *skip, enum igbinary_type t, enum igbinary_type type8, size_t offset) {
+	const size_t l = igbinary_unserialize_len(igsd, t, type8, "igbinary_unserialize_chararray");
+	igbinary_unserialize_advance(igsd, l, "igbinary_unserialize_chararray");
+	if (UNLIKELY(skip->stats != nullptr) && l > skip->stats->max_string_length) {
+		throw IgbinaryWarning("igbinary_validate: string of %llu bytes at offset %llu is longer than max_string_length", (unsigned long long) l, (unsigned long long) offset);
+	}
+	if (skip->define || skip->record) {
+		igsd->skipped_strings.emplace_back(skip->strings, offset);
+	}
+	if (skip->define) {
+		igsd->strings.emplace_back();
+	}
+	skip->strings++;
+	return l;
+}
+/* }}} */
+/* {{{ igbinary_unserialize_skip_scalar_type */
+/** Returns true if t is the type of a scalar (null, bool, long, double or string). */
+inline static bool igbinary_unserialize_skip_scalar_type(enum igbinary_type t) {
+	switch (t) {
+		case igbinary_type_null:
+		case igbinary_type_bool_false:
+		case igbinary_type_bool_true:
+		case igbinary_type_long8p:
+		case igbinary_type_long8n:
+		case igbinary_type_long16p:
+		case igbinary_type_long16n:
+		case igbinary_type_long32p:
+		case igbinary_type_long32n:
+		case igbinary_type_long64p:
+		case igbinary_type_long64n:
+		case igbinary_type_double:
+		case igbinary_type_string_empty:
+		case igbinary_type_string_id8:
+		case igbinary_type_string_id16:
+		case igbinary_type_string_id32:
+		case igbinary_type_string8:
+		case igbinary_type_string16:
+		case igbinary_type_string32:
+			return true;
+		default:
+			return false;
+	}
+}
+/* }}} */
+/* {{{ igbinary_unserialize_skip_scalar */
+/** Moves past the scalar of type t, without creating it. Returns false if t is not a scalar type. */
+inline static bool igbinary_unserialize_skip_scalar(igbinary_unserialize_data *igsd, igbinary_unserialize_skip_data *skip, enum igbinary_type t) {
+	switch (t) {
+		case igbinary_type_null:
+		case igbinary_type_bool_false:
+		case igbinary_type_bool_true:
+		case igbinary_type_string_empty:
+			return true;
+		case igbinary_type_long8p:
+		case igbinary_type_long8n:
+		case igbinary_type_long16p:
+		case igbinary_type_long16n:
+		case igbinary_type_long32p:
+		case igbinary_type_long32n:
+		case igbinary_type_long64p:
+		case igbinary_type_long64n:
+			igbinary_unserialize_long(igsd, t);  // Checks the bounds of 64 bit longs.
+			return true;
+		case igbinary_type_double:
+			igbinary_unserialize_advance(igsd, 8, "igbinary_unserialize_double");
+			return true;
+		case igbinary_type_string_id8:
+		case igbinary_type_string_id16:
+		case igbinary_type_string_id32:
+			if (igbinary_unserialize_len(igsd, t, igbinary_type_string_id8, "igbinary_unserialize_string") >= skip->strings) {
+				throw IgbinaryWarning("igbinary_unserialize_string: string index is out-of-bounds");
+			}
+			return true;
+		case igbinary_type_string8:
+		case igbinary_type_string16:
+		case igbinary_type_string32:
+			igbinary_unserialize_skip_chararray(igsd, skip, t, igbinary_type_string8, igsd->buffer_offset - 1);
+			return true;
+		default:
+			return false;
+	}
+}
+/* }}} */
+/* {{{ igbinary_unserialize_skip_entries */
+/**
+ * Moves past the n keys and values of an array, dict or of an object's properties.
+ * The entries of a vec have no keys (has_keys is false), and those of a keyset have no values (has_values is false).
+ * The values of vecs, dicts and collections can't be PHP references (allow_refs is false).
+ */
+static void igbinary_unserialize_skip_entries(igbinary_unserialize_data *igsd, igbinary_unserialize_skip_data *skip, size_t n, const char* where, bool has_keys = true, bool has_values = true, bool allow_refs = true) {
+	/* n cannot be larger than the number of minimum "objects" in the array */
+	if (n > igsd->buffer_size - igsd->buffer_offset) {
+		throw IgbinaryWarning("%s: data size %llu smaller that requested array length %llu.", where, (long long)(igsd->buffer_size - igsd->buffer_offset), (long long) n);
+	}
+	if (UNLIKELY(skip->stats != nullptr)) {
+		igbinary_unserialize_skip_stats* stats = skip->stats;
+		stats->elements += n;
+		if (stats->elements > stats->max_elements) {
+			throw IgbinaryWarning("igbinary_validate: more than max_elements (%llu) array elements and object properties", (unsigned long long) stats->max_elements);
+		}
+		if (++stats->depth > stats->max_depth) {
+			throw IgbinaryWarning("igbinary_validate: arrays and objects nested deeper than max_depth (%llu) at offset %llu", (unsigned long long) stats->max_depth, (unsigned long long) igsd->buffer_offset);
+		}
+		stats->deepest = std::max(stats->deepest, stats->depth);
+	}
+	for (size_t i = 0; i < n; i++) {
+		if (!has_keys) {
+			if (!allow_refs) {
+				igbinary_unserialize_check_hack_value(igsd);
+			}
+			igbinary_unserialize_skip_variant(igsd, skip);
+			continue;
+		}
+		const enum igbinary_type t = (enum igbinary_type) igbinary_unserialize8(igsd, "igbinary_unserialize_array_key");
+		switch (t) {
+			case igbinary_type_null:
+				continue;  // A skipped entry, with no value.
+			case igbinary_type_string_empty:
+			case igbinary_type_long8p:
+			case igbinary_type_long8n:
+			case igbinary_type_long16p:
+			case igbinary_type_long16n:
+			case igbinary_type_long32p:
+			case igbinary_type_long32n:
+			case igbinary_type_long64p:
+			case igbinary_type_long64n:
+			case igbinary_type_string8:
+			case igbinary_type_string16:
+			case igbinary_type_string32:
+			case igbinary_type_string_id8:
+			case igbinary_type_string_id16:
+			case igbinary_type_string_id32:
+				igbinary_unserialize_skip_scalar(igsd, skip, t);
+				break;
+			default:
+				throw IgbinaryWarning("igbinary_unserialize_array_key: Unexpected igbinary_type 0x%02x at offset %lld", (int) t, (long long) igsd->buffer_offset);
+		}
+		if (has_values) {
+			if (!allow_refs) {
+				igbinary_unserialize_check_hack_value(igsd);
+			}
+			igbinary_unserialize_skip_variant(igsd, skip);
+		}
+	}
+	if (UNLIKELY(skip->stats != nullptr)) {
+		skip->stats->depth--;
+	}
+}
+/* }}} */
+/* {{{ igbinary_unserialize_skip_class_name */
+/** Counts an object of the class whose name has string id i, for igbinary_validate. */
+static void igbinary_unserialize_skip_class_name(igbinary_unserialize_data *igsd, igbinary_unserialize_skip_data *skip, size_t i) {
+	Array& classes = skip->stats->classes;
+	if (i < igsd->strings.size()) {
+		// From the dictionary.
+		const String& name = igsd->strings[i];
+		classes.set(name, classes[name].toInt64() + 1);
+		return;
+	}
+	const auto& skipped = igsd->skipped_strings;
+	auto it = std::lower_bound(skipped.begin(), skipped.end(), std::make_pair(i, (size_t) 0));
+	if (it == skipped.end() || it->first != i) {
+		throw IgbinaryWarning("igbinary_unserialize_string: string index is out-of-bounds");
+	}
+	size_t l;
+	const char* data = igbinary_unserialize_chararray_at(igsd, it->second, l);
+	const String name(data, l, CopyString);
+	classes.set(name, classes[name].toInt64() + 1);
+}
+/* }}} */
+/* {{{ igbinary_unserialize_skip_object */
+/** Moves past an object of type t, without looking up its class. */
+static void igbinary_unserialize_skip_object(igbinary_unserialize_data *igsd, igbinary_unserialize_skip_data *skip, enum igbinary_type t) {
+	size_t name_id = skip->strings;
+	if (t >= igbinary_type_object8 && t <= igbinary_type_object32) {
+		igbinary_unserialize_skip_chararray(igsd, skip, t, igbinary_type_object8, igsd->buffer_offset - 1);
+	} else {
+		name_id = igbinary_unserialize_len(igsd, t, igbinary_type_object_id8, "igbinary_unserialize_string");
+		if (name_id >= skip->strings) {
+			throw IgbinaryWarning("igbinary_unserialize_string: string index is out-of-bounds");
+		}
+	}
+	if (UNLIKELY(skip->stats != nullptr)) {
+		igbinary_unserialize_skip_class_name(igsd, skip, name_id);
+	}
+
+	t = (enum igbinary_type) igbinary_unserialize8(igsd, "igbinary_unserialize_object");
+	igbinary_unserialize_skip_reference(igsd, skip);
+	if (t >= igbinary_type_array8 && t <= igbinary_type_array32) {
+		const size_t n = igbinary_unserialize_len(igsd, t, igbinary_type_array8, "igbinary_unserialize_object_contents");
+		igbinary_unserialize_skip_entries(igsd, skip, n, "igbinary_unserialize_object_contents");
+	} else if (t >= igbinary_type_vec8 && t <= igbinary_type_keyset32) {
+		// The elements of a collection. The collection has the reference id, not its elements.
+		const enum igbinary_type type8 = igbinary_unserialize_hack_type8(t);
+		const size_t n = igbinary_unserialize_len(igsd, t, type8, "igbinary_unserialize_collection");
+		igbinary_unserialize_skip_entries(igsd, skip, n, "igbinary_unserialize_collection", type8 != igbinary_type_vec8, type8 != igbinary_type_keyset8, false);
+	} else if (t >= igbinary_type_object_ser8 && t <= igbinary_type_object_ser32) {
+		const size_t n = igbinary_unserialize_len(igsd, t, igbinary_type_object_ser8, "igbinary_unserialize_object_ser");
+		igbinary_unserialize_advance(igsd, n, "igbinary_unserialize_object_ser");
+		if (UNLIKELY(skip->stats != nullptr) && n > skip->stats->max_string_length) {
+			throw IgbinaryWarning("igbinary_validate: serialized data of %llu bytes is longer than max_string_length", (unsigned long long) n);
+		}
+	} else {
+		throw IgbinaryWarning("igbinary_unserialize_object: unknown object inner type '%02x', position %lld", (int)t, (long long)igsd->buffer_offset);
+	}
+}
+/* }}} */
+/* {{{ igbinary_unserialize_skip_object_schema */
+/** Moves past an object with a schema, defining the schema if the data defines it here, without looking up its class. */
+static void igbinary_unserialize_skip_object_schema(igbinary_unserialize_data *igsd, igbinary_unserialize_skip_data *skip, enum igbinary_type t) {
+	const igbinary_unserialize_schema& schema = igbinary_unserialize_schema_id(igsd, t);
+	if (UNLIKELY(skip->stats != nullptr)) {
+		Array& classes = skip->stats->classes;
+		classes.set(schema.class_name, classes[schema.class_name].toInt64() + 1);
+	}
+	igbinary_unserialize_skip_reference(igsd, skip);
+	igbinary_unserialize_skip_entries(igsd, skip, schema.n, "igbinary_unserialize_object_schema", false);
+}
+/* }}} */
+/* {{{ igbinary_unserialize_skip_indexed */
+/**
+ * Moves past an indexed container. When defining placeholders, this is done without looking inside:
+ * The strings it defines are only found if they are used, see igbinary_unserialize_skipped_range_strings.
+ */
+static void igbinary_unserialize_skip_indexed(igbinary_unserialize_data *igsd, igbinary_unserialize_skip_data *skip) {
+	const igbinary_unserialize_indexed_data h = igbinary_unserialize_indexed_header(igsd);
+	if (!skip->define || skip->referenced != nullptr) {
+		const size_t references_start = skip->references;
+		igbinary_unserialize_skip_variant(igsd, skip);
+		igbinary_unserialize_indexed_end(igsd, h);
+		if (skip->references - references_start != h.references) {
+			throw IgbinaryWarning("igbinary_unserialize_indexed: container defined %llu references, expected %llu", (unsigned long long)(skip->references - references_start), (unsigned long long) h.references);
+		}
+		return;
+	}
+	igsd->skipped_ranges.push_back(igbinary_unserialize_skipped_range{skip->strings, h.strings, h.body_offset, skip->references});
+	igsd->strings.resize(igsd->strings.size() + h.strings);
+	igsd->references.resize(igsd->references.size() + h.references, nullptr);
+	skip->strings += h.strings;
+	skip->references += h.references;
+	igsd->buffer_offset = h.body_offset + h.body_len;
+}
+/* }}} */
+/* {{{ igbinary_unserialize_skipped_range_strings */
+/** Adds the offsets of the strings in the skipped indexed container which defined string id i to igsd->skipped_strings. */
+static void igbinary_unserialize_skipped_range_strings(igbinary_unserialize_data *igsd, size_t i) {
+	auto& ranges = igsd->skipped_ranges;
+	auto it = std::find_if(ranges.begin(), ranges.end(), [i](const igbinary_unserialize_skipped_range& range) {
+		return i >= range.strings_start && i - range.strings_start < range.strings;
+	});
+	if (it == ranges.end()) {
+		return;
+	}
+	const igbinary_unserialize_skipped_range range = *it;
+	ranges.erase(it);
+
+	const size_t original_offset = igsd->buffer_offset;
+	igsd->buffer_offset = range.offset;
+	igbinary_unserialize_skip_data skip = {range.strings_start, range.references_start, nullptr, false, true, nullptr};
+	igbinary_unserialize_skip_variant(igsd, &skip);
+	igsd->buffer_offset = original_offset;
+	std::sort(igsd->skipped_strings.begin(), igsd->skipped_strings.end());
+}
+/* }}} */
+/* {{{ igbinary_unserialize_skip_variant */
+/**
+ * Moves past the next value without creating it, defining the same string ids and reference ids as igbinary_unserialize_variant.
+ * Throws IgbinaryWarning for the data igbinary_unserialize_variant would reject, other than unknown classes.
+ */
+static void igbinary_unserialize_skip_variant(igbinary_unserialize_data *igsd, igbinary_unserialize_skip_data *skip) {
+	const enum igbinary_type t = (enum igbinary_type) igbinary_unserialize8(igsd, "igbinary_unserialize_variant");
+	if (igbinary_unserialize_skip_scalar(igsd, skip, t)) {
+		return;
+	}
+	switch (t) {
+		case igbinary_type_ref:
+			{
+				if (igsd->buffer_offset >= igsd->buffer_size) {
+					igbinary_unserialize_throw_end_of_data("igbinary_unserialize_variant");
+				}
+				const enum igbinary_type inner = (enum igbinary_type) igsd->buffer[igsd->buffer_offset];
+				igbinary_unserialize_skip_variant(igsd, skip);
+				// Arrays and objects already have a reference id, and references to them don't get another.
+				if (igbinary_unserialize_skip_scalar_type(inner)) {
+					igbinary_unserialize_skip_reference(igsd, skip);
+				}
+			}
+			return;
+		case igbinary_type_objref8:
+		case igbinary_type_objref16:
+		case igbinary_type_objref32:
+		case igbinary_type_ref8:
+		case igbinary_type_ref16:
+		case igbinary_type_ref32:
+			{
+				const size_t n = t >= igbinary_type_objref8 ?
+					igbinary_unserialize_len(igsd, t, igbinary_type_objref8, "igbinary_unserialize_ref") :
+					igbinary_unserialize_len(igsd, t, igbinary_type_ref8, "igbinary_unserialize_ref");
+				if (n >= skip->references) {
+					throw IgbinaryWarning("igbinary_unserialize_ref: invalid reference %u >= %u", (int) n, (int) skip->references);
+				}
+				if (skip->referenced != nullptr) {
+					(*skip->referenced)[n] = true;
+				}
+			}
+			return;
+		case igbinary_type_object8:
+		case igbinary_type_object16:
+		case igbinary_type_object32:
+		case igbinary_type_object_id8:
+		case igbinary_type_object_id16:
+		case igbinary_type_object_id32:
+			igbinary_unserialize_skip_object(igsd, skip, t);
+			return;
+		case igbinary_type_object_schema8:
+		case igbinary_type_object_schema16:
+		case igbinary_type_object_schema32:
+			igbinary_unserialize_skip_object_schema(igsd, skip, t);
+			return;
+		case igbinary_type_array8:
+		case igbinary_type_array16:
+		case igbinary_type_array32:
+			{
+				const size_t n = igbinary_unserialize_len(igsd, t, igbinary_type_array8, "igbinary_unserialize_array");
+				igbinary_unserialize_skip_reference(igsd, skip);
+				igbinary_unserialize_skip_entries(igsd, skip, n, "igbinary_unserialize_array");
+			}
+			return;
+		case igbinary_type_indexed:
+			igbinary_unserialize_skip_indexed(igsd, skip);
+			return;
+		case igbinary_type_vec8:
+		case igbinary_type_vec16:
+		case igbinary_type_vec32:
+		case igbinary_type_dict8:
+		case igbinary_type_dict16:
+		case igbinary_type_dict32:
+		case igbinary_type_keyset8:
+		case igbinary_type_keyset16:
+		case igbinary_type_keyset32:
+			{
+				const enum igbinary_type type8 = igbinary_unserialize_hack_type8(t);
+				const size_t n = igbinary_unserialize_len(igsd, t, type8, "igbinary_unserialize_array");
+				igbinary_unserialize_skip_reference(igsd, skip);
+				igbinary_unserialize_skip_entries(igsd, skip, n, "igbinary_unserialize_array", type8 != igbinary_type_vec8, type8 != igbinary_type_keyset8, false);
+			}
+			return;
+		default:
+			throw IgbinaryWarning("igbinary_unserialize_skip: unknown igbinary_type 0x%02x at offset %lld", (int) t, (long long) igsd->buffer_offset);
+	}
+}
+/* }}} */
+/* {{{ IgbinaryIterator */
+/**
+ * Native data of the IgbinaryIterator objects returned by igbinary_unserialize_iter().
+ * Unserializes one element of the top-level array at a time, keeping the string table and reference ids between elements.
+ *
+ * Elements which later elements refer back to (shared objects and PHP references) are kept in `retained`.
+ * The other elements are freed when the iterator moves past them, so memory use is bounded by the largest element,
+ * the retained values and the string table, instead of the whole array.
+ */
+struct IgbinaryIterator {
+	IgbinaryIterator() = default;
+	IgbinaryIterator(const IgbinaryIterator&) = delete;
+	IgbinaryIterator& operator=(const IgbinaryIterator&) = delete;
+
+	String serialized;					/**< Keeps igsd.buffer alive. */
+	igbinary_unserialize_data igsd;
+	size_t remaining{0};				/**< Number of entries of the top-level array which weren't unserialized yet. */
+	size_t position{0};					/**< Number of calls to next() since the last rewind(). */
+	bool started{false};				/**< True if `referenced` was computed for the current pass over serialized. */
+	bool valid{false};
+	Variant key;
+	Variant value;
+	req::vector<bool> referenced;		/**< Set for each reference id that a ref or objref points back to. */
+	req::hash_map<size_t, Variant> retained;  /**< Copies of the referenced values of previous elements, by reference id. */
+	req::vector<size_t> retained_values;  /**< Ids of the entries of `retained` which aren't PHP references. */
+};
+/* }}} */
+/* {{{ igbinary_iterator_retain_reference */
+/** Moves the target of reference id out of the current element, into it->retained. */
+static void igbinary_iterator_retain_reference(IgbinaryIterator* it, size_t id) {
+	Variant*& ref = it->igsd.references[id];
+	it->retained.erase(id);
+	Variant& copy = it->retained[id];
+	// Copy the raw value, so that a PHP reference stays bound to the same RefData.
+	tvDup(*ref->asTypedValue(), *copy.asTypedValue());
+	if (copy.getRawType() != KindOfRef) {
+		it->retained_values.push_back(id);
+	}
+	ref = &copy;
+}
+/* }}} */
+/* {{{ igbinary_iterator_retain */
+/**
+ * Called after an element was unserialized. Entries of igsd.references point into that element, which is freed by the next call.
+ * Copies the values that later elements refer back to into it->retained, and clears the other pointers.
+ */
+static void igbinary_iterator_retain(IgbinaryIterator* it, size_t references_start) {
+	req::vector<Variant*>& references = it->igsd.references;
+	// A PHP reference to a retained value which wasn't a reference makes the id point at a new reference in this element.
+	for (size_t i = 0; i < it->retained_values.size(); ) {
+		const size_t id = it->retained_values[i];
+		if (references[id] == &it->retained[id]) {
+			i++;
+			continue;
+		}
+		it->retained_values[i] = it->retained_values.back();
+		it->retained_values.pop_back();
+		igbinary_iterator_retain_reference(it, id);
+	}
+	for (size_t id = references_start; id < references.size(); id++) {
+		if (id < it->referenced.size() && it->referenced[id]) {
+			igbinary_iterator_retain_reference(it, id);
+		} else {
+			references[id] = nullptr;
+		}
+	}
+}
+/* }}} */
+/* {{{ igbinary_iterator_next */
+/** Unserializes the next element of the top-level array into it->key and it->value, or marks the iterator as finished. */
+static void igbinary_iterator_next(IgbinaryIterator* it) {
+	igbinary_unserialize_data* igsd = &it->igsd;
+	it->valid = false;
+	it->key = init_null();
+	it->value = init_null();
+	while (it->remaining > 0) {
+		it->remaining--;
+		if (!igbinary_unserialize_array_key(igsd, it->key)) {
+			continue;
+		}
+		const size_t references_start = igsd->references.size();
+		igbinary_unserialize_variant(igsd, it->value, WANT_CLEAR);
+		igbinary_iterator_retain(it, references_start);
+		it->valid = true;
+		for (auto& obj : igsd->wakeup) {
+			obj->invokeWakeup();
+		}
+		igsd->wakeup.clear();
+		igsd->m_overwrittenList = Array();
+		return;
+	}
+}
+/* }}} */
+/* {{{ igbinary_iterator_rewind */
+/**
+ * Unserializes the header and the length of the top-level array, and then the first element.
+ * Before that, scans the array for the reference ids that are referred back to, without creating any values.
+ */
+static void igbinary_iterator_rewind(IgbinaryIterator* it) {
+	if (it->started && it->position == 0) {
+		return;  // Still at the first element.
+	}
+	igbinary_unserialize_data* igsd = &it->igsd;
+	it->started = false;
+	it->position = 0;
+	it->valid = false;
+	it->key = init_null();
+	it->value = init_null();
+	it->retained.clear();
+	it->retained_values.clear();
+	it->referenced.clear();
+	igsd->release(igbinary_context_high_water_mark());
+	igbinary_unserialize_data_init(igsd, reinterpret_cast<const uint8_t*>(it->serialized.data()), it->serialized.size());
+
+	igbinary_unserialize_header(igsd);
+	enum igbinary_type t = (enum igbinary_type) igbinary_unserialize8(igsd, "igbinary_unserialize_iter");
+	if (t == igbinary_type_indexed) {
+		igbinary_unserialize_indexed_header(igsd);
+		t = (enum igbinary_type) igbinary_unserialize8(igsd, "igbinary_unserialize_iter");
+	}
+	if (t < igbinary_type_array8 || t > igbinary_type_array32) {
+		throw IgbinaryWarning("igbinary_unserialize_iter: expected an array, got igbinary_type 0x%02x", (int) t);
+	}
+	const size_t n = igbinary_unserialize_len(igsd, t, igbinary_type_array8, "igbinary_unserialize_iter");
+	const size_t elements_offset = igsd->buffer_offset;
+
+	igbinary_unserialize_skip_data skip = {igsd->strings.size(), 0, &it->referenced, false, false, nullptr};
+	igbinary_unserialize_skip_reference(igsd, &skip);  // The top-level array
+	igbinary_unserialize_skip_entries(igsd, &skip, n, "igbinary_unserialize_iter");
+	if (it->referenced[0]) {
+		throw IgbinaryWarning("igbinary_unserialize_iter: references to the top-level array are not supported");
+	}
+
+	igsd->buffer_offset = elements_offset;
+	igsd->references.push_back(nullptr);  // The top-level array is never created.
+	it->remaining = n;
+	it->started = true;
+	igbinary_iterator_next(it);
+}
+/* }}} */
+/* {{{ igbinary_unserialize_skip_value */
+/** Moves past the next value without creating it, adding placeholders for its strings and references to igsd. */
+static void igbinary_unserialize_skip_value(igbinary_unserialize_data *igsd) {
+	igbinary_unserialize_skip_data skip = {igsd->strings.size(), igsd->references.size(), nullptr, true, false, nullptr};
+	igbinary_unserialize_skip_variant(igsd, &skip);
+}
+/* }}} */
+/* {{{ igbinary_unserialize_path_key_matches */
+/**
+ * Moves past an array key or property name, and returns true if it is key (an int, or a string which isn't an integer).
+ * Sets has_value to false for a skipped entry, which has no value. String keys are compared without being created.
+ */
+static bool igbinary_unserialize_path_key_matches(igbinary_unserialize_data *igsd, const Variant& key, bool& has_value) {
+	const size_t offset = igsd->buffer_offset;
+	const enum igbinary_type t = (enum igbinary_type) igbinary_unserialize8(igsd, "igbinary_unserialize_array_key");
+	has_value = true;
+	switch (t) {
+		case igbinary_type_null:
+			has_value = false;
+			return false;
+		case igbinary_type_string_empty:
+			return key.isString() && key.getStringData()->empty();
+		case igbinary_type_long8p:
+		case igbinary_type_long8n:
+		case igbinary_type_long16p:
+		case igbinary_type_long16n:
+		case igbinary_type_long32p:
+		case igbinary_type_long32n:
+		case igbinary_type_long64p:
+		case igbinary_type_long64n:
+			{
+				const int64_t l = igbinary_unserialize_long(igsd, t);
+				return key.isInteger() && key.toInt64() == l;
+			}
+		case igbinary_type_string8:
+		case igbinary_type_string16:
+		case igbinary_type_string32:
+			{
+				igbinary_unserialize_skip_data skip = {igsd->strings.size(), igsd->references.size(), nullptr, true, false, nullptr};
+				const size_t l = igbinary_unserialize_skip_chararray(igsd, &skip, t, igbinary_type_string8, offset);
+				if (!key.isString()) {
+					return false;
+				}
+				const StringData* k = key.getStringData();
+				return k->size() == (int) l && memcmp(k->data(), igsd->buffer + igsd->buffer_offset - l, l) == 0;
+			}
+		case igbinary_type_string_id8:
+		case igbinary_type_string_id16:
+		case igbinary_type_string_id32:
+			{
+				const String& s = igbinary_unserialize_string(igsd, t);
+				return key.isString() && s.get()->same(key.getStringData());
+			}
+		default:
+			throw IgbinaryWarning("igbinary_unserialize_array_key: Unexpected igbinary_type 0x%02x at offset %lld", (int) t, (long long) igsd->buffer_offset);
+	}
+}
+/* }}} */
+/* {{{ igbinary_unserialize_path_seek */
+/**
+ * Uses the key table of an indexed container to move to the value of key, without looking at the elements before it.
+ * Adds placeholders for the strings and references defined before that element.
+ * Returns false if the container has no such key.
+ */
+static bool igbinary_unserialize_path_seek(igbinary_unserialize_data *igsd, const igbinary_unserialize_indexed_data& h, const Variant& key, size_t strings_start, size_t references_start) {
+	uint32_t hash;
+	if (key.isInteger()) {
+		hash = igbinary_indexed_hash_int(key.toInt64());
+	} else {
+		const StringData* s = key.getStringData();
+		hash = igbinary_indexed_hash_string(s->data(), s->size());
+	}
+	const uint8_t* const table = igsd->buffer + h.table_offset;
+	// Find the first entry with this hash.
+	size_t lo = 0, hi = h.table_len;
+	while (lo < hi) {
+		const size_t mid = lo + (hi - lo) / 2;
+		if (igbinary_load32(table + mid * IGBINARY_INDEXED_ENTRY_SIZE) < hash) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	// The strings of the elements before it are found if they are used, see igbinary_unserialize_skipped_range_strings.
+	igsd->skipped_ranges.push_back(igbinary_unserialize_skipped_range{strings_start, h.strings, h.body_offset, references_start});
+	for (size_t i = lo; i < h.table_len; i++) {
+		const uint8_t* const entry = table + i * IGBINARY_INDEXED_ENTRY_SIZE;
+		if (igbinary_load32(entry) != hash) {
+			break;
+		}
+		const size_t offset = igbinary_load32(entry + 4);
+		const size_t strings = igbinary_load32(entry + 8);
+		const size_t references = igbinary_load32(entry + 12);
+		if (offset >= h.body_len || strings > h.strings || references > h.references) {
+			throw IgbinaryWarning("igbinary_unserialize_path: invalid key table entry %llu", (unsigned long long) i);
+		}
+		// Undo the placeholders added while checking the key of a previous entry with the same hash.
+		const size_t strings_end = strings_start + strings;
+		auto& skipped = igsd->skipped_strings;
+		skipped.erase(std::lower_bound(skipped.begin(), skipped.end(), std::make_pair(strings_end, (size_t) 0)), skipped.end());
+		igsd->strings.resize(strings_end);
+		igsd->references.resize(references_start + references, nullptr);
+
+		igsd->buffer_offset = h.body_offset + offset;
+		bool has_value;
+		if (igbinary_unserialize_path_key_matches(igsd, key, has_value)) {
+			return true;
+		}
+	}
+	return false;
+}
+/* }}} */
+/* {{{ igbinary_unserialize_path_key */
+/** Converts an element of the path passed to igbinary_unserialize_path() to an int or string key, as Hack arrays would use it. */
+static Variant igbinary_unserialize_path_key(const Variant& key) {
+	if (key.isInteger() || key.isString()) {
+		return key;
+	}
+	if (key.isBoolean() || key.isDouble()) {
+		return key.toInt64();
+	}
+	return key.toString();
+}
+/* }}} */
+/* {{{ igbinary_unserialize_path_array_key */
+/** Converts an int or string key to the key PHP arrays and objects would use: strings which are integers ("7") become ints. */
+static Variant igbinary_unserialize_path_array_key(const Variant& key) {
+	int64_t n;
+	if (key.isString() && key.getStringData()->isStrictlyInteger(n)) {
+		return n;
+	}
+	return key;
+}
+/* }}} */
+/* {{{ igbinary_unserialize_path */
+/**
+ * Finds the value at path inside the value at igsd->buffer_offset, skipping the other entries of the arrays and objects on the way,
+ * and unserializes only that value into v. Returns false if there is no value at path.
+ * The keys of path are ints or strings. They are converted as PHP arrays would convert them (see igbinary_unserialize_path_array_key)
+ * only to look them up in PHP arrays and objects: vecs, dicts, keysets and collections keep numeric strings as strings.
+ * Throws IgbinarySkippedReference if a ref or objref on the way, or in the value, is to a value that was skipped.
+ */
+static bool igbinary_unserialize_path(igbinary_unserialize_data *igsd, const req::vector<Variant>& path, Variant& v) {
+	for (const Variant& key : path) {
+		const Variant array_key = igbinary_unserialize_path_array_key(key);
+		enum igbinary_type t = (enum igbinary_type) igbinary_unserialize8(igsd, "igbinary_unserialize_variant");
+		if (t == igbinary_type_ref) {
+			// A reference to an array or object shares the reference id of that array or object.
+			t = (enum igbinary_type) igbinary_unserialize8(igsd, "igbinary_unserialize_variant");
+		}
+		if (t == igbinary_type_indexed) {
+			const size_t strings_start = igsd->strings.size();
+			const size_t references_start = igsd->references.size();
+			const igbinary_unserialize_indexed_data h = igbinary_unserialize_indexed_header(igsd);
+			if (h.table_len > 0) {
+				// Only PHP arrays and objects are indexed.
+				if (!igbinary_unserialize_path_seek(igsd, h, array_key, strings_start, references_start)) {
+					return false;
+				}
+				continue;
+			}
+			t = (enum igbinary_type) igbinary_unserialize8(igsd, "igbinary_unserialize_variant");
+		}
+		igbinary_unserialize_skip_data skip = {igsd->strings.size(), igsd->references.size(), nullptr, true, false, nullptr};
+		if (t >= igbinary_type_object8 && t <= igbinary_type_object_id32) {
+			if (t <= igbinary_type_object32) {
+				igbinary_unserialize_skip_chararray(igsd, &skip, t, igbinary_type_object8, igsd->buffer_offset - 1);
+			} else if (igbinary_unserialize_len(igsd, t, igbinary_type_object_id8, "igbinary_unserialize_string") >= igsd->strings.size()) {
+				throw IgbinaryWarning("igbinary_unserialize_string: string index is out-of-bounds");
+			}
+			t = (enum igbinary_type) igbinary_unserialize8(igsd, "igbinary_unserialize_object");
+			if (t >= igbinary_type_object_ser8 && t <= igbinary_type_object_ser32) {
+				return false;  // The properties of a Serializable object are only known to its unserialize().
+			}
+			// The properties of the object, or the elements of a collection, follow. The object has the reference id.
+		} else if (t >= igbinary_type_object_schema8 && t <= igbinary_type_object_schema32) {
+			// The values of the properties follow, without their names, in the order of the schema's property names.
+			igbinary_unserialize_schema& schema = igbinary_unserialize_schema_id(igsd, t);
+			igbinary_unserialize_schema_names(igsd, schema);
+			igbinary_unserialize_skip_reference(igsd, &skip);
+			if (!array_key.isString()) {
+				return false;
+			}
+			size_t i = 0;
+			while (i < schema.n && !schema.names[i].get()->same(array_key.getStringData())) {
+				i++;
+			}
+			if (i == schema.n) {
+				return false;
+			}
+			for (; i > 0; i--) {
+				igbinary_unserialize_skip_value(igsd);
+			}
+			continue;
+		} else if ((t >= igbinary_type_ref8 && t <= igbinary_type_ref32) || (t >= igbinary_type_objref8 && t <= igbinary_type_objref32)) {
+			// Arrays and objects seen before this one were skipped, and its ancestors aren't created.
+			throw IgbinarySkippedReference(t >= igbinary_type_objref8 ?
+				igbinary_unserialize_len(igsd, t, igbinary_type_objref8, "igbinary_unserialize_ref") :
+				igbinary_unserialize_len(igsd, t, igbinary_type_ref8, "igbinary_unserialize_ref"));
+		}
+		size_t n;
+		// The elements of a PHP array or the properties of an object, or of a dict or Map.
+		const Variant* element_key = &array_key;
+		if (t >= igbinary_type_array8 && t <= igbinary_type_array32) {
+			n = igbinary_unserialize_len(igsd, t, igbinary_type_array8, "igbinary_unserialize_array");
+		} else if (t >= igbinary_type_dict8 && t <= igbinary_type_dict32) {
+			n = igbinary_unserialize_len(igsd, t, igbinary_type_dict8, "igbinary_unserialize_array");
+			element_key = &key;
+		} else if (t >= igbinary_type_vec8 && t <= igbinary_type_vec32) {
+			// The elements of a vec have no keys, so the key is the number of values to skip.
+			n = igbinary_unserialize_len(igsd, t, igbinary_type_vec8, "igbinary_unserialize_array");
+			igbinary_unserialize_skip_reference(igsd, &skip);
+			if (!key.isInteger() || key.toInt64() < 0 || (uint64_t) key.toInt64() >= n) {
+				return false;
+			}
+			for (int64_t i = key.toInt64(); i > 0; i--) {
+				igbinary_unserialize_skip_value(igsd);
+			}
+			continue;
+		} else if (t >= igbinary_type_keyset8 && t <= igbinary_type_keyset32) {
+			// The elements of a keyset are their own keys, and have no elements of their own.
+			n = igbinary_unserialize_len(igsd, t, igbinary_type_keyset8, "igbinary_unserialize_array");
+			igbinary_unserialize_skip_reference(igsd, &skip);
+			if (&key != &path.back()) {
+				return false;
+			}
+			for (size_t i = 0; i < n; i++) {
+				bool has_value;
+				if (igbinary_unserialize_path_key_matches(igsd, key, has_value)) {
+					v = key;
+					return true;
+				}
+			}
+			return false;
+		} else {
+			return false;  // Scalars have no elements.
+		}
+		igbinary_unserialize_skip_reference(igsd, &skip);
+		if (n > igsd->buffer_size - igsd->buffer_offset) {
+			throw IgbinaryWarning("igbinary_unserialize_array: data size %llu smaller that requested array length %llu.", (long long)(igsd->buffer_size - igsd->buffer_offset), (long long) n);
+		}
+
+		bool found = false;
+		for (size_t i = 0; i < n && !found; i++) {
+			bool has_value;
+			found = igbinary_unserialize_path_key_matches(igsd, *element_key, has_value);
+			if (!found && has_value) {
+				igbinary_unserialize_skip_value(igsd);
+			}
+		}
+		if (!found) {
+			return false;
+		}
+	}
+	igbinary_unserialize_variant(igsd, v, WANT_CLEAR);
+	return true;
+}
+/* }}} */
 } // namespace
 
 namespace HPHP {
 
 /** Unserialize the data, or clean up and throw an Exception. Effectively constant, unless __sleep modifies something. */
 void igbinary_unserialize(const uint8_t *buf, size_t buf_len, Variant& v) {
-	igbinary_unserialize_data igsd(buf, buf_len);  // initialized by constructor, freed by destructor
+	IgbinaryContextPool<igbinary_unserialize_data>::Lease lease(*s_unserialize_contexts);  // Released by destructor
+	igbinary_unserialize_data* igsd = lease.get();
+	igbinary_unserialize_data_init(igsd, buf, buf_len);
 	try {
-		igbinary_unserialize_header(&igsd);  // Unserialize header or throw exception.
-		igbinary_unserialize_variant(&igsd, v, WANT_CLEAR);
+		igbinary_unserialize_header(igsd);  // Unserialize header or throw exception.
+		igbinary_unserialize_variant(igsd, v, WANT_CLEAR);
 		/* FIXME finish_wakeup */
 	} catch (IgbinaryWarning &e) {
 		v.setNull();
 		raise_warning(e.getMessage());
 		return;
 	}
-	for (auto& obj : igsd.wakeup) {
+	for (auto& obj : igsd->wakeup) {
 		obj->invokeWakeup();
 	}
 }
 
+/* {{{ igbinary_unserialize_values */
+bool igbinary_unserialize_values(const uint8_t *buf, size_t buf_len, Variant& v) {
+	IgbinaryContextPool<igbinary_unserialize_data>::Lease lease(*s_unserialize_contexts);  // Released by destructor
+	igbinary_unserialize_data* igsd = lease.get();
+	igbinary_unserialize_data_init(igsd, buf, buf_len);
+	igsd->values_only = true;
+	try {
+		igbinary_unserialize_header(igsd);  // Unserialize header or throw exception.
+		igbinary_unserialize_variant(igsd, v, WANT_CLEAR);
+	} catch (IgbinaryWarning &e) {
+		v.setNull();
+		raise_warning(e.getMessage());
+		return false;
+	}
+	return true;
+}
+/* }}} */
+
+/**
+ * Returns the value at path inside the serialized value, or null if there is none, creating only that value.
+ * Falls back to unserializing everything if the value refers to something outside of it.
+ */
+Variant igbinary_unserialize_path(const uint8_t *buf, size_t buf_len, const Array& path) {
+	req::vector<Variant> keys;
+	keys.reserve(path.size());
+	for (ArrayIter iter(path); iter; ++iter) {
+		keys.push_back(igbinary_unserialize_path_key(iter.secondRef()));
+	}
+	{
+		IgbinaryContextPool<igbinary_unserialize_data>::Lease lease(*s_unserialize_contexts);  // Released by destructor
+		igbinary_unserialize_data* igsd = lease.get();
+		igbinary_unserialize_data_init(igsd, buf, buf_len);
+		Variant v;
+		try {
+			igbinary_unserialize_header(igsd);  // Unserialize header or throw exception.
+			if (!igbinary_unserialize_path(igsd, keys, v)) {
+				return init_null();
+			}
+			for (auto& obj : igsd->wakeup) {
+				obj->invokeWakeup();
+			}
+			return v;
+		} catch (IgbinarySkippedReference &e) {
+			// Fall back to unserializing everything.
+		} catch (IgbinaryWarning &e) {
+			raise_warning(e.getMessage());
+			return init_null();
+		}
+	}
+	Variant v;
+	igbinary_unserialize(buf, buf_len, v);
+	for (const Variant& key : keys) {
+		Array props;
+		const ArrayData* arr = nullptr;
+		bool php_keys = true;
+		if (v.isArray()) {
+			arr = v.getArrayData();
+			php_keys = arr->isPHPArray();
+		} else if (v.isObject() && v.getObjectData()->isCollection()) {
+			arr = collections::asArray(v.getObjectData());  // nullptr for a Pair
+			php_keys = false;
+		} else if (v.isObject()) {
+			props = v.toObject()->toArray();
+			arr = props.get();
+		}
+		if (arr == nullptr) {
+			return init_null();
+		}
+		const Variant k = php_keys ? igbinary_unserialize_path_array_key(key) : key;
+		const TypedValue* value = k.isInteger() ? arr->nvGet(k.toInt64()) : arr->nvGet(k.getStringData());
+		if (value == nullptr) {
+			return init_null();
+		}
+		const Variant element = tvAsCVarRef(value);
+		v = element;
+	}
+	return v;
+}
+
+const StaticString
+  s_max_depth("max_depth"),
+  s_max_elements("max_elements"),
+  s_max_string_length("max_string_length"),
+  s_elements("elements"),
+  s_strings("strings"),
+  s_references("references"),
+  s_classes("classes");
+
+/* {{{ igbinary_validate_limit */
+/** Reads the limit called name from limits into limit, which is left unchanged if it isn't set. Returns false if it is negative. */
+static bool igbinary_validate_limit(const Array& limits, const StaticString& name, size_t& limit) {
+	if (!limits.exists(name)) {
+		return true;
+	}
+	const int64_t value = limits[name].toInt64();
+	if (value < 0) {
+		raise_warning("igbinary_validate(): %s must be at least 0", name.data());
+		return false;
+	}
+	limit = (size_t) value;
+	return true;
+}
+/* }}} */
+
+/**
+ * Checks that the serialized data would unserialize without creating any of its values, and returns counts of what it contains,
+ * or false (after a warning) if it is invalid or exceeds one of the limits.
+ */
+Variant igbinary_validate(const uint8_t *buf, size_t buf_len, const Array& limits) {
+	igbinary_unserialize_skip_stats stats = {SIZE_MAX, SIZE_MAX, SIZE_MAX, 0, 0, 0, Array::Create()};
+	for (ArrayIter iter(limits); iter; ++iter) {
+		const Variant key = iter.first();
+		const String name = key.toString();
+		if (!key.isString() || (!name.same(s_max_depth) && !name.same(s_max_elements) && !name.same(s_max_string_length))) {
+			raise_warning("igbinary_validate(): unknown limit \"%s\"", name.data());
+			return false;
+		}
+	}
+	if (!igbinary_validate_limit(limits, s_max_depth, stats.max_depth) ||
+			!igbinary_validate_limit(limits, s_max_elements, stats.max_elements) ||
+			!igbinary_validate_limit(limits, s_max_string_length, stats.max_string_length)) {
+		return false;
+	}
+
+	IgbinaryContextPool<igbinary_unserialize_data>::Lease lease(*s_unserialize_contexts);  // Released by destructor
+	igbinary_unserialize_data* igsd = lease.get();
+	igbinary_unserialize_data_init(igsd, buf, buf_len);
+	// Only the offsets of strings are recorded, so that class names can be looked up by string id.
+	igbinary_unserialize_skip_data skip = {0, 0, nullptr, false, true, &stats};
+	try {
+		igbinary_unserialize_header(igsd);  // Unserialize header or throw exception.
+		skip.strings = igsd->strings.size();  // The strings of the dictionary, if any.
+		igbinary_unserialize_skip_variant(igsd, &skip);
+	} catch (IgbinaryWarning &e) {
+		raise_warning(e.getMessage());
+		return false;
+	}
+	return make_map_array(
+		s_elements, (int64_t) stats.elements,
+		s_max_depth, (int64_t) stats.deepest,
+		s_strings, (int64_t) skip.strings,
+		s_references, (int64_t) skip.references,
+		s_classes, stats.classes
+	);
+}
+
+/* {{{ igbinary_dictionary_train */
+Variant igbinary_dictionary_train(const Array& samples, int64_t max_strings) {
+	if (max_strings < 0) {
+		raise_warning("igbinary_dictionary_train(): max_strings must be at least 0");
+		return false;
+	}
+	// The number of samples which define each string. Strings are only defined once per sample.
+	req::hash_map<std::string, int64_t> counts;
+	for (ArrayIter iter(samples); iter; ++iter) {
+		const Variant& sample = iter.secondRef();
+		if (!sample.isArray() && !sample.isObject()) {
+			continue;  // Top-level scalars never use string ids.
+		}
+		const Variant serialized = igbinary_serialize(sample);
+		if (!serialized.isString()) {
+			return false;
+		}
+		const String s = serialized.toString();
+		IgbinaryContextPool<igbinary_unserialize_data>::Lease lease(*s_unserialize_contexts);  // Released by destructor
+		igbinary_unserialize_data* igsd = lease.get();
+		igbinary_unserialize_data_init(igsd, reinterpret_cast<const uint8_t*>(s.data()), s.size());
+		igbinary_unserialize_skip_data skip = {0, 0, nullptr, false, true, nullptr};
+		try {
+			igbinary_unserialize_header(igsd);
+			igbinary_unserialize_skip_variant(igsd, &skip);
+			for (const auto& skipped : igsd->skipped_strings) {
+				size_t l;
+				const char* data = igbinary_unserialize_chararray_at(igsd, skipped.second, l);
+				counts[std::string(data, l)]++;
+			}
+		} catch (IgbinaryWarning &e) {
+			raise_warning(e.getMessage());
+			return false;
+		}
+	}
+	// A string used by a single sample isn't worth an id. The others save about their length each time they are used.
+	req::vector<std::pair<int64_t, const std::string*>> candidates;
+	for (const auto& count : counts) {
+		if (count.second >= 2) {
+			candidates.emplace_back(count.second * (int64_t) count.first.size(), &count.first);
+		}
+	}
+	std::sort(candidates.begin(), candidates.end(), [](const std::pair<int64_t, const std::string*>& a, const std::pair<int64_t, const std::string*>& b) {
+		return a.first != b.first ? a.first > b.first : *a.second < *b.second;
+	});
+	// The most useful strings get the ids below 256, which take 1 byte.
+	PackedArrayInit result(std::min<size_t>(candidates.size(), (size_t) max_strings));
+	for (size_t i = 0; i < candidates.size() && i < (size_t) max_strings; i++) {
+		result.append(String(candidates[i].second->data(), candidates[i].second->size(), CopyString));
+	}
+	return result.toArray();
+}
+/* }}} */
+
+const StaticString s_IgbinaryIterator("IgbinaryIterator");
+
+/* {{{ igbinary_iterator_call */
+/** Calls f, or ends the iteration with a warning if the data is invalid. */
+template<typename F>
+static void igbinary_iterator_call(IgbinaryIterator* it, F f) {
+	try {
+		f(it);
+	} catch (IgbinaryWarning &e) {
+		it->remaining = 0;
+		it->valid = false;
+		it->key = init_null();
+		it->value = init_null();
+		raise_warning(e.getMessage());
+	}
+}
+/* }}} */
+
+static Variant HHVM_METHOD(IgbinaryIterator, current) {
+	return Native::data<IgbinaryIterator>(this_)->value;
+}
+
+static Variant HHVM_METHOD(IgbinaryIterator, key) {
+	return Native::data<IgbinaryIterator>(this_)->key;
+}
+
+static void HHVM_METHOD(IgbinaryIterator, next) {
+	auto it = Native::data<IgbinaryIterator>(this_);
+	if (it->valid) {
+		it->position++;
+		igbinary_iterator_call(it, igbinary_iterator_next);
+	}
+}
+
+static void HHVM_METHOD(IgbinaryIterator, rewind) {
+	igbinary_iterator_call(Native::data<IgbinaryIterator>(this_), igbinary_iterator_rewind);
+}
+
+static bool HHVM_METHOD(IgbinaryIterator, valid) {
+	return Native::data<IgbinaryIterator>(this_)->valid;
+}
+
+Variant igbinary_unserialize_iter(const String& serialized) {
+	static Class* cls = Unit::lookupClass(s_IgbinaryIterator.get());
+	Object obj{cls};
+	auto it = Native::data<IgbinaryIterator>(obj);
+	it->serialized = serialized;
+	try {
+		igbinary_iterator_rewind(it);
+	} catch (IgbinaryWarning &e) {
+		raise_warning(e.getMessage());
+		return false;
+	}
+	return obj;
+}
+
+void igbinary_iterator_module_init() {
+	HHVM_ME(IgbinaryIterator, current);
+	HHVM_ME(IgbinaryIterator, key);
+	HHVM_ME(IgbinaryIterator, next);
+	HHVM_ME(IgbinaryIterator, rewind);
+	HHVM_ME(IgbinaryIterator, valid);
+	Native::registerNativeDataInfo<IgbinaryIterator>(s_IgbinaryIterator.get(), Native::NDIFlags::NO_COPY);
+}
+
 } // namespace HPHP
@@ -0,0 +1,17 @@
+<?php
+// Lists are unserialized as packed arrays, and converted when a later key is not the next index.
+$x = 'shared';
+$inner = array(1, 2);
+$a = array(0 => &$x, 1 => $inner, 2 => &$x, 'key' => $inner, 10 => &$x);
+$u = igbinary_unserialize(igbinary_serialize($a));
+echo implode(',', array_keys($u)), "\n";
+var_dump($u[1] === $inner, $u['key'] === $inner);
+$u[0] = 'changed';
+var_dump($u[2], $u[10]);
+
+$list = array(1, 'two', array(3), 4.5, null);
+var_dump(igbinary_unserialize(igbinary_serialize($list)) === $list);
+$holes = array(0 => 'a', 2 => 'c');
+var_dump(igbinary_unserialize(igbinary_serialize($holes)) === $holes);
+$reordered = array(1 => 'b', 0 => 'a');
+var_dump(igbinary_unserialize(igbinary_serialize($reordered)) === $reordered);
@@ -0,0 +1,39 @@
+<?php
+// Short array keys and class names are shared between unserialize calls. Modifying them must not affect later calls.
+class InternedKeys {
+	public $id = 1;
+}
+$long = str_repeat('k', 100);
+$data = array('id' => 1, "\0*\0protected" => 2, $long => 3, 'list' => array(new InternedKeys()));
+$s = igbinary_serialize($data);
+for ($i = 0; $i < 2; $i++) {
+	$u = igbinary_unserialize($s);
+	$keys = array_keys($u);
+	$keys[0] .= '_modified';
+	echo implode(',', array_map('strlen', array_keys($u))), "\n";
+	echo $keys[0], "\n";
+	echo get_class($u['list'][0]), "\n";
+}
+var_dump(igbinary_unserialize($s) == $data);
+
+// Keys which are string literals in this file are already static strings, so every unserialized copy shares them.
+// Other keys are copied for each copy, so keeping the copies takes more memory.
+$literal_keys = array(
+	'interned_key_number_one' => 1, 'interned_key_number_two' => 2, 'interned_key_number_three' => 3, 'interned_key_number_four' => 4,
+	'interned_key_number_five' => 5, 'interned_key_number_six' => 6, 'interned_key_number_seven' => 7, 'interned_key_number_eight' => 8,
+);
+$generated_keys = array();
+foreach ($literal_keys as $key => $value) {
+	$generated_keys[strrev($key)] = $value;
+}
+function unserialized_copies_bytes($serialized) {
+	$copies = array();
+	$before = memory_get_usage();
+	for ($i = 0; $i < 1000; $i++) {
+		$copies[] = igbinary_unserialize($serialized);
+	}
+	return memory_get_usage() - $before;
+}
+$generated_bytes = unserialized_copies_bytes(igbinary_serialize($generated_keys));
+$literal_bytes = unserialized_copies_bytes(igbinary_serialize($literal_keys));
+var_dump($literal_bytes < $generated_bytes);
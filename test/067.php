@@ -0,0 +1,45 @@
+<?php
+// igbinary_serialized_size returns the length of igbinary_serialize's output, including for output larger than one chunk.
+class SizedSleep {
+	public $a = 'first';
+	public $b = 'second';
+	public function __sleep() {
+		return array('a');
+	}
+}
+$big = array();
+for ($i = 0; $i < 20000; $i++) {
+	$big[] = array('key' => 'value' . ($i % 100), 'n' => $i * 1000003, 'f' => $i / 7);
+}
+$ref = array(1, 2);
+$values = array(
+	null,
+	true,
+	0,
+	-1,
+	300,
+	-70000,
+	PHP_INT_MAX,
+	~PHP_INT_MAX,
+	1.5,
+	'',
+	'abc',
+	str_repeat('x', 300),
+	str_repeat('y', 70000),
+	array(),
+	array('a' => 'b', 'c' => array('a' => 'b')),
+	array(&$ref, &$ref),
+	new SizedSleep(),
+	$big,
+);
+foreach ($values as $i => $v) {
+	$expected = strlen(igbinary_serialize($v));
+	$actual = igbinary_serialized_size($v);
+	if ($actual !== $expected) {
+		echo "$i: expected $expected, got ";
+		var_dump($actual);
+	}
+}
+var_dump(igbinary_serialized_size(300));
+var_dump(igbinary_serialized_size(array('a' => 'b')));
+echo "Done\n";
@@ -0,0 +1,26 @@
+<?php
+// Serializer and unserializer contexts are reused between calls, including calls nested in __sleep and __wakeup.
+class NestedSleep {
+	public $inner;
+	public $copy;
+	public function __sleep() {
+		$this->copy = igbinary_unserialize(igbinary_serialize(array('nested', 'nested', $this->inner)));
+		return array('inner', 'copy');
+	}
+	public function __wakeup() {
+		$this->copy = igbinary_unserialize(igbinary_serialize($this->copy));
+	}
+}
+$o = new NestedSleep();
+$o->inner = array('x' => 'nested');
+$data = array('nested', $o, $o, 'nested');
+$first = igbinary_serialize($data);
+for ($i = 0; $i < 3; $i++) {
+	$s = igbinary_serialize($data);
+	var_dump($s === $first);
+	$u = igbinary_unserialize($s);
+	var_dump($u[1] === $u[2], $u[1]->copy, $u[3]);
+}
+// A failed call must leave the context clean for the next one.
+var_dump(@igbinary_unserialize("\x00\x00\x00\x02\x14\x02\x11\x01a"));
+var_dump(igbinary_unserialize(igbinary_serialize(array('a' => 'a'))));
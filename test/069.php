@@ -0,0 +1,27 @@
+<?php
+// Many instances of the same class: declared properties, dynamic properties and __wakeup are handled for every instance.
+class LayoutBase {
+	public $base = 'default';
+}
+class LayoutEntity extends LayoutBase {
+	public $id;
+	public $name = 'unnamed';
+	public static $wakeups = 0;
+	public function __wakeup() {
+		self::$wakeups++;
+	}
+}
+$list = array();
+for ($i = 0; $i < 3; $i++) {
+	$o = new LayoutEntity();
+	$o->id = $i;
+	$o->base = "base$i";
+	if ($i === 1) {
+		$o->extra = 'dynamic';
+	}
+	$list[] = $o;
+}
+$u = igbinary_unserialize(igbinary_serialize($list));
+var_dump($u);
+var_dump(LayoutEntity::$wakeups);
+var_dump($u == $list);
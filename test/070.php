@@ -0,0 +1,36 @@
+<?php
+// __sleep results are cached per class. A different list of names from a later instance must still be honored.
+class SleepPlan {
+	public $a;
+	protected $b;
+	private $c;
+	public $names;
+
+	public function __construct($a, $b, $c, $names) {
+		$this->a = $a;
+		$this->b = $b;
+		$this->c = $c;
+		$this->names = $names;
+	}
+
+	public function __sleep() {
+		if ($this->names === null) {
+			return array('a', 'b', 'c');
+		}
+		return $this->names;
+	}
+}
+$dynamic = new SleepPlan(5, 6, 7, array('c', 'dyn'));
+$dynamic->dyn = 'dynamic';
+$list = array(
+	new SleepPlan(1, 2, 3, null),
+	new SleepPlan(3, 4, 5, null),
+	new SleepPlan(4, 5, 6, array('a', 'b')),
+	$dynamic,
+	new SleepPlan(8, 9, 10, null),
+);
+$s = igbinary_serialize($list);
+echo bin2hex(igbinary_serialize($list[1])), "\n";
+foreach (igbinary_unserialize($s) as $o) {
+	var_dump(array_keys(array_filter((array)$o, function ($v) { return $v !== null; })));
+}
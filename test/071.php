@@ -0,0 +1,26 @@
+<?php
+// Objects without __sleep serialize their properties in the same order and with the same names as (array)$obj.
+class SlotsParent {
+	private $secret = 'parent private';
+	protected $shared = 'parent protected';
+	public $redeclared = 'parent public';
+	public static $ignored = 'static';
+}
+class SlotsChild extends SlotsParent {
+	private $secret = 'child private';
+	public $redeclared = 'child public';
+	public $removed = 'unset';
+	public $list = array(1, 2);
+}
+$plain = new SlotsChild();
+$withDynamic = new SlotsChild();
+unset($withDynamic->removed);
+$withDynamic->dynamic = 'dynamic';
+$withDynamic->{'7'} = 'numeric';
+foreach (array($plain, $withDynamic) as $o) {
+	$object = igbinary_serialize($o);
+	$array = igbinary_serialize((array)$o);
+	$prefix = 4 + 2 + strlen(get_class($o));
+	var_dump(substr($object, $prefix) === substr($array, 4));
+	var_dump(igbinary_unserialize($object) == $o);
+}
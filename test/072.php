@@ -0,0 +1,73 @@
+<?php
+// igbinary_serialize_to_stream writes the bytes of igbinary_serialize in chunks of about chunk_size bytes, and reports failed writes.
+class ChunkStream {
+	public static $chunks = array();
+	public static $fail_after = null;
+	public $context;
+
+	public function stream_open($path, $mode, $options, &$opened_path) {
+		return true;
+	}
+
+	public function stream_write($data) {
+		$written = array_sum(array_map('strlen', self::$chunks));
+		if (self::$fail_after !== null && $written + strlen($data) > self::$fail_after) {
+			return 0;
+		}
+		self::$chunks[] = $data;
+		return strlen($data);
+	}
+
+	public function stream_flush() {
+		return true;
+	}
+
+	public function stream_close() {
+	}
+}
+stream_wrapper_register('igchunks', 'ChunkStream');
+
+function write_chunks($value, $chunk_size) {
+	ChunkStream::$chunks = array();
+	$stream = fopen('igchunks://test', 'w');
+	$written = igbinary_serialize_to_stream($stream, $value, $chunk_size);
+	fclose($stream);
+	return $written;
+}
+
+// Chunks are flushed between values, once they hold at least chunk_size bytes.
+$list = array();
+for ($i = 0; $i < 1000; $i++) {
+	$list[] = sprintf('element %08d', $i);
+}
+$expected = igbinary_serialize($list);
+foreach (array(1, 100, 4096, 65536) as $chunk_size) {
+	$written = write_chunks($list, $chunk_size);
+	$chunks = ChunkStream::$chunks;
+	$bounded = true;
+	foreach (array_slice($chunks, 0, -1) as $chunk) {
+		$bounded = $bounded && strlen($chunk) >= $chunk_size && strlen($chunk) < $chunk_size + 64;
+	}
+	echo "$chunk_size: ";
+	var_dump($written === strlen($expected) && implode('', $chunks) === $expected && $bounded);
+}
+var_dump(count(ChunkStream::$chunks));
+
+// Strings just shorter than, as long as, and longer than a chunk are written whole.
+foreach (array(99, 100, 101, 250) as $len) {
+	$value = array(str_repeat('a', $len), 'x', str_repeat('b', $len), str_repeat('a', $len));
+	$written = write_chunks($value, 100);
+	echo "$len: ";
+	var_dump($written === strlen(igbinary_serialize($value)) && implode('', ChunkStream::$chunks) === igbinary_serialize($value));
+}
+
+// A write that fails part way through is reported, along with how much was written before it.
+ChunkStream::$fail_after = 250;
+var_dump(write_chunks($list, 100));
+var_dump(array_sum(array_map('strlen', ChunkStream::$chunks)) <= 250);
+ChunkStream::$fail_after = null;
+
+$stream = fopen('php://memory', 'w+');
+var_dump(igbinary_serialize_to_stream($stream, array('a' => 'b'), 0));
+var_dump(igbinary_serialize_to_stream($stream, array('a' => 'b')));
+echo "Done\n";
@@ -0,0 +1,43 @@
+<?php
+// igbinary_unserialize_iter yields the same elements as igbinary_unserialize, including objects shared between elements.
+class IterEntity {
+	public $id;
+	public $parent;
+	public function __construct($id, $parent = null) {
+		$this->id = $id;
+		$this->parent = $parent;
+	}
+	public function __wakeup() {
+		echo "wakeup {$this->id}\n";
+	}
+}
+$root = new IterEntity(1);
+$data = array(
+	'first' => $root,
+	'name' => 'first',
+	5 => array('name', 'first', 1.5),
+	'child' => new IterEntity(2, $root),
+	'again' => $root,
+);
+$serialized = igbinary_serialize($data);
+$it = igbinary_unserialize_iter($serialized);
+echo get_class($it), "\n";
+$elements = array();
+foreach ($it as $key => $value) {
+	echo "key: ";
+	var_dump($key);
+	$elements[$key] = $value;
+}
+var_dump($elements == igbinary_unserialize($serialized));
+var_dump($elements['first'] === $elements['child']->parent);
+var_dump($elements['first'] === $elements['again']);
+// The iterator can be restarted.
+$count = 0;
+foreach ($it as $value) {
+	$count++;
+}
+var_dump($count);
+var_dump(iterator_to_array(igbinary_unserialize_iter(igbinary_serialize(array()))));
+var_dump(igbinary_unserialize_iter(igbinary_serialize('not an array')));
+// An element of an unknown type is rejected while the elements are skipped, before any of them is created.
+var_dump(igbinary_unserialize_iter("\x00\x00\x00\x02\x14\x01\x06\x00\xff"));
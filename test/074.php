@@ -0,0 +1,30 @@
+<?php
+// igbinary_unserialize_path returns the same value as walking the result of igbinary_unserialize.
+class PathSettings {
+	public $locale = 'en_US';
+	protected $theme = 'dark';
+	public function __wakeup() {
+		echo "wakeup PathSettings\n";
+	}
+}
+$settings = new PathSettings();
+$data = array(
+	'skipped' => array('locale' => 'fr_FR', 'list' => range(1, 20), 'settings' => new PathSettings()),
+	'user' => array(
+		'name' => 'locale',
+		'settings' => $settings,
+		'tags' => array(7 => 'seven', 'locale' => 'skipped'),
+	),
+	'same' => $settings,
+);
+$serialized = igbinary_serialize($data);
+var_dump(igbinary_unserialize_path($serialized, array('user', 'settings', 'locale')));
+var_dump(igbinary_unserialize_path($serialized, array('user', 'name')));
+var_dump(igbinary_unserialize_path($serialized, array('user', 'tags', '7')));
+var_dump(igbinary_unserialize_path($serialized, array('user', 'tags')));
+var_dump(igbinary_unserialize_path($serialized, array('user', 'missing')));
+var_dump(igbinary_unserialize_path($serialized, array('user', 'name', 'x')));
+var_dump(igbinary_unserialize_path($serialized, array()) == igbinary_unserialize($serialized));
+// 'same' refers back to an object in 'user', so everything is unserialized.
+var_dump(igbinary_unserialize_path($serialized, array('same', 'locale')));
+var_dump(igbinary_unserialize_path("\x00\x00\x00\x02\x14\x01\x11", array('a')));
@@ -0,0 +1,46 @@
+<?php
+// igbinary.index_threshold serializes large arrays and objects as indexed containers, which unserialize to the same values.
+class IndexedSettings {
+	public $locale = 'en_US';
+	public $theme = 'dark';
+	public $flags = array(1, 2, 3);
+}
+$settings = new IndexedSettings();
+$data = array(
+	'skipped' => array('locale' => 'fr_FR', 'list' => range(1, 20), 'settings' => new IndexedSettings()),
+	'user' => array(
+		'name' => 'locale',
+		'settings' => $settings,
+		'tags' => array(7 => 'seven', 'locale' => 'skipped', 'x' => 'y'),
+	),
+	'empty' => array(),
+	'same' => $settings,
+);
+$plain = igbinary_serialize($data);
+var_dump(ini_set('igbinary.index_threshold', '3'));
+$indexed = igbinary_serialize($data);
+var_dump(bin2hex(substr($indexed, 4, 1)));
+var_dump(strlen($indexed) > strlen($plain));
+var_dump(igbinary_unserialize($indexed) == igbinary_unserialize($plain));
+var_dump(igbinary_unserialize_path($indexed, array('user', 'settings', 'locale')));
+var_dump(igbinary_unserialize_path($indexed, array('user', 'tags', 7)));
+var_dump(igbinary_unserialize_path($indexed, array('user', 'tags', 'x')));
+var_dump(igbinary_unserialize_path($indexed, array('user', 'missing')));
+var_dump(igbinary_unserialize_path($indexed, array('skipped', 'list', 19)));
+var_dump(igbinary_unserialize_path($indexed, array('same', 'theme')));
+foreach (igbinary_unserialize_iter($indexed) as $key => $value) {
+	echo $key, ': ', gettype($value), "\n";
+}
+
+ini_set('igbinary.index_keys', '0');
+$unkeyed = igbinary_serialize($data);
+var_dump(strlen($unkeyed) < strlen($indexed));
+var_dump(igbinary_unserialize($unkeyed) == igbinary_unserialize($plain));
+var_dump(igbinary_unserialize_path($unkeyed, array('user', 'tags', 'locale')));
+
+// Arrays below the threshold are unchanged.
+var_dump(igbinary_serialize(array(1, 2)) === "\x00\x00\x00\x02\x14\x02\x06\x00\x06\x01\x06\x01\x06\x02");
+ini_set('igbinary.index_threshold', '0');
+var_dump(igbinary_serialize($data) === $plain);
+// A truncated indexed container.
+var_dump(igbinary_unserialize(substr($indexed, 0, 20)));
@@ -0,0 +1,23 @@
+<?php
+// igbinary_validate checks serialized data and counts what it contains, without unserializing it.
+class ValidateFoo {
+	public $x = 1;
+	public $y = array();
+	public function __wakeup() {
+		echo "wakeup ValidateFoo\n";
+	}
+}
+$data = array('a' => array(1, 2, 3), 'o' => new ValidateFoo(), 'p' => new ValidateFoo(), 's' => 'str');
+$serialized = igbinary_serialize($data);
+var_dump(igbinary_validate($serialized));
+var_dump(igbinary_validate(igbinary_serialize(5)));
+// Classes aren't looked up.
+var_dump(igbinary_validate(str_replace('ValidateFoo', 'MissingFooo', $serialized))['classes']);
+var_dump(is_array(igbinary_validate($serialized, array('max_depth' => 3, 'max_elements' => 11, 'max_string_length' => 11))));
+var_dump(igbinary_validate($serialized, array('max_depth' => 2)));
+var_dump(igbinary_validate($serialized, array('max_elements' => 10)));
+var_dump(igbinary_validate($serialized, array('max_string_length' => 5)));
+var_dump(igbinary_validate($serialized, array('depth' => 5)));
+var_dump(igbinary_validate($serialized, array('max_depth' => -1)));
+var_dump(igbinary_validate(substr($serialized, 0, 10)));
+var_dump(igbinary_validate("\x00\x00\x00\x02\x14\x01\x06\x00\x0e\x00"));
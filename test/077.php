@@ -0,0 +1,43 @@
+<?php
+// igbinary_dataset_build writes a file of keyed values, which igbinary_dataset_get reads one value at a time.
+class DatasetValue {
+	public $name;
+	public function __construct($name) {
+		$this->name = $name;
+	}
+}
+function dataset_values() {
+	yield 'one' => 1;
+	yield 2 => array('two', 2.5);
+	yield 'obj' => new DatasetValue('three');
+	yield '' => 'empty key';
+}
+$path = sys_get_temp_dir() . '/igbinary_test_077_' . getmypid() . '.igds';
+var_dump(igbinary_dataset_build($path, dataset_values()));
+var_dump(igbinary_dataset_get($path, 'one'));
+var_dump(igbinary_dataset_get($path, 2));
+var_dump(igbinary_dataset_get($path, '2'));
+var_dump(igbinary_dataset_get($path, 'obj'));
+var_dump(igbinary_dataset_get($path, ''));
+var_dump(igbinary_dataset_get($path, 'missing'));
+var_dump(igbinary_dataset_get($path, array()));
+unlink($path);
+
+$keys = array();
+for ($i = 0; $i < 1000; $i++) {
+	$keys["key$i"] = $i * 2;
+}
+$path2 = $path . '.2';
+var_dump(igbinary_dataset_build($path2, $keys));
+$ok = true;
+foreach ($keys as $key => $value) {
+	$ok = $ok && igbinary_dataset_get($path2, $key) === $value;
+}
+var_dump($ok);
+unlink($path2);
+
+var_dump(igbinary_dataset_write($path, array('a' => 1)));
+$path3 = $path . '.3';
+file_put_contents($path3, str_repeat('x', 100));
+var_dump(igbinary_dataset_get($path3, 'a'));
+unlink($path3);
@@ -0,0 +1,37 @@
+<?php
+// Strings in a registered dictionary are serialized as its string ids.
+class DictUser {
+	public $name;
+	public $email;
+	public function __construct($name) {
+		$this->name = $name;
+		$this->email = "$name@example.com";
+	}
+}
+$samples = array();
+for ($i = 0; $i < 10; $i++) {
+	$samples[] = array('id' => $i, 'status' => 'active', 'user' => new DictUser("user$i"));
+}
+$strings = igbinary_dictionary_train($samples, 8);
+var_dump($strings);
+var_dump(igbinary_dictionary_register(7, $strings));
+// Registering the same strings again is allowed.
+var_dump(igbinary_dictionary_register(7, $strings));
+
+$value = array('id' => 11, 'status' => 'active', 'user' => new DictUser('other'));
+$plain = igbinary_serialize($value);
+$compact = igbinary_serialize($value, 7);
+var_dump(bin2hex(substr($compact, 0, 8)));
+var_dump(strlen($compact) < strlen($plain));
+var_dump(igbinary_unserialize($compact) == $value);
+var_dump(igbinary_unserialize_path($compact, array('user', 'name')));
+var_dump(igbinary_validate($compact)['classes']);
+
+var_dump(igbinary_dictionary_register(8, array('name')));
+var_dump(bin2hex(igbinary_serialize(array('name' => 'x', 'other' => 'name'), 8)));
+
+var_dump(igbinary_dictionary_register(7, array('a')));
+var_dump(igbinary_dictionary_register(0, array('a')));
+var_dump(igbinary_dictionary_register(9, array('a', 'a')));
+var_dump(igbinary_serialize($value, 9));
+var_dump(igbinary_unserialize("\x00\x01\x00\x02\x00\x00\x00\x09\x00"));
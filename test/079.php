@@ -0,0 +1,35 @@
+<?php
+// igbinary.compression_threshold compresses large serialized data, which every unserializing function decompresses.
+class CompressedRow {
+	public $name = 'row';
+	public $tags = array('alpha', 'beta');
+}
+$data = array();
+for ($i = 0; $i < 200; $i++) {
+	$data["key$i"] = array('id' => $i, 'row' => new CompressedRow(), 'text' => str_repeat('lorem ipsum ', 3));
+}
+$plain = igbinary_serialize($data);
+var_dump(ini_set('igbinary.compression_threshold', '100'));
+$compressed = igbinary_serialize($data);
+var_dump(bin2hex(substr($compressed, 0, 4)));
+var_dump(strlen($compressed) < strlen($plain) / 2);
+var_dump(igbinary_unserialize($compressed) == igbinary_unserialize($plain));
+var_dump(igbinary_unserialize_path($compressed, array('key150', 'row', 'tags', 1)));
+$count = 0;
+foreach (igbinary_unserialize_iter($compressed) as $key => $value) {
+	$count++;
+}
+var_dump($count);
+var_dump(igbinary_validate($compressed)['elements'] === igbinary_validate($plain)['elements']);
+// Data below the threshold, or which doesn't get smaller, isn't compressed.
+var_dump(igbinary_serialize(array(1, 2, 3)) === "\x00\x00\x00\x02\x14\x03\x06\x00\x06\x01\x06\x01\x06\x02\x06\x02\x06\x03");
+$random = '';
+for ($i = 0; $i < 200; $i++) {
+	$random .= chr(mt_rand(0, 255));
+}
+var_dump(substr(igbinary_serialize(array($random)), 0, 4) === "\x00\x00\x00\x02");
+
+// A block written by another LZ4 implementation: a single sequence of 2 literals.
+var_dump(igbinary_unserialize("\x00\x02\x00\x02\x00\x00\x00\x02\x20\x14\x00"));
+var_dump(igbinary_unserialize("\x00\x02\x00\x02\x00\x00\x00\x05\x50abc"));
+var_dump(igbinary_unserialize("\x00\x02\x00\x02\xff\xff\xff\xff\x00"));
@@ -0,0 +1,42 @@
+<?hh
+// vec, dict and keyset are serialized with their own types, and unserialized as the same kind of array.
+$values = array(
+	vec[1, 'two', vec[]],
+	dict['a' => 1, '1' => 2, 3 => keyset[]],
+	keyset[1, 'a', '2'],
+	array('vec' => vec[true], 'dict' => dict[]),
+);
+foreach ($values as $value) {
+	$serialized = igbinary_serialize($value);
+	$result = igbinary_unserialize($serialized);
+	var_dump($result === $value);
+	var_dump(igbinary_validate($serialized) !== false);
+}
+var_dump(bin2hex(igbinary_serialize(vec[1, 2])));
+var_dump(bin2hex(igbinary_serialize(keyset['a'])));
+var_dump(igbinary_unserialize(igbinary_serialize(dict['1' => 'x'])));
+// Repeated Hack arrays are written once, like repeated arrays.
+$shared = vec['x', 'y'];
+var_dump(igbinary_unserialize(igbinary_serialize(array($shared, $shared))) === array($shared, $shared));
+
+$nested = igbinary_serialize(dict['list' => vec['a', dict['b' => 'c']], 'set' => keyset['k', 5]]);
+var_dump(igbinary_unserialize_path($nested, array('list', 1, 'b')));
+var_dump(igbinary_unserialize_path($nested, array('list', 2)));
+var_dump(igbinary_unserialize_path($nested, array('set', 5)));
+var_dump(igbinary_unserialize_path($nested, array('set', 'missing')));
+var_dump(igbinary_validate($nested)['elements']);
+// Numeric strings are keys of their own in dicts and keysets, unlike in arrays.
+$numeric = igbinary_serialize(dict['7' => 'string key', 8 => 'int key', 'set' => keyset['7', 9]]);
+var_dump(igbinary_unserialize_path($numeric, array('7')));
+var_dump(igbinary_unserialize_path($numeric, array(7)));
+var_dump(igbinary_unserialize_path($numeric, array('8')));
+var_dump(igbinary_unserialize_path($numeric, array(8)));
+var_dump(igbinary_unserialize_path($numeric, array('set', '7')));
+var_dump(igbinary_unserialize_path($numeric, array('set', 7)));
+var_dump(igbinary_unserialize_path(igbinary_serialize(array('7' => 'array')), array('7')));
+// The same holds when the value refers back to a skipped object, and everything is unserialized.
+$obj = new stdClass();
+$obj->v = 'shared';
+$shared_numeric = igbinary_serialize(array('first' => $obj, 'map' => Map {'7' => $obj}));
+var_dump(igbinary_unserialize_path($shared_numeric, array('map', '7', 'v')));
+var_dump(igbinary_unserialize_path($shared_numeric, array('map', 7, 'v')));
@@ -0,0 +1,31 @@
+<?hh
+// Collections are serialized as their class name and their elements, and unserialized without converting to arrays.
+$row = array('id' => 1);
+$values = array(
+	Vector {1, 'two', $row},
+	Map {'a' => 1, '1' => 2, 3 => Vector {}},
+	Set {1, 'a', '2'},
+	ImmVector {true, null},
+	ImmMap {'k' => 'v'},
+	ImmSet {},
+);
+foreach ($values as $value) {
+	$serialized = igbinary_serialize($value);
+	$result = igbinary_unserialize($serialized);
+	var_dump(get_class($result), $result == $value, count($result));
+	var_dump(igbinary_validate($serialized) !== false);
+}
+var_dump(bin2hex(igbinary_serialize(Vector {1})));
+var_dump(igbinary_unserialize(igbinary_serialize(Map {'1' => 'x', 1 => 'y'})));
+
+// Arrays and objects in a collection can be referred to later, and the collection itself can be.
+$obj = new stdClass();
+$vector = Vector {$obj, $row};
+$result = igbinary_unserialize(igbinary_serialize(array($vector, $obj, $row, $vector)));
+var_dump($result[0][0] === $result[1], $result[2] === $row, $result[0] === $result[3]);
+
+$nested = igbinary_serialize(Map {'list' => Vector {'a', Map {'b' => 'c'}}, 'set' => Set {'k'}});
+var_dump(igbinary_unserialize_path($nested, array('list', 1, 'b')));
+var_dump(igbinary_unserialize_path($nested, array('set', 'k')));
+
+var_dump(igbinary_serialize(Pair {1, 2}));
@@ -0,0 +1,8 @@
+<?php
+// Arrays held only by their parent take reference ids without being tracked, so later refs keep the same ids.
+$i = 5;
+$shared = array($i);
+$value = array(array($i), $shared, $shared, array(array($i + 1), $shared));
+$serialized = igbinary_serialize($value);
+var_dump(bin2hex($serialized));
+var_dump(igbinary_unserialize($serialized) === $value);
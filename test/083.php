@@ -0,0 +1,18 @@
+<?php
+// igbinary.static_array_cache_size caches the serialized form of static arrays, which produces the same data.
+function static_config() {
+	return array('alpha' => 1, 'beta' => 2, 'gamma' => array('x', 'y'), 'delta' => 'alpha',
+		'epsilon' => 1.5, 'zeta' => null, 'eta' => true, 'theta' => array('x', 'y', 'alpha'));
+}
+$config = static_config();
+$payload = array('first' => $config, 'alpha', 'second' => $config, 'nested' => array('k' => $config['gamma']));
+$overlapping = array('alpha', 'x', array('x', 'y'), $config, $config['theta']);
+
+$expected = igbinary_serialize($payload);
+var_dump(ini_set('igbinary.static_array_cache_size', '1048576'));
+for ($i = 0; $i < 2; $i++) {
+	// The first iteration caches the arrays, and the second one uses them.
+	var_dump(igbinary_serialize($payload) === $expected);
+	var_dump(igbinary_unserialize(igbinary_serialize($payload)) === $payload);
+	var_dump(igbinary_unserialize(igbinary_serialize($overlapping)) === $overlapping);
+}
@@ -0,0 +1,18 @@
+<?php
+// igbinary_unserialize_shared caches arrays for all requests, and rejects objects and references.
+$config = array('name' => 'config', 'list' => range(1, 5), 'nested' => array('a' => array('b' => 1.5)), 'vec' => array());
+$serialized = igbinary_serialize($config);
+for ($i = 0; $i < 2; $i++) {
+	$shared = igbinary_unserialize_shared($serialized);
+	var_dump($shared === $config);
+}
+// Changing the result doesn't change the cached array.
+$shared['name'] = 'changed';
+var_dump(igbinary_unserialize_shared($serialized)['name']);
+var_dump(igbinary_unserialize_shared(igbinary_serialize('scalar')));
+
+var_dump(igbinary_unserialize_shared(igbinary_serialize(array(new stdClass()))));
+$with_reference = array(1);
+$with_reference[1] = &$with_reference[0];
+var_dump(igbinary_unserialize_shared(igbinary_serialize($with_reference)));
+var_dump(igbinary_unserialize_shared(substr($serialized, 0, 10)));
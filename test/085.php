@@ -0,0 +1,35 @@
+<?php
+// Objects of a class with a registered schema are serialized as their property values, in the order of the schema.
+class SchemaPoint {
+	public $x = 0;
+	protected $y = 0;
+	private $label = '';
+	public function __construct($x, $y, $label) {
+		$this->x = $x;
+		$this->y = $y;
+		$this->label = $label;
+	}
+}
+var_dump(igbinary_schema_register('SchemaPoint', array('x', 'y', 'label')));
+// Registering the same schema again is allowed.
+var_dump(igbinary_schema_register('SchemaPoint', array('x', 'y', 'label'), 1));
+
+$points = array(new SchemaPoint(1, 2, 'a'), new SchemaPoint(3, 4, 'b'));
+$serialized = igbinary_serialize($points);
+var_dump(bin2hex($serialized));
+var_dump(igbinary_unserialize($serialized) == $points);
+var_dump(igbinary_unserialize_path($serialized, array(1, "\0SchemaPoint\0label")));
+var_dump(igbinary_validate($serialized)['classes']);
+// A version that isn't registered here is unserialized by looking up the property names.
+$other_version = str_replace('0b536368656d61506f696e740601', '0b536368656d61506f696e740602', bin2hex($serialized));
+var_dump(igbinary_unserialize(hex2bin($other_version)) == $points);
+// Objects with dynamic properties are serialized with their property names.
+$dynamic = new SchemaPoint(5, 6, 'c');
+$dynamic->extra = true;
+var_dump(bin2hex(substr(igbinary_serialize($dynamic), 4, 1)));
+var_dump(igbinary_unserialize(igbinary_serialize($dynamic)) == $dynamic);
+
+var_dump(igbinary_schema_register('SchemaPoint', array('x', 'y')));
+var_dump(igbinary_schema_register('SchemaPoint', array('label', 'y', 'x')));
+var_dump(igbinary_schema_register('NoSuchSchemaClass', array()));
+var_dump(igbinary_unserialize_shared($serialized));
@@ -0,0 +1,50 @@
+<?php
+// __sleep plans stay valid while nested instances of the same class, whose __sleep returns other names, are serialized.
+class SleepNode {
+	public $value;
+	public $child;
+	public $extra;
+	public $names;
+
+	public function __construct($value, $child, $names, $extra = 'x') {
+		$this->value = $value;
+		$this->child = $child;
+		$this->names = $names;
+		$this->extra = $extra;
+	}
+
+	public function __sleep() {
+		return $this->names;
+	}
+}
+
+// Serializes another SleepNode from inside __sleep, while the outer call is in the middle of a SleepNode's properties.
+class SleepReentrant {
+	public $a = 1;
+	public $payload;
+
+	public function __sleep() {
+		$this->payload = describe(igbinary_unserialize(igbinary_serialize(new SleepNode(9, null, array('value')))));
+		return array('a', 'payload');
+	}
+}
+
+function describe($node) {
+	if (!is_object($node)) {
+		return var_export($node, true);
+	}
+	$parts = array();
+	foreach ((array)$node as $key => $value) {
+		if ($key !== 'names') {
+			$parts[] = "$key=" . describe($value);
+		}
+	}
+	return '{' . implode(' ', $parts) . '}';
+}
+
+$inner = new SleepNode(3, new SleepReentrant(), array('child', 'extra', 'value'), 'z');
+$middle = new SleepNode(2, $inner, array('child', 'value', 'extra'), 'y');
+$outer = new SleepNode(1, $middle, array('child', 'value'));
+for ($i = 0; $i < 2; $i++) {
+	echo describe(igbinary_unserialize(igbinary_serialize($outer))), "\n";
+}
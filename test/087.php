@@ -0,0 +1,17 @@
+<?hh
+// The values of vecs, dicts and collections can't be PHP references, so data with one there is rejected.
+$malformed = array(
+	'vec' => "\x00\x00\x00\x02\x27\x01\x25\x06\x01",
+	'dict' => "\x00\x00\x00\x02\x2a\x01\x06\x00\x25\x06\x01",
+	'Vector' => "\x00\x00\x00\x02\x17\x09HH\\Vector\x27\x01\x25\x06\x01",
+	'Map' => "\x00\x00\x00\x02\x17\x06HH\\Map\x2a\x01\x06\x00\x25\x06\x01",
+);
+foreach ($malformed as $name => $serialized) {
+	echo "$name\n";
+	var_dump(igbinary_unserialize($serialized));
+	var_dump(igbinary_validate($serialized));
+}
+// A reference to an element of an array inside a vec is still allowed.
+$inner = array(1);
+$inner[1] = &$inner[0];
+var_dump(igbinary_unserialize(igbinary_serialize(vec[$inner])) == vec[$inner]);
@@ -0,0 +1,21 @@
+<?php
+// A process keeps reading the dataset it mapped until igbinary_dataset_close, or until it writes the same path itself.
+$path = sys_get_temp_dir() . '/igbinary_test_088_' . getmypid() . '.igds';
+$other = $path . '.other';
+var_dump(igbinary_dataset_close($path));
+var_dump(igbinary_dataset_build($path, array('version' => 1)));
+var_dump(igbinary_dataset_get($path, 'version'));
+
+// Replaced by another process: this one still reads the file it mapped.
+var_dump(igbinary_dataset_build($other, array('version' => 2)));
+var_dump(igbinary_dataset_close($other));
+rename($other, $path);
+var_dump(igbinary_dataset_get($path, 'version'));
+var_dump(igbinary_dataset_close($path));
+var_dump(igbinary_dataset_close($path));
+var_dump(igbinary_dataset_get($path, 'version'));
+
+// Written by this process: the next lookup maps the new file.
+var_dump(igbinary_dataset_build($path, array('version' => 3)));
+var_dump(igbinary_dataset_get($path, 'version'));
+unlink($path);